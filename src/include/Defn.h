@@ -52,6 +52,15 @@
 # define attribute_hidden
 #endif
 
+/* FIXME: This should be done wih a proper configure test, also making
+   sure that the pthreads library is linked in. LT */
+#ifndef Win32
+# if (defined(__APPLE__) || defined(_REENTRANT) || defined(HAVE_OPENMP)) && \
+     ! defined(HAVE_PTHREAD)
+#  define HAVE_PTHREAD
+# endif
+#endif
+
 #ifdef __MAIN__
 # define extern0 attribute_hidden
 #else
@@ -99,7 +108,18 @@ extern0 SEXP    R_dot_Class;  /* ".Class" */
 extern0 SEXP    R_dot_GenericCallEnv;  /* ".GenericCallEnv" */
 extern0 SEXP    R_dot_GenericDefEnv;  /* ".GenericDefEnv" */
 
-extern0 SEXP	R_StringHash;       /* Global hash of CHARSXPs */
+/* Global hash of CHARSXPs: an open-addressed table, see envir.c.  The
+   CHARSXP in a slot is NULL if empty, or R_NilValue if deleted. */
+typedef struct {
+    SEXP c;
+    unsigned int hash;
+} R_StringSlot;
+typedef struct {
+    R_StringSlot *slots;
+    size_t size, used, deleted;
+} R_StringTable;
+extern0 R_StringTable R_StringHash[2]; /* current, and old while resizing */
+extern0 SEXP	R_MatchCache;       /* match() hash tables, see unique.c */
 
 
  /* writable char access for R internal use only */
@@ -141,10 +161,6 @@ int ENC_KNOWN(SEXP x);
 int SET_CACHED(SEXP x);
 int IS_CACHED(SEXP x);
 #endif
-/* macros and declarations for managing CHARSXP cache */
-# define CXHEAD(x) (x)
-# define CXTAIL(x) ATTRIB(x)
-SEXP (SET_CXTAIL)(SEXP x, SEXP y);
 
 #include "Errormsg.h"
 
@@ -289,7 +305,8 @@ extern int putenv(char *string);
 #endif
 #endif
 
-#define HSIZE	   4119	/* The size of the hash table for symbols */
+#define HSIZE	   4096	/* The initial size of the hash table for symbols,
+			   a power of 2 */
 #define MAXIDSIZE 10000	/* Largest symbol size,
 			   in bytes excluding terminator.
 			   Was 256 prior to 2.13.0, now just a sanity check.
@@ -430,6 +447,13 @@ typedef struct {
 #define IS_SPECIAL_SYMBOL(b) ((b)->sxpinfo.gp & SPECIAL_SYMBOL_MASK)
 #define SET_NO_SPECIAL_SYMBOLS(b) ((b)->sxpinfo.gp |= SPECIAL_SYMBOL_MASK)
 #define UNSET_NO_SPECIAL_SYMBOLS(b) ((b)->sxpinfo.gp &= (~SPECIAL_SYMBOL_MASK))
+
+/* environments the S3 dispatch cache relies on (see objects.c) */
+#define S3_LOOKUP_MASK (1<<13)
+#define IS_S3_LOOKUP_FRAME(e) (ENVFLAGS(e) & S3_LOOKUP_MASK)
+#define MARK_AS_S3_LOOKUP_FRAME(e) \
+  SET_ENVFLAGS(e, ENVFLAGS(e) | S3_LOOKUP_MASK)
+#define MAYBE_S3_METHOD(v) (isFunction(v) || TYPEOF(v) == PROMSXP)
 #define NO_SPECIAL_SYMBOLS(b) ((b)->sxpinfo.gp & SPECIAL_SYMBOL_MASK)
 
 #else /* USE_RINTERNALS */
@@ -656,7 +680,8 @@ LibExtern SEXP*	R_PPStack;	    /* The pointer protection stack */
 /* Evaluation Environment */
 extern0 SEXP	R_CurrentExpr;	    /* Currently evaluating expression */
 extern0 SEXP	R_ReturnedValue;    /* Slot for return-ing values */
-extern0 SEXP*	R_SymbolTable;	    /* The symbol table */
+extern0 SEXP*	R_SymbolTable;	    /* The symbol table, NULL for free slots */
+extern0 int	R_SymbolTableSize;  /* The number of slots in the table */
 #ifdef R_USE_SIGNALS
 extern0 RCNTXT R_Toplevel;	      /* Storage for the toplevel context */
 extern0 RCNTXT* R_ToplevelContext;  /* The toplevel context */
@@ -672,6 +697,12 @@ extern0 int	R_Expressions	INI_as(5000);	/* options(expressions) */
 extern0 int	R_Expressions_keep INI_as(5000);	/* options(expressions) */
 extern0 Rboolean R_KeepSource	INI_as(FALSE);	/* options(keep.source) */
 extern0 Rboolean R_CBoundsCheck	INI_as(FALSE);	/* options(CBoundsCheck) */
+typedef enum {
+    MATPROD_AUTO = 1,		/* BLAS unless NA/NaN present */
+    MATPROD_INTERNAL,		/* always the blocked internal kernel */
+    MATPROD_BLAS		/* always the BLAS */
+} MATPROD_TYPE;
+extern0 MATPROD_TYPE R_Matprod	INI_as(MATPROD_AUTO);	/* options(matprod) */
 extern0 int	R_WarnLength	INI_as(1000);	/* Error/warning max length */
 extern0 int	R_nwarnings	INI_as(50);
 extern uintptr_t R_CStackLimit	INI_as((uintptr_t)-1);	/* C stack limit */
@@ -771,6 +802,8 @@ extern0 R_bcstack_t *R_BCNodeStackBase, *R_BCNodeStackTop, *R_BCNodeStackEnd;
 extern0 IStackval *R_BCIntStackBase, *R_BCIntStackTop, *R_BCIntStackEnd;
 #endif
 extern0 int R_jit_enabled INI_as(0);
+/* Changes of the global variable cache: see envir.c */
+extern0 double R_GlobalCacheVersion INI_as(0);
 extern0 int R_compile_pkgs INI_as(0);
 extern SEXP R_cmpfun(SEXP);
 extern void R_init_jit_enabled(void);
@@ -896,6 +929,7 @@ LibExtern SEXP R_LogicalNAValue INI_as(NULL);
 # define IntegerFromString	Rf_IntegerFromString
 # define internalTypeCheck	Rf_internalTypeCheck
 # define isValidName		Rf_isValidName
+# define installN		Rf_installN
 # define installTrChar		Rf_installTrChar
 # define ItemName		Rf_ItemName
 # define jump_to_toplevel	Rf_jump_to_toplevel
@@ -917,6 +951,7 @@ LibExtern SEXP R_LogicalNAValue INI_as(NULL);
 # define mbtoucs		Rf_mbtoucs
 # define mbcsToUcs2		Rf_mbcsToUcs2
 # define memtrace_report	Rf_memtrace_report
+# define mkCharLenCEs		Rf_mkCharLenCEs
 # define mkCLOSXP		Rf_mkCLOSXP
 # define mkFalse		Rf_mkFalse
 # define mkPROMISE		Rf_mkPROMISE
@@ -1010,6 +1045,9 @@ SEXP R_GetVarLocValue(R_varloc_t);
 SEXP R_GetVarLocSymbol(R_varloc_t);
 Rboolean R_GetVarLocMISSING(R_varloc_t);
 void R_SetVarLocValue(R_varloc_t, SEXP);
+SEXP R_GlobalCacheLoc(SEXP);
+void R_HashFinishSplit(SEXP);
+SEXP R_VisibleFrame(SEXP);
 
 /* deparse option bits: change do_dump if more are added */
 
@@ -1116,6 +1154,8 @@ SEXP matchArgExact(SEXP, SEXP*);
 SEXP matchArgs(SEXP, SEXP, SEXP);
 SEXP matchPar(const char *, SEXP*);
 void memtrace_report(void *, void *);
+void mkCharLenCEs(SEXP, R_xlen_t, const char * const *, const int *,
+		  R_xlen_t, cetype_t);
 SEXP mkCLOSXP(SEXP, SEXP, SEXP);
 SEXP mkFalse(void);
 SEXP mkPRIMSXP (int, int);
@@ -1182,6 +1222,10 @@ void unmarkPhase(void);
 #endif
 SEXP R_LookupMethod(SEXP, SEXP, SEXP, SEXP);
 int usemethod(const char *, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP*);
+void R_S3MethodChanged(SEXP);
+void R_S3BindingChanged(SEXP, SEXP, SEXP, SEXP);
+void R_S3ActiveBinding(SEXP, SEXP);
+void R_S3FlushCache(void);
 SEXP vectorIndex(SEXP, SEXP, int, int, int, SEXP, Rboolean);
 
 #ifdef R_USE_SIGNALS
@@ -1267,6 +1311,7 @@ size_t mbtoucs(unsigned int *wc, const char *s, size_t n);
 size_t wcstoutf8(char *s, const wchar_t *wc, size_t n);
 
 SEXP Rf_installTrChar(SEXP);
+void Rf_installN(SEXP, SEXP *);
 
 const wchar_t *wtransChar(SEXP x); /* from sysutils.c */
 
@@ -1313,6 +1358,7 @@ size_t Rwcstombs(char *s, const wchar_t *wc, size_t n);
 #endif
 
 FILE *RC_fopen(const SEXP fn, const char *mode, const Rboolean expand);
+void R_DetachMappedFile(const char *path, const char *mode);
 int Seql(SEXP a, SEXP b);
 int Scollate(SEXP a, SEXP b);
 
@@ -39,7 +39,7 @@
    We explicitly reserve the right to change the connection
    implementation without a compatibility layer.
  */
-#define R_CONNECTIONS_VERSION 1
+#define R_CONNECTIONS_VERSION 2
 
 /* this allows the opaque pointer definition to be made available 
    in Rinternals.h */
@@ -79,6 +79,9 @@ struct Rconn {
     void *ex_ptr;
     void *private;
     int status; /* for pipes etc */
+    /* read buffer for text-mode reading, NULL if not in use */
+    unsigned char *buff;
+    size_t buff_len, buff_stored_len, buff_pos;
 };
 
 #ifdef  __cplusplus
@@ -62,6 +62,8 @@ int Rconn_fgetc(Rconnection con);
 int Rconn_ungetc(int c, Rconnection con);
 int Rconn_getline(Rconnection con, char *buf, int bufsize);
 int Rconn_printf(Rconnection con, const char *format, ...);
+size_t Rconn_peek(Rconnection con, const char **buf);
+void Rconn_skip(Rconnection con, size_t n);
 Rconnection getConnection(int n);
 Rconnection getConnection_no_err(int n);
 Rboolean switch_stdout(int icon, int closeOnExit);
@@ -80,5 +82,7 @@ int Rsockselect(int nsock, int *insockfd, int *ready, int *write, double timeout
 
 #define set_iconv Rf_set_iconv
 void set_iconv(Rconnection con);
+#define set_buffer Rf_set_buffer
+void set_buffer(Rconnection con);
 #endif
 
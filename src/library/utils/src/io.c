@@ -538,6 +538,58 @@ static void ruleout_types(const char *s, Typecvt_Info *typeInfo, LocalData *data
 }
 
 
+/* The integer and double passes of typeconvert() are done in parallel
+   for long inputs: the workers convert a prefix of 'cvec' into 'rval'
+   and the index returned is the first element the sequential loop has
+   to look at itself, because it does not convert or because the
+   workers leave it alone (non-ASCII strings, for which isBlankString
+   can signal an error).  Elements before that index are final.
+   numerals = "warn.loss" can warn, so is left to the sequential loop.
+ */
+#define TYPECVT_PAR_MIN 10000
+
+static int typeconvert_par(SEXP cvec, SEXP rval, LocalData *data, int i_exact)
+{
+    int len = LENGTH(cvec), first = len, nthreads = 1;
+
+#ifdef _OPENMP
+    if (R_num_math_threads > 0) nthreads = R_num_math_threads;
+#endif
+    if (nthreads < 2 || len < TYPECVT_PAR_MIN || i_exact == NA_INTEGER)
+	return 0;
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) reduction(min:first)
+#endif
+    for (int i = 0; i < len; i++) {
+	SEXP s;
+	const char *tmp;
+	char *endp;
+	Rboolean na;
+
+	if (i > first) continue; /* the rest is redone sequentially */
+	s = STRING_ELT(cvec, i);
+	if (s != NA_STRING && !IS_ASCII(s)) {
+	    first = i;
+	    continue;
+	}
+	tmp = CHAR(s);
+	na = s == NA_STRING || tmp[0] == '\0' || isNAstring(tmp, 1, data)
+	    || isBlankString(tmp);
+	if (TYPEOF(rval) == INTSXP) {
+	    INTEGER(rval)[i] = na ? NA_INTEGER : Strtoi(tmp, 10);
+	    if (!na && INTEGER(rval)[i] == NA_INTEGER) first = i;
+	} else {
+	    if (na) REAL(rval)[i] = NA_REAL;
+	    else {
+		REAL(rval)[i] = Strtod(tmp, &endp, FALSE, data, i_exact);
+		if (!isBlankString(endp)) first = i;
+	    }
+	}
+    }
+    return first;
+}
+
+
 /* type.convert(char, na.strings, as.is, dec, numerals) */
 
 /* This is a horrible hack which is used in read.table to take a
@@ -650,7 +702,7 @@ SEXP typeconvert(SEXP call, SEXP op, SEXP args, SEXP env)
 
     if (!done && typeInfo.isinteger) {
 	PROTECT(rval = allocVector(INTSXP, len));
-	for (i = 0; i < len; i++) {
+	for (i = typeconvert_par(cvec, rval, &data, i_exact); i < len; i++) {
 	    tmp = CHAR(STRING_ELT(cvec, i));
 	    if (STRING_ELT(cvec, i) == NA_STRING || strlen(tmp) == 0
 		|| isNAstring(tmp, 1, &data) || isBlankString(tmp))
@@ -669,7 +721,7 @@ SEXP typeconvert(SEXP call, SEXP op, SEXP args, SEXP env)
 
     if (!done && typeInfo.isreal) {
 	PROTECT(rval = allocVector(REALSXP, len));
-	for (i = 0; i < len; i++) {
+	for (i = typeconvert_par(cvec, rval, &data, i_exact); i < len; i++) {
 	    tmp = CHAR(STRING_ELT(cvec, i));
 	    if (STRING_ELT(cvec, i) == NA_STRING || strlen(tmp) == 0
 		|| isNAstring(tmp, 1, &data) || isBlankString(tmp))
@@ -1019,11 +1071,20 @@ static const char
     return EncodeElement0(x, indx, quote ? '"' : 0, dec);
 }
 
+/* Output buffer of one thread of the fast path below */
+typedef struct wt_buf {
+    char *data;
+    size_t len, size;
+    Rboolean oom;
+} wt_buf;
+
 typedef struct wt_info {
     Rboolean wasopen;
     Rconnection con;
     R_StringBuffer *buf;
     int savedigits;
+    wt_buf *fbuf;
+    int nfbuf;
 } wt_info;
 
 /* utility to cleanup e.g. after interrpts */
@@ -1033,6 +1094,257 @@ static void wt_cleanup(void *data)
     if(!ld->wasopen) ld->con->close(ld->con);
     R_FreeStringBuffer(ld->buf);
     R_print.digits = ld->savedigits;
+    for(int t = 0; t < ld->nfbuf; t++) free(ld->fbuf[t].data);
+    ld->nfbuf = 0;
+}
+
+/* Fast path of writetable().
+
+   When all the columns are logical, integer, double, character or
+   factors with character levels, no string needs translation to the
+   native encoding and the connection does not re-encode its output
+   (where a character that cannot be converted would lose the rest of
+   a block, not just of a cell), the cells are formatted without
+   EncodeElement0 and its static buffers: blocks of rows are formatted
+   in parallel into one buffer per thread, which are then written in
+   order by a single Rconn_printf each.  The output is the same as that of the general
+   code: numbers are formatted by formatReal to 15 significant digits,
+   with a shortcut for doubles with integer values.
+ */
+#define WT_ROWS 2048 /* rows per thread and block */
+#define NB 1000 /* Same as printutils.c */
+
+typedef struct wt_col {
+    SEXP x, levels;
+    R_xlen_t off;
+    Rboolean quote;
+} wt_col;
+
+/* Can translateChar(s) be replaced by CHAR(s)? */
+static R_INLINE Rboolean wt_native(SEXP s)
+{
+    if(IS_ASCII(s) || s == NA_STRING) return TRUE;
+    if(IS_UTF8(s)) return utf8locale;
+    return !IS_LATIN1(s) && !IS_BYTES(s);
+}
+
+static Rboolean wt_fast_col(SEXP x, R_xlen_t off, R_xlen_t n, SEXP levels)
+{
+    switch(TYPEOF(x)) {
+    case LGLSXP:
+    case REALSXP:
+	return isNull(levels);
+    case INTSXP:
+	if(!isNull(levels)) {
+	    int nl = LENGTH(levels), *code = INTEGER(x) + off;
+	    if(TYPEOF(levels) != STRSXP ||
+	       !wt_fast_col(levels, 0, nl, R_NilValue)) return FALSE;
+	    for(R_xlen_t i = 0; i < n; i++)
+		if(code[i] != NA_INTEGER && (code[i] < 1 || code[i] > nl))
+		    return FALSE;
+	}
+	return TRUE;
+    case STRSXP:
+	if(!isNull(levels)) return FALSE;
+	for(R_xlen_t i = 0; i < n; i++)
+	    if(!wt_native(STRING_ELT(x, off + i))) return FALSE;
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
+static char *wt_reserve(wt_buf *b, size_t n)
+{
+    if(b->len + n > b->size) {
+	size_t size = 2 * b->size;
+	char *data;
+	if(size < b->len + n) size = b->len + n;
+	data = realloc(b->data, size);
+	if(!data) {
+	    b->oom = TRUE;
+	    return NULL;
+	}
+	b->data = data;
+	b->size = size;
+    }
+    return b->data + b->len;
+}
+
+static void wt_puts(wt_buf *b, const char *p, size_t n)
+{
+    char *q = wt_reserve(b, n);
+    if(q) {
+	memcpy(q, p, n);
+	b->len += n;
+    }
+}
+
+static void wt_string(wt_buf *b, const char *p, Rboolean quote,
+		      Rboolean qmethod)
+{
+    size_t n = strlen(p);
+    char *q;
+
+    if(!quote) {
+	wt_puts(b, p, n);
+	return;
+    }
+    if(!(q = wt_reserve(b, 2 * n + 2))) return;
+    *q++ = '"';
+    for(; *p; p++) {
+	if(*p == '"') *q++ = qmethod ? '\\' : '"';
+	*q++ = *p;
+    }
+    *q++ = '"';
+    b->len = q - b->data;
+}
+
+static void wt_real(wt_buf *b, double x, char cdec)
+{
+    char buff[NB], fmt[20];
+    int w, d, e;
+
+    /* IEEE allows signed zeros (yuck!) */
+    if (x == 0.0) x = 0.0;
+    if(!R_FINITE(x)) {
+	if(x > 0) wt_puts(b, "Inf", 3); else wt_puts(b, "-Inf", 4);
+	return;
+    }
+    if(fabs(x) < 1e15 && x == (double)(long long) x) {
+	/* As scientific() works out exactly for these: fixed notation
+	   needs as many characters as there are digits, scientific
+	   notation as many as the significant digits plus 4 or 5. */
+	long long v = (long long) x, u = v < 0 ? -v : v;
+	char *q = buff + 24, *p = q;
+	int nd, nsig;
+
+	do *--p = (char) ('0' + u % 10); while(u /= 10);
+	nd = (int)(q - p);
+	for(nsig = nd; nsig > 1 && q[nsig - nd - 1] == '0'; nsig--) ;
+	if(nd <= (nsig > 1) + nsig + 4 + R_print.scipen) {
+	    if(v < 0) *--p = '-';
+	    wt_puts(b, p, q - p);
+	    return;
+	}
+    }
+    formatReal(&x, 1, &w, &d, &e, 0);
+    if(w > NB-1) w = NB-1;
+    if(e) {
+	if(d) sprintf(fmt,"%%#%d.%de", w, d);
+	else sprintf(fmt,"%%%d.%de", w, d);
+    } else
+	sprintf(fmt,"%%%d.%df", w, d);
+    snprintf(buff, NB, fmt, x);
+    buff[NB-1] = '\0';
+    if(cdec != '.') {
+	char *p = strchr(buff, '.');
+	if(p) *p = cdec;
+    }
+    wt_puts(b, buff, strlen(buff));
+}
+
+static void wt_cell(wt_buf *b, wt_col *col, R_xlen_t i, Rboolean qmethod,
+		    const char *cna, char cdec)
+{
+    SEXP x = col->x;
+    char buff[24], *q = buff + 24, *p = q;
+
+    i += col->off;
+    if(isna(x, i)) {
+	wt_puts(b, cna, strlen(cna));
+	return;
+    }
+    switch(TYPEOF(x)) {
+    case LGLSXP:
+	if(LOGICAL(x)[i]) wt_puts(b, "TRUE", 4); else wt_puts(b, "FALSE", 5);
+	break;
+    case INTSXP:
+	if(!isNull(col->levels)) {
+	    wt_string(b, CHAR(STRING_ELT(col->levels, INTEGER(x)[i] - 1)),
+		      col->quote, qmethod);
+	} else {
+	    int v = INTEGER(x)[i];
+	    unsigned int u = v < 0 ? -(unsigned int) v : (unsigned int) v;
+	    do *--p = (char) ('0' + u % 10); while(u /= 10);
+	    if(v < 0) *--p = '-';
+	    wt_puts(b, p, q - p);
+	}
+	break;
+    case REALSXP:
+	wt_real(b, REAL(x)[i], cdec);
+	break;
+    case STRSXP:
+	wt_string(b, CHAR(STRING_ELT(x, i)), col->quote, qmethod);
+	break;
+    default:
+	break;
+    }
+}
+
+static void wt_rows(wt_buf *b, int i0, int i1, wt_col *cols, int nc,
+		    SEXP rnames, Rboolean quote_rn, Rboolean qmethod,
+		    const char *csep, const char *ceol, const char *cna,
+		    char cdec)
+{
+    size_t lsep = strlen(csep), leol = strlen(ceol);
+
+    for(int i = i0; i < i1 && !b->oom; i++) {
+	if(!isNull(rnames)) {
+	    /* translateChar(NA_STRING) is "NA" */
+	    wt_string(b, CHAR(STRING_ELT(rnames, i)), quote_rn, qmethod);
+	    wt_puts(b, csep, lsep);
+	}
+	for(int j = 0; j < nc; j++) {
+	    if(j > 0) wt_puts(b, csep, lsep);
+	    wt_cell(b, cols + j, i, qmethod, cna, cdec);
+	}
+	wt_puts(b, ceol, leol);
+    }
+}
+
+static void wt_fast(wt_info *wi, int nr, wt_col *cols, int nc, SEXP rnames,
+		    Rboolean quote_rn, Rboolean qmethod, const char *csep,
+		    const char *ceol, const char *cna, char cdec)
+{
+    int nthreads = 1;
+
+#ifdef _OPENMP
+    if(R_num_math_threads > 0) nthreads = R_num_math_threads;
+#endif
+    if(nthreads > (nr + WT_ROWS - 1) / WT_ROWS)
+	nthreads = (nr + WT_ROWS - 1) / WT_ROWS;
+    if(nthreads < 1) nthreads = 1;
+    wi->fbuf = (wt_buf *) R_alloc(nthreads, sizeof(wt_buf));
+    for(int t = 0; t < nthreads; t++) {
+	wi->fbuf[t].data = NULL;
+	wi->fbuf[t].size = 0;
+	wi->fbuf[t].oom = FALSE;
+    }
+    wi->nfbuf = nthreads;
+
+    for(int i0 = 0; i0 < nr; i0 += nthreads * WT_ROWS) {
+	int n = nr - i0 < nthreads * WT_ROWS ? nr - i0 : nthreads * WT_ROWS;
+	R_CheckUserInterrupt();
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+#endif
+	for(int t = 0; t < nthreads; t++) {
+	    wt_buf *b = wi->fbuf + t;
+	    b->len = 0;
+	    wt_rows(b, i0 + (int)((double) n * t / nthreads),
+		    i0 + (int)((double) n * (t + 1) / nthreads),
+		    cols, nc, rnames, quote_rn, qmethod, csep, ceol, cna, cdec);
+	    /* and terminate for Rconn_printf */
+	    wt_puts(b, "", 1);
+	}
+	for(int t = 0; t < nthreads; t++)
+	    if(wi->fbuf[t].oom)
+		error(_("cannot allocate buffer in 'write.table'"));
+	for(int t = 0; t < nthreads; t++)
+	    if(wi->fbuf[t].len > 1)
+		Rconn_printf(wi->con, "%s", wi->fbuf[t].data);
+    }
 }
 
 SEXP writetable(SEXP call, SEXP op, SEXP args, SEXP env)
@@ -1098,6 +1410,7 @@ SEXP writetable(SEXP call, SEXP op, SEXP args, SEXP env)
     wi.con = con;
     wi.wasopen = wasopen;
     wi.buf = &strBuf;
+    wi.nfbuf = 0;
     begincontext(&cntxt, CTXT_CCODE, call, R_BaseEnv, R_BaseEnv,
 		 R_NilValue, R_NilValue);
     cntxt.cend = &wt_cleanup;
@@ -1117,6 +1430,20 @@ SEXP writetable(SEXP call, SEXP op, SEXP args, SEXP env)
 	    } else levels[j] = R_NilValue;
 	}
 
+	wt_col *cols = (wt_col *) R_alloc(nc, sizeof(wt_col));
+	Rboolean fast = !con->outconv &&
+	    (isNull(rnames) || wt_fast_col(rnames, 0, nr, R_NilValue));
+	for(int j = 0; j < nc && fast; j++) {
+	    cols[j].x = VECTOR_ELT(x, j);
+	    cols[j].levels = levels[j];
+	    cols[j].off = 0;
+	    cols[j].quote = quote_col[j];
+	    fast = wt_fast_col(cols[j].x, 0, nr, levels[j]);
+	}
+	if(fast) {
+	    wt_fast(&wi, nr, cols, nc, rnames, quote_rn, qmethod, csep, ceol,
+		    cna, sdec[0]);
+	} else
 	for(int i = 0; i < nr; i++) {
 	    if(i % 1000 == 999) R_CheckUserInterrupt();
 	    if(!isNull(rnames))
@@ -1161,6 +1488,20 @@ SEXP writetable(SEXP call, SEXP op, SEXP args, SEXP env)
 	if(XLENGTH(x) != (R_len_t)nr * nc)
 	    error(_("corrupt matrix -- dims not not match length"));
 
+	wt_col *cols = (wt_col *) R_alloc(nc, sizeof(wt_col));
+	Rboolean fast = !con->outconv &&
+	    (isNull(rnames) || wt_fast_col(rnames, 0, nr, R_NilValue));
+	for(int j = 0; j < nc && fast; j++) {
+	    cols[j].x = x;
+	    cols[j].levels = R_NilValue;
+	    cols[j].off = (R_xlen_t) j * nr;
+	    cols[j].quote = quote_col[j];
+	    fast = wt_fast_col(x, cols[j].off, nr, R_NilValue);
+	}
+	if(fast) {
+	    wt_fast(&wi, nr, cols, nc, rnames, quote_rn, qmethod, csep, ceol,
+		    cna, sdec[0]);
+	} else
 	for(int i = 0; i < nr; i++) {
 	    if(i % 1000 == 999) R_CheckUserInterrupt();
 	    if(!isNull(rnames))
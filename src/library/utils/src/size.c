@@ -52,12 +52,16 @@ static R_size_t objectsize(SEXP s)
 	break;
     case LISTSXP:
     case LANGSXP:
-    case BCODESXP:
     case DOTSXP:
 	cnt += objectsize(TAG(s));
 	cnt += objectsize(CAR(s));
 	cnt += objectsize(CDR(s));
 	break;
+    case BCODESXP:
+	/* the TAG holds the global variable cache of the interpreter */
+	cnt += objectsize(CAR(s));
+	cnt += objectsize(CDR(s));
+	break;
     case CLOSXP:
 	cnt += objectsize(FORMALS(s));
 	cnt += objectsize(BODY(s));
@@ -42,6 +42,13 @@ SEXP Rprofmem(SEXP args)
     return do_Rprofmem(CDR(args));
 }
 
+/* from src/main/memory.c */
+SEXP do_Rprofheap(SEXP args);
+SEXP Rprofheap(SEXP args)
+{
+    return do_Rprofheap(CDR(args));
+}
+
 /* from src/main/dounzip.c */
 SEXP Runzip(SEXP args);
 
@@ -28,6 +28,7 @@ SEXP objectSize(SEXP s);
 SEXP unzip(SEXP args);
 SEXP Rprof(SEXP args);
 SEXP Rprofmem(SEXP args);
+SEXP Rprofheap(SEXP args);
 
 SEXP countfields(SEXP args);
 SEXP flushconsole(void);
@@ -178,7 +178,8 @@ void attribute_hidden InitArithmetic()
 /* FIXME: consider using
     tmp = (LDOUBLE)x1 - floor(q) * (LDOUBLE)x2;
  */
-static double myfmod(double x1, double x2)
+/* also used by the byte code interpreter */
+double attribute_hidden myfmod(double x1, double x2)
 {
     if (x2 == 0.0) return R_NaN;
     double q = x1 / x2, tmp = x1 - floor(q) * x2;
@@ -188,7 +189,7 @@ static double myfmod(double x1, double x2)
     return tmp - q * x2;
 }
 
-static double myfloor(double x1, double x2)
+double attribute_hidden myfloor(double x1, double x2)
 {
     double q = x1 / x2, tmp;
 
@@ -582,33 +582,144 @@ SEXP attribute_hidden do_rowscols(SEXP call, SEXP op, SEXP args, SEXP rho)
     return ans;
 }
 
+/* Cache-blocked kernels for the real cases of %*%, crossprod() and
+   tcrossprod().  Unlike the reference BLAS these never skip a
+   multiplication by zero, so NA and NaN propagate as in scalar
+   arithmetic (PR#4582) and they can be used whatever the data.  The
+   columns of the result are split over R_num_math_threads threads.
+
+   A panel of MATPROD_NB rows by MATPROD_KB columns of x (256Kb) is
+   kept in cache while it is applied to MATPROD_NC columns of the
+   result. */
+
+#define MATPROD_NB 256
+#define MATPROD_KB 128
+#define MATPROD_NC 32
+
+#if defined(_OPENMP) && _OPENMP >= 201307
+# define MATPROD_SIMD _Pragma("omp simd")
+# define MATPROD_SIMD_SUM _Pragma("omp simd reduction(+:sum)")
+#else
+# define MATPROD_SIMD
+# define MATPROD_SIMD_SUM
+#endif
+
+static R_INLINE int matprod_nthreads(double work)
+{
+#ifdef _OPENMP
+    /* not worth starting threads for small products */
+    if (R_num_math_threads > 1 && work > 1e6)
+	return R_num_math_threads;
+#endif
+    return 1;
+}
+
+static Rboolean mayHaveNaN(double *x, R_xlen_t n)
+{
+    for (R_xlen_t i = 0; i < n; i++)
+	if (ISNAN(x[i])) return TRUE;
+    return FALSE;
+}
+
+/* z := x %*% op(y), where op(y)[j, k] is y[j * ys + k * yk].
+   x is nrx by ncx, z is nrx by ncz.  If 'upper', only z[i, k] with
+   i <= k are computed (the caller fills in the rest).  This covers
+   %*% (ys = 1, yk = nry) and tcrossprod() (ys = nry, yk = 1). */
+static void internal_axpy_prod(double *x, int nrx, int ncx,
+			       double *y, R_xlen_t ys, R_xlen_t yk,
+			       double *z, int ncz, Rboolean upper)
+{
+    R_xlen_t NRX = nrx;
+    for (R_xlen_t i = 0; i < NRX * ncz; i++) z[i] = 0;
+#ifdef _OPENMP
+    int nthreads = matprod_nthreads((double) nrx * ncx * ncz);
+# pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1)
+#endif
+    for (int k0 = 0; k0 < ncz; k0 += MATPROD_NC) {
+	int k1 = (k0 + MATPROD_NC < ncz) ? k0 + MATPROD_NC : ncz;
+	/* the x panel [i0:i1, j0:j1] is reused for columns k0:k1 of z */
+	for (int j0 = 0; j0 < ncx; j0 += MATPROD_KB) {
+	    int j1 = (j0 + MATPROD_KB < ncx) ? j0 + MATPROD_KB : ncx;
+	    for (int i0 = 0; i0 < nrx; i0 += MATPROD_NB) {
+		int i1 = (i0 + MATPROD_NB < nrx) ? i0 + MATPROD_NB : nrx;
+		for (int k = k0; k < k1; k++) {
+		    double *zk = z + k * NRX;
+		    int ie = (upper && k + 1 < i1) ? k + 1 : i1;
+		    for (int j = j0; j < j1; j++) {
+			double *xj = x + j * NRX;
+			double yjk = y[j * ys + k * yk];
+			MATPROD_SIMD
+			for (int i = i0; i < ie; i++)
+			    zk[i] += xj[i] * yjk;
+		    }
+		}
+	    }
+	}
+    }
+}
+
+/* z := t(x) %*% y by blocked dot products of columns; x is nr by ncx,
+   y is nr by ncy.  'upper' as for internal_axpy_prod. */
+static void internal_dot_prod(double *x, int nr, int ncx,
+			      double *y, int ncy, double *z, Rboolean upper)
+{
+    R_xlen_t NR = nr, NCX = ncx;
+    for (R_xlen_t i = 0; i < NCX * ncy; i++) z[i] = 0;
+#ifdef _OPENMP
+    int nthreads = matprod_nthreads((double) nr * ncx * ncy);
+# pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1)
+#endif
+    for (int k = 0; k < ncy; k++) {
+	double *yk = y + k * NR, *zk = z + k * NCX;
+	int nc = upper ? k + 1 : ncx;
+	for (int l0 = 0; l0 < nr; l0 += MATPROD_NB * MATPROD_KB) {
+	    int l1 = (l0 + MATPROD_NB * MATPROD_KB < nr) ?
+		l0 + MATPROD_NB * MATPROD_KB : nr;
+	    for (int i = 0; i < nc; i++) {
+		double *xi = x + i * NR, sum = 0.0;
+		MATPROD_SIMD_SUM
+		for (int l = l0; l < l1; l++)
+		    sum += xi[l] * yk[l];
+		zk[i] += sum;
+	    }
+	}
+    }
+}
+
+/* Copy the upper triangle of the n by n matrix z to the lower. */
+static void symmetrize(double *z, int n)
+{
+    R_xlen_t N = n;
+    for (int i = 1; i < n; i++)
+	for (int j = 0; j < i; j++) z[i + N * j] = z[j + N * i];
+}
+
+/* Which of the BLAS and the internal kernel to use for the operands,
+   as governed by options(matprod). */
+static Rboolean use_internal(double *x, R_xlen_t nx, double *y, R_xlen_t ny)
+{
+    switch (R_Matprod) {
+    case MATPROD_INTERNAL: return TRUE;
+    case MATPROD_BLAS: return FALSE;
+    default:
+	/* Don't trust the BLAS to handle NA/NaNs correctly: PR#4582
+	 * The test is only O(n) here.
+	 */
+	return mayHaveNaN(x, nx) || (y != x && mayHaveNaN(y, ny));
+    }
+}
+
 static void matprod(double *x, int nrx, int ncx,
 		    double *y, int nry, int ncy, double *z)
 {
     char *transa = "N", *transb = "N";
     double one = 1.0, zero = 0.0;
-    LDOUBLE sum;
-    Rboolean have_na = FALSE;
     R_xlen_t NRX = nrx, NRY = nry;
 
     if (nrx > 0 && ncx > 0 && nry > 0 && ncy > 0) {
-	/* Don't trust the BLAS to handle NA/NaNs correctly: PR#4582
-	 * The test is only O(n) here.
-	 */
-	for (R_xlen_t i = 0; i < NRX*ncx; i++)
-	    if (ISNAN(x[i])) {have_na = TRUE; break;}
-	if (!have_na)
-	    for (R_xlen_t i = 0; i < NRY*ncy; i++)
-		if (ISNAN(y[i])) {have_na = TRUE; break;}
-	if (have_na) {
-	    for (int i = 0; i < nrx; i++)
-		for (int k = 0; k < ncy; k++) {
-		    sum = 0.0;
-		    for (int j = 0; j < ncx; j++)
-			sum += x[i + j * NRX] * y[j + k * NRY];
-		    z[i + k * NRX] = (double) sum;
-		}
-	} else
+	if (use_internal(x, NRX*ncx, y, NRY*ncy))
+	    internal_axpy_prod(x, nrx, ncx, y, 1, NRY, z, ncy, FALSE);
+	else
 	    F77_CALL(dgemm)(transa, transb, &nrx, &ncy, &ncx, &one,
 			    x, &nrx, y, &nry, &zero, z, &nrx);
     } else /* zero-extent operations should return zeroes */
@@ -665,11 +776,13 @@ static void symcrossprod(double *x, int nr, int nc, double *z)
 {
     char *trans = "T", *uplo = "U";
     double one = 1.0, zero = 0.0;
-    R_xlen_t NC = nc;
+    R_xlen_t NR = nr, NC = nc;
     if (nr > 0 && nc > 0) {
-	F77_CALL(dsyrk)(uplo, trans, &nc, &nr, &one, x, &nr, &zero, z, &nc);
-	for (int i = 1; i < nc; i++)
-	    for (int j = 0; j < i; j++) z[i + NC *j] = z[j + NC * i];
+	if (use_internal(x, NR*nc, x, NR*nc))
+	    internal_dot_prod(x, nr, nc, x, nc, z, TRUE);
+	else
+	    F77_CALL(dsyrk)(uplo, trans, &nc, &nr, &one, x, &nr, &zero, z, &nc);
+	symmetrize(z, nc);
     } else { /* zero-extent operations should return zeroes */
 	for(R_xlen_t i = 0; i < NC*NC; i++) z[i] = 0;
     }
@@ -681,9 +794,13 @@ static void crossprod(double *x, int nrx, int ncx,
 {
     char *transa = "T", *transb = "N";
     double one = 1.0, zero = 0.0;
+    R_xlen_t NRX = nrx, NRY = nry;
     if (nrx > 0 && ncx > 0 && nry > 0 && ncy > 0) {
-	F77_CALL(dgemm)(transa, transb, &ncx, &ncy, &nrx, &one,
-			x, &nrx, y, &nry, &zero, z, &ncx);
+	if (use_internal(x, NRX*ncx, y, NRY*ncy))
+	    internal_dot_prod(x, nrx, ncx, y, ncy, z, FALSE);
+	else
+	    F77_CALL(dgemm)(transa, transb, &ncx, &ncy, &nrx, &one,
+			    x, &nrx, y, &nry, &zero, z, &ncx);
     } else { /* zero-extent operations should return zeroes */
 	R_xlen_t NCX = ncx;
 	for(R_xlen_t i = 0; i < NCX*ncy; i++) z[i] = 0;
@@ -710,12 +827,14 @@ static void symtcrossprod(double *x, int nr, int nc, double *z)
 {
     char *trans = "N", *uplo = "U";
     double one = 1.0, zero = 0.0;
+    R_xlen_t NR = nr;
     if (nr > 0 && nc > 0) {
-	F77_CALL(dsyrk)(uplo, trans, &nr, &nc, &one, x, &nr, &zero, z, &nr);
-	for (int i = 1; i < nr; i++)
-	    for (int j = 0; j < i; j++) z[i + nr *j] = z[j + nr * i];
+	if (use_internal(x, NR*nc, x, NR*nc))
+	    internal_axpy_prod(x, nr, nc, x, NR, 1, z, nr, TRUE);
+	else
+	    F77_CALL(dsyrk)(uplo, trans, &nr, &nc, &one, x, &nr, &zero, z, &nr);
+	symmetrize(z, nr);
     } else { /* zero-extent operations should return zeroes */
-	R_xlen_t NR = nr;
 	for(R_xlen_t i = 0; i < NR*NR; i++) z[i] = 0;
     }
 
@@ -726,11 +845,14 @@ static void tcrossprod(double *x, int nrx, int ncx,
 {
     char *transa = "N", *transb = "T";
     double one = 1.0, zero = 0.0;
+    R_xlen_t NRX = nrx, NRY = nry;
     if (nrx > 0 && ncx > 0 && nry > 0 && ncy > 0) {
-	F77_CALL(dgemm)(transa, transb, &nrx, &nry, &ncx, &one,
-			x, &nrx, y, &nry, &zero, z, &nrx);
+	if (use_internal(x, NRX*ncx, y, NRY*ncy))
+	    internal_axpy_prod(x, nrx, ncx, y, NRY, 1, z, nry, FALSE);
+	else
+	    F77_CALL(dgemm)(transa, transb, &nrx, &nry, &ncx, &one,
+			    x, &nrx, y, &nry, &zero, z, &nrx);
     } else { /* zero-extent operations should return zeroes */
-	R_xlen_t NRX = nrx;
 	for(R_xlen_t i = 0; i < NRX*nry; i++) z[i] = 0;
     }
 }
@@ -403,6 +403,7 @@ SEXP attribute_hidden do_parentenvgets(SEXP call, SEXP op, SEXP args, SEXP rho)
 	!isEnvironment((parent = simple_as_environment(parent))))
 	error(_("'parent' is not an environment"));
 
+    if (IS_S3_LOOKUP_FRAME(env)) R_S3FlushCache();
     SET_ENCLOS(env, parent);
 
     return( CAR(args) );
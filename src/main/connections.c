@@ -99,6 +99,13 @@ static void con_destroy(int i);
 # include <unistd.h>
 #endif
 
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
 #ifdef HAVE_FCNTL_H
 # include <fcntl.h>
 /* Solaris and AIX define open as open64 under some circumstances */
@@ -277,6 +284,105 @@ void set_iconv(Rconnection con)
     }
 }
 
+/* Text-mode connections opened read-only on files, compressed files
+   and URLs read through a buffer of RCONN_BUFF_LEN bytes, so that
+   character-at-a-time readers do not pay for a call through
+   con->fgetc_internal (and a library call) per byte.  Everything
+   which reads from such a connection must go through Rconn_fgetc,
+   buff_read or Rconn_peek/Rconn_skip, and seeks through buff_seek.
+   The buffer is (re)initialized by the open methods.
+ */
+#define RCONN_BUFF_LEN 65536
+
+void set_buffer(Rconnection con)
+{
+    if(con->canread && con->text && !con->canwrite && con->blocking) {
+	if(!con->buff) {
+	    con->buff = (unsigned char *) malloc(RCONN_BUFF_LEN);
+	    /* if this fails, just read unbuffered */
+	    con->buff_len = con->buff ? RCONN_BUFF_LEN : 0;
+	}
+    } else if(con->buff) {
+	free(con->buff);
+	con->buff = NULL;
+	con->buff_len = 0;
+    }
+    con->buff_stored_len = con->buff_pos = 0;
+}
+
+/* Move any unread bytes to the start of the buffer and top it up,
+   returning the number of bytes added */
+static size_t buff_fill(Rconnection con)
+{
+    size_t unread = con->buff_stored_len - con->buff_pos, n;
+
+    if(unread && con->buff_pos)
+	memmove(con->buff, con->buff + con->buff_pos, unread);
+    con->buff_pos = 0;
+    con->buff_stored_len = unread;
+    n = con->read(con->buff + unread, 1, con->buff_len - unread, con);
+    con->buff_stored_len += n;
+    return n;
+}
+
+static R_INLINE int buff_fgetc(Rconnection con)
+{
+    if(con->buff_pos == con->buff_stored_len && buff_fill(con) == 0)
+	return R_EOF;
+    return con->buff[con->buff_pos++];
+}
+
+/* con->read, taking any buffered bytes first */
+static size_t buff_read(void *ptr, size_t size, size_t nitems,
+			Rconnection con)
+{
+    size_t unread, n, total = size * nitems;
+
+    if(!con->buff) return con->read(ptr, size, nitems, con);
+    unread = con->buff_stored_len - con->buff_pos;
+    n = (total < unread) ? total : unread;
+    memcpy(ptr, con->buff + con->buff_pos, n);
+    con->buff_pos += n;
+    if(n < total)
+	n += con->read((char *) ptr + n, 1, total - n, con);
+    return n / size;
+}
+
+/* The file position seen by the user is that of the underlying
+   connection less what is still in the buffer */
+static double buff_seek(Rconnection con, double where, int origin, int rw)
+{
+    size_t unread = con->buff_stored_len - con->buff_pos;
+    double pos;
+
+    if(ISNA(where)) return con->seek(con, where, origin, rw) - unread;
+    if(origin == 2) where -= unread;
+    pos = con->seek(con, where, origin, rw) - unread;
+    con->buff_stored_len = con->buff_pos = 0;
+    return pos;
+}
+
+/* Direct access to the buffer: returns the number of bytes available
+   without conversion and sets *buf to point to them, refilling the
+   buffer if it is empty.  A return of 0 means either EOF or that
+   the caller has to use Rconn_fgetc (no buffer, re-encoding,
+   pushback or a saved character). */
+size_t Rconn_peek(Rconnection con, const char **buf)
+{
+    if(!con->buff || con->inconv || con->nPushBack > 0 ||
+       con->save != -1000 || con->save2 != -1000)
+	return 0;
+    if(con->buff_pos == con->buff_stored_len) buff_fill(con);
+    *buf = (const char *) con->buff + con->buff_pos;
+    return con->buff_stored_len - con->buff_pos;
+}
+
+/* Consume n bytes returned by Rconn_peek */
+void Rconn_skip(Rconnection con, size_t n)
+{
+    con->buff_pos += n;
+}
+
 
 /* ------------------- null connection functions --------------------- */
 
@@ -402,7 +508,7 @@ int dummy_fgetc(Rconnection con)
 	    }
 	    p = con->iconvbuff + con->inavail;
 	    for(i = con->inavail; i < 25; i++) {
-		c = con->fgetc_internal(con);
+		c = con->buff ? buff_fgetc(con) : con->fgetc_internal(con);
 		if(c == R_EOF){ con->EOF_signalled = TRUE; break; }
 		*p++ = (char) c;
 		con->inavail++;
@@ -442,7 +548,9 @@ int dummy_fgetc(Rconnection con)
 	}
 	con->navail--;
 	return *con->next++;
-    } else
+    } else if(con->buff)
+	return buff_fgetc(con);
+    else
 	return con->fgetc_internal(con);
 }
 
@@ -498,6 +606,8 @@ void init_con(Rconnection new, const char *description, int enc,
     new->fflush = &null_fflush;
     new->read = &null_read;
     new->write = &null_write;
+    new->buff = NULL;
+    new->buff_len = new->buff_stored_len = new->buff_pos = 0;
     new->nPushBack = 0;
     new->save = new->save2 = -1000;
     new->private = NULL;
@@ -551,6 +661,7 @@ static Rboolean file_open(Rconnection con)
 #ifdef HAVE_FCNTL
     int fd, flags;
 #endif
+    struct stat sb;
     int mlen = (int) strlen(con->mode); // short
 
     if(strlen(con->description) == 0) {
@@ -618,6 +729,14 @@ static Rboolean file_open(Rconnection con)
     else con->text = TRUE;
     con->save = -1000;
     set_iconv(con);
+    /* buffer regular files only, not stdin, fifos, devices ... */
+    if(strcmp(con->description, "stdin") &&
+       !fstat(fileno(fp), &sb) && S_ISREG(sb.st_mode))
+	set_buffer(con);
+    else if(con->buff) {
+	free(con->buff);
+	con->buff = NULL;
+    }
 
 #ifdef HAVE_FCNTL
     if(!con->blocking) {
@@ -1427,6 +1546,541 @@ SEXP attribute_hidden do_pipe(SEXP call, SEXP op, SEXP args, SEXP env)
 /* ------------------- [bgx]zipped file connections --------------------- */
 
 #include "gzio.h"
+#include <bzlib.h>
+#include <lzma.h>
+
+/* Block-compressed files.
+
+   When more than one thread is in use, gzfile, bzfile and xzfile
+   connections opened for writing buffer what is written and compress
+   it in independent blocks, several at a time.  Each block is written
+   as a complete gzip member, bzip2 stream or xz stream, so the file is
+   a concatenation of streams which the serial code below (and the
+   command-line tools) decompress as usual.  A gzip member carries an
+   extra header field "RB" giving its size and that of its data, and an
+   xz stream ends with an index of its sizes, so a reader allowed
+   several threads can locate the blocks and decompress them in
+   parallel.  bzip2 streams have no room for an index and are always
+   read serially.
+*/
+
+#define BLK_SIZE 1048576	/* data in a gzip block */
+#define BLK_XZSIZE 8388608	/* data in an xz block, and its largest dictionary */
+#define BLK_XZMEM 536870912	/* for compressing xz blocks on all threads */
+#define BLK_MAX 268435456	/* largest block read in parallel */
+#define BLK_GZHEAD 24		/* gzip member header with "RB" field */
+
+typedef struct blkfile {
+    FILE *fp;
+    int type;			/* 0 = gzip, 1 = bzip2, 2 = xz */
+    int compress;
+    int nthreads;
+    Rboolean reading;
+    size_t bsize;		/* (largest) size of the data of a block */
+    size_t csize;		/* largest compressed block, when reading */
+    unsigned char *buf;		/* data of up to 'nthreads' blocks */
+    size_t balloc;		/* bytes allocated for 'buf' when writing */
+    unsigned char **cbuf;	/* and the compressed blocks */
+    size_t *clen, *cmax;	/* their sizes, and allocations when writing */
+    size_t len, pos;		/* bytes in 'buf', next to be read */
+    double base;		/* offset of 'buf' in the data */
+    int nout;			/* blocks written */
+    R_xlen_t nblk, nalloc, next;/* index of a file being read */
+    OFF_T *boff;
+    size_t *bclen, *bulen;
+    double *bstart;
+    lzma_filter filters[2];
+    lzma_options_lzma opt_lzma;
+} *Rblkfile;
+
+static int blk_threads(void)
+{
+#ifdef _OPENMP
+    return R_num_math_threads;
+#else
+    return 1;
+#endif
+}
+
+static void blk_put32(unsigned char *p, uLong x)
+{
+    p[0] = (unsigned char)(x & 0xff); p[1] = (unsigned char)((x >> 8) & 0xff);
+    p[2] = (unsigned char)((x >> 16) & 0xff); p[3] = (unsigned char)(x >> 24);
+}
+
+static uLong blk_get32(const unsigned char *p)
+{
+    return (uLong) p[0] | ((uLong) p[1] << 8) | ((uLong) p[2] << 16) |
+	((uLong) p[3] << 24);
+}
+
+static void blk_free(Rblkfile b)
+{
+    if (b->cbuf)
+	for (int i = 0; i < b->nthreads; i++) free(b->cbuf[i]);
+    free(b->cbuf); free(b->clen); free(b->cmax); free(b->buf);
+    free(b->boff); free(b->bclen); free(b->bulen); free(b->bstart);
+    free(b);
+}
+
+static Rboolean blk_buffers(Rblkfile b)
+{
+    b->buf = malloc(b->nthreads * b->bsize);
+    b->cbuf = calloc(b->nthreads, sizeof(unsigned char *));
+    b->clen = calloc(b->nthreads, sizeof(size_t));
+    if (!b->buf || !b->cbuf || !b->clen) return FALSE;
+    for (int i = 0; i < b->nthreads; i++)
+	if (!(b->cbuf[i] = malloc(b->csize))) return FALSE;
+    return TRUE;
+}
+
+/* Returns NULL if blocks are not to be used, or cannot be, in which
+   case the caller opens the file for serial compression. */
+static Rblkfile
+blk_open_write(const char *path, const char *mode, int type, int compress)
+{
+    Rblkfile b;
+    int nt = blk_threads();
+    uint64_t mem;
+
+    if (nt < 2 || (type == 1 && compress < 1)) return NULL;
+    b = calloc(1, sizeof(struct blkfile));
+    if (!b) return NULL;
+    b->type = type;
+    b->compress = compress;
+    b->nthreads = nt;
+    b->bsize = BLK_SIZE;
+    if (type == 1) b->bsize = 400000 * compress; /* 4 bzip2 blocks */
+    if (type == 2) {
+	uint32_t preset_number = abs(compress);
+	if(compress < 0) preset_number |= LZMA_PRESET_EXTREME;
+	if(lzma_lzma_preset(&b->opt_lzma, preset_number)) {
+	    blk_free(b);
+	    return NULL;
+	}
+	b->filters[0].id = LZMA_FILTER_LZMA2;
+	b->filters[0].options = &(b->opt_lzma);
+	b->filters[1].id = LZMA_VLI_UNKNOWN;
+	/* a dictionary larger than a block would be wasted, and the
+	   encoder needs several times its size */
+	b->bsize = BLK_XZSIZE;
+	if (b->opt_lzma.dict_size > b->bsize)
+	    b->opt_lzma.dict_size = (uint32_t) b->bsize;
+	mem = lzma_raw_encoder_memusage(b->filters);
+	if (mem == UINT64_MAX) {
+	    blk_free(b);
+	    return NULL;
+	}
+	mem += b->bsize + lzma_stream_buffer_bound(b->bsize);
+	if (nt > BLK_XZMEM / mem) nt = (int)(BLK_XZMEM / mem);
+	if (nt < 2) {
+	    blk_free(b);
+	    return NULL;
+	}
+	b->nthreads = nt;
+    }
+    /* the blocks themselves are allocated as they are written */
+    b->cbuf = calloc(b->nthreads, sizeof(unsigned char *));
+    b->clen = calloc(b->nthreads, sizeof(size_t));
+    b->cmax = calloc(b->nthreads, sizeof(size_t));
+    if (!b->cbuf || !b->clen || !b->cmax || !(b->fp = R_fopen(path, mode))) {
+	blk_free(b);
+	return NULL;
+    }
+    return b;
+}
+
+/* a bound on the compressed size of a block of 'n' bytes */
+static size_t blk_bound(Rblkfile b, size_t n)
+{
+    return (b->type == 2) ? lzma_stream_buffer_bound(n) : n + (n >> 6) + 1024;
+}
+
+/* compress 'n' bytes at 'src' into cbuf[i], setting clen[i] to its
+   size or 0 on failure */
+static void blk_compress(Rblkfile b, int i, const unsigned char *src, size_t n)
+{
+    unsigned char *dst = b->cbuf[i];
+
+    b->clen[i] = 0;
+    switch(b->type) {
+    case 0:
+    {
+	z_stream s;
+	int res;
+	memset(&s, 0, sizeof(s));
+	if (deflateInit2(&s, b->compress, Z_DEFLATED, -MAX_WBITS,
+			 MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+	    return;
+	s.next_in = (Bytef *) src; s.avail_in = (uInt) n;
+	s.next_out = dst + BLK_GZHEAD;
+	s.avail_out = (uInt)(b->cmax[i] - BLK_GZHEAD - 8);
+	res = deflate(&s, Z_FINISH);
+	deflateEnd(&s);
+	if (res != Z_STREAM_END) return;
+	n = s.total_in;
+	memset(dst, 0, BLK_GZHEAD);
+	dst[0] = gz_magic[0]; dst[1] = gz_magic[1];
+	dst[2] = Z_DEFLATED; dst[3] = EXTRA_FIELD; dst[9] = OS_CODE;
+	dst[10] = 12; dst[12] = 'R'; dst[13] = 'B'; dst[14] = 8;
+	b->clen[i] = BLK_GZHEAD + s.total_out + 8;
+	blk_put32(dst + 16, b->clen[i]);
+	blk_put32(dst + 20, n);
+	dst += BLK_GZHEAD + s.total_out;
+	blk_put32(dst, crc32(crc32(0L, Z_NULL, 0), src, (uInt) n));
+	blk_put32(dst + 4, n);
+	break;
+    }
+    case 1:
+    {
+	unsigned int m = (unsigned int) b->cmax[i];
+	if (BZ2_bzBuffToBuffCompress((char *) dst, &m, (char *) src,
+				     (unsigned int) n, b->compress, 0, 0)
+	    == BZ_OK)
+	    b->clen[i] = m;
+	break;
+    }
+    case 2:
+    {
+	size_t m = 0;
+	if (lzma_stream_buffer_encode(b->filters, LZMA_CHECK_CRC32, NULL,
+				      src, n, dst, &m, b->cmax[i]) == LZMA_OK)
+	    b->clen[i] = m;
+	break;
+    }
+    }
+}
+
+/* compress and write out the buffered data: an empty file gets one
+   empty block, as the serial code would write */
+static Rboolean blk_flush(Rblkfile b)
+{
+    static unsigned char empty[1];
+    unsigned char *buf = b->buf ? b->buf : empty;
+    int i, m = (int)((b->len + b->bsize - 1) / b->bsize);
+
+    if (m == 0 && b->nout) return TRUE;
+    if (m == 0) m = 1;
+    for (i = 0; i < m; i++) {
+	size_t off = i * b->bsize, need;
+	need = blk_bound(b, (b->len - off < b->bsize) ? b->len - off : b->bsize);
+	if (b->cmax[i] < need) {
+	    unsigned char *p = realloc(b->cbuf[i], need);
+	    if (!p) {
+		warning(_("cannot allocate buffer for compressed block"));
+		return FALSE;
+	    }
+	    b->cbuf[i] = p;
+	    b->cmax[i] = need;
+	}
+    }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(m) schedule(static, 1)
+#endif
+    for (i = 0; i < m; i++) {
+	size_t off = i * b->bsize;
+	blk_compress(b, i, buf + off,
+		     (b->len - off < b->bsize) ? b->len - off : b->bsize);
+    }
+    for (i = 0; i < m; i++) {
+	if (!b->clen[i]) {
+	    warning(_("compression of a block failed"));
+	    return FALSE;
+	}
+	if (fwrite(b->cbuf[i], 1, b->clen[i], b->fp) != b->clen[i]) {
+	    warning(_("write error on compressed file"));
+	    return FALSE;
+	}
+    }
+    b->base += b->len;
+    b->len = 0;
+    b->nout += m;
+    return TRUE;
+}
+
+static Rboolean blk_write(Rblkfile b, const void *ptr, size_t n)
+{
+    const unsigned char *p = ptr;
+    size_t cap = b->nthreads * b->bsize;
+
+    while (n > 0) {
+	size_t k = cap - b->len;
+	if (k > n) k = n;
+	if (b->len + k > b->balloc) {
+	    size_t na = 2 * b->balloc;
+	    unsigned char *buf;
+	    if (na < b->len + k) na = b->len + k;
+	    if (na > cap) na = cap;
+	    if (!(buf = realloc(b->buf, na))) {
+		warning(_("cannot allocate buffer for compressed block"));
+		return FALSE;
+	    }
+	    b->buf = buf;
+	    b->balloc = na;
+	}
+	memcpy(b->buf + b->len, p, k);
+	b->len += k; p += k; n -= k;
+	if (b->len == cap && !blk_flush(b)) return FALSE;
+    }
+    return TRUE;
+}
+
+static Rboolean blk_add(Rblkfile b, OFF_T off, size_t clen, size_t ulen)
+{
+    if (b->nblk == b->nalloc) {
+	R_xlen_t na = b->nalloc ? 2 * b->nalloc : 64;
+	OFF_T *boff = realloc(b->boff, na * sizeof(OFF_T));
+	size_t *bclen, *bulen;
+	if (boff) b->boff = boff;
+	bclen = realloc(b->bclen, na * sizeof(size_t));
+	if (bclen) b->bclen = bclen;
+	bulen = realloc(b->bulen, na * sizeof(size_t));
+	if (bulen) b->bulen = bulen;
+	if (!boff || !bclen || !bulen) return FALSE;
+	b->nalloc = na;
+    }
+    b->boff[b->nblk] = off;
+    b->bclen[b->nblk] = clen;
+    b->bulen[b->nblk++] = ulen;
+    return TRUE;
+}
+
+/* Index a gzip file all of whose members carry the "RB" field */
+static Rboolean blk_index_gz(Rblkfile b)
+{
+    unsigned char h[BLK_GZHEAD];
+    OFF_T off = 0, end;
+
+    if (f_seek(b->fp, 0, SEEK_END)) return FALSE;
+    end = f_tell(b->fp);
+    while (off < end) {
+	size_t clen;
+	if (f_seek(b->fp, off, SEEK_SET) ||
+	    fread(h, 1, BLK_GZHEAD, b->fp) != BLK_GZHEAD)
+	    return FALSE;
+	if (h[0] != gz_magic[0] || h[1] != gz_magic[1] ||
+	    h[2] != Z_DEFLATED || !(h[3] & EXTRA_FIELD) ||
+	    h[10] != 12 || h[11] != 0 || h[12] != 'R' || h[13] != 'B' ||
+	    h[14] != 8 || h[15] != 0)
+	    return FALSE;
+	clen = blk_get32(h + 16);
+	if (clen < BLK_GZHEAD + 8 || clen > end - off ||
+	    !blk_add(b, off, clen, blk_get32(h + 20)))
+	    return FALSE;
+	off += clen;
+    }
+    return TRUE;
+}
+
+/* Index the streams of an xz file, working back from its end */
+static Rboolean blk_index_xz(Rblkfile b)
+{
+    unsigned char foot[LZMA_STREAM_HEADER_SIZE];
+    OFF_T end;
+    R_xlen_t i;
+
+    if (f_seek(b->fp, 0, SEEK_END)) return FALSE;
+    end = f_tell(b->fp);
+    while (end > 0) {
+	lzma_stream_flags flags;
+	lzma_index *idx = NULL;
+	uint64_t memlimit = UINT64_MAX;
+	size_t ipos = 0;
+	lzma_vli ssize, usize;
+	unsigned char *ibuf;
+	lzma_ret ret;
+
+	if (end < 2 * LZMA_STREAM_HEADER_SIZE ||
+	    f_seek(b->fp, end - LZMA_STREAM_HEADER_SIZE, SEEK_SET) ||
+	    fread(foot, 1, LZMA_STREAM_HEADER_SIZE, b->fp)
+	    != LZMA_STREAM_HEADER_SIZE)
+	    return FALSE;
+	if (!foot[8] && !foot[9] && !foot[10] && !foot[11]) {
+	    end -= 4; /* stream padding */
+	    continue;
+	}
+	if (lzma_stream_footer_decode(&flags, foot) != LZMA_OK ||
+	    end - LZMA_STREAM_HEADER_SIZE - (OFF_T) flags.backward_size
+	    < LZMA_STREAM_HEADER_SIZE)
+	    return FALSE;
+	ibuf = malloc(flags.backward_size);
+	if (!ibuf) return FALSE;
+	if (f_seek(b->fp, end - LZMA_STREAM_HEADER_SIZE -
+		   (OFF_T) flags.backward_size, SEEK_SET) ||
+	    fread(ibuf, 1, flags.backward_size, b->fp) != flags.backward_size) {
+	    free(ibuf);
+	    return FALSE;
+	}
+	ret = lzma_index_buffer_decode(&idx, &memlimit, NULL, ibuf, &ipos,
+				       flags.backward_size);
+	free(ibuf);
+	if (ret != LZMA_OK) return FALSE;
+	ssize = lzma_index_stream_size(idx);
+	usize = lzma_index_uncompressed_size(idx);
+	lzma_index_end(idx, NULL);
+	if (ssize > (lzma_vli) end || usize > BLK_MAX ||
+	    !blk_add(b, end - (OFF_T) ssize, ssize, usize))
+	    return FALSE;
+	end -= ssize;
+    }
+    for (i = 0; i < b->nblk / 2; i++) {
+	R_xlen_t j = b->nblk - 1 - i;
+	OFF_T o = b->boff[i];
+	size_t c = b->bclen[i], u = b->bulen[i];
+	b->boff[i] = b->boff[j]; b->bclen[i] = b->bclen[j];
+	b->bulen[i] = b->bulen[j];
+	b->boff[j] = o; b->bclen[j] = c; b->bulen[j] = u;
+    }
+    return TRUE;
+}
+
+/* Returns NULL unless the file is a block-compressed gzip or xz file
+   of several blocks and more than one thread is in use */
+static Rblkfile blk_open_read(const char *path, int type)
+{
+    Rblkfile b;
+    R_xlen_t k;
+    double start = 0;
+    Rboolean ok;
+
+    if (blk_threads() < 2 || type == 1) return NULL;
+    b = calloc(1, sizeof(struct blkfile));
+    if (!b) return NULL;
+    b->type = type;
+    b->reading = TRUE;
+    if (!(b->fp = R_fopen(path, "rb"))) {
+	blk_free(b);
+	return NULL;
+    }
+    ok = (type == 0) ? blk_index_gz(b) : blk_index_xz(b);
+    if (ok && b->nblk > 1 && (b->bstart = malloc(b->nblk * sizeof(double)))) {
+	for (k = 0; k < b->nblk; k++) {
+	    if (b->bulen[k] > b->bsize) b->bsize = b->bulen[k];
+	    if (b->bclen[k] > b->csize) b->csize = b->bclen[k];
+	    b->bstart[k] = start;
+	    start += b->bulen[k];
+	}
+	b->nthreads = blk_threads();
+	if (b->nthreads > b->nblk) b->nthreads = (int) b->nblk;
+	if (b->bsize == 0) b->bsize = 1;
+	if (b->bsize <= BLK_MAX && blk_buffers(b)) return b;
+    }
+    fclose(b->fp);
+    blk_free(b);
+    return NULL;
+}
+
+/* decompress the next blocks into 'buf' */
+static Rboolean blk_fill(Rblkfile b)
+{
+    int i, m = b->nthreads;
+    R_xlen_t k0 = b->next;
+
+    if (k0 >= b->nblk) return FALSE;
+    if (m > b->nblk - k0) m = (int)(b->nblk - k0);
+    for (i = 0; i < m; i++)
+	if (f_seek(b->fp, b->boff[k0 + i], SEEK_SET) ||
+	    fread(b->cbuf[i], 1, b->bclen[k0 + i], b->fp) != b->bclen[k0 + i]) {
+	    warning(_("read error on compressed file"));
+	    return FALSE;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(m) schedule(static, 1)
+#endif
+    for (i = 0; i < m; i++) {
+	R_xlen_t k = k0 + i;
+	unsigned char *dst = b->buf + (size_t)(b->bstart[k] - b->bstart[k0]);
+	b->clen[i] = (size_t) -1;
+	if (b->type == 0) {
+	    z_stream s;
+	    memset(&s, 0, sizeof(s));
+	    if (inflateInit2(&s, 16 + MAX_WBITS) != Z_OK) continue;
+	    s.next_in = b->cbuf[i]; s.avail_in = (uInt) b->bclen[k];
+	    s.next_out = dst; s.avail_out = (uInt) b->bulen[k];
+	    if (inflate(&s, Z_FINISH) == Z_STREAM_END) b->clen[i] = s.total_out;
+	    inflateEnd(&s);
+	} else {
+	    uint64_t memlimit = UINT64_MAX;
+	    size_t ipos = 0, opos = 0;
+	    if (lzma_stream_buffer_decode(&memlimit, 0, NULL, b->cbuf[i],
+					  &ipos, b->bclen[k], dst, &opos,
+					  b->bulen[k]) == LZMA_OK)
+		b->clen[i] = opos;
+	}
+    }
+    for (i = 0; i < m; i++)
+	if (b->clen[i] != b->bulen[k0 + i]) {
+	    warning(_("corrupt data in block-compressed file"));
+	    return FALSE;
+	}
+    b->base = b->bstart[k0];
+    b->len = (size_t)(b->bstart[k0 + m - 1] - b->base) + b->bulen[k0 + m - 1];
+    b->pos = 0;
+    b->next = k0 + m;
+    return TRUE;
+}
+
+static size_t blk_read(Rblkfile b, void *ptr, size_t n)
+{
+    unsigned char *p = ptr;
+    size_t got = 0;
+
+    while (got < n) {
+	size_t k;
+	if (b->pos == b->len) {
+	    if (!blk_fill(b)) break;
+	    continue;
+	}
+	k = b->len - b->pos;
+	if (k > n - got) k = n - got;
+	memcpy(p + got, b->buf + b->pos, k);
+	b->pos += k; got += k;
+    }
+    return got;
+}
+
+/* Seeking is only supported forwards when writing, and sets up the
+   block containing the new position when reading */
+static Rboolean blk_seek(Rblkfile b, double where)
+{
+    R_xlen_t lo = 0, hi = b->nblk;
+
+    if (!b->reading) {
+	char zeros[BUFSIZE];
+	double n = where - (b->base + b->len);
+	if (n < 0) return FALSE;
+	memset(zeros, 0, BUFSIZE);
+	while (n > 0) {
+	    size_t k = (n > BUFSIZE) ? BUFSIZE : (size_t) n;
+	    if (!blk_write(b, zeros, k)) return FALSE;
+	    n -= k;
+	}
+	return TRUE;
+    }
+    /* the last block starting at or before 'where' */
+    while (hi - lo > 1) {
+	R_xlen_t mid = (lo + hi) / 2;
+	if (b->bstart[mid] <= where) lo = mid; else hi = mid;
+    }
+    b->next = lo;
+    b->len = b->pos = 0;
+    if (!blk_fill(b)) return FALSE;
+    b->pos = (where - b->base > b->len) ? b->len : (size_t)(where - b->base);
+    return TRUE;
+}
+
+static double blk_tell(Rblkfile b)
+{
+    return b->base + (b->reading ? b->pos : b->len);
+}
+
+static Rboolean blk_close(Rblkfile b)
+{
+    Rboolean ok = b->reading || blk_flush(b);
+    if (fclose(b->fp)) ok = FALSE;
+    blk_free(b);
+    return ok;
+}
 
 /* needs to be declared before con_close1 */
 typedef struct gzconn {
@@ -1445,6 +2099,7 @@ typedef struct gzconn {
 typedef struct gzfileconn {
     void *fp;
     int compress;
+    Rblkfile blk;
 } *Rgzfileconn;
 
 static Rboolean gzfile_open(Rconnection con)
@@ -1458,34 +2113,51 @@ static Rboolean gzfile_open(Rconnection con)
     if(strchr(con->mode, 'w')) snprintf(mode, 6, "wb%1d", gzcon->compress);
     else if (con->mode[0] == 'a') snprintf(mode, 6, "ab%1d", gzcon->compress);
     else strcpy(mode, "rb");
-    errno = 0; /* precaution */
-    fp = R_gzopen(R_ExpandFileName(con->description), mode);
-    if(!fp) {
-	warning(_("cannot open compressed file '%s', probable reason '%s'"),
-		R_ExpandFileName(con->description), strerror(errno));
-	return FALSE;
+    if(mode[0] == 'r')
+	gzcon->blk = blk_open_read(R_ExpandFileName(con->description), 0);
+    else
+	gzcon->blk = blk_open_write(R_ExpandFileName(con->description),
+				    mode[0] == 'w' ? "wb" : "ab", 0,
+				    gzcon->compress);
+    if(!gzcon->blk) {
+	errno = 0; /* precaution */
+	R_DetachMappedFile(R_ExpandFileName(con->description), mode);
+	fp = R_gzopen(R_ExpandFileName(con->description), mode);
+	if(!fp) {
+	    warning(_("cannot open compressed file '%s', probable reason '%s'"),
+		    R_ExpandFileName(con->description), strerror(errno));
+	    return FALSE;
+	}
+	gzcon->fp = fp;
     }
-    ((Rgzfileconn)(con->private))->fp = fp;
     con->isopen = TRUE;
     con->canwrite = (con->mode[0] == 'w' || con->mode[0] == 'a');
     con->canread = !con->canwrite;
     con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
     set_iconv(con);
+    set_buffer(con);
     con->save = -1000;
     return TRUE;
 }
 
 static void gzfile_close(Rconnection con)
 {
-    R_gzclose(((Rgzfileconn)(con->private))->fp);
+    Rgzfileconn gzcon = con->private;
+
+    if(gzcon->blk) {
+	blk_close(gzcon->blk);
+	gzcon->blk = NULL;
+    } else R_gzclose(gzcon->fp);
     con->isopen = FALSE;
 }
 
 static int gzfile_fgetc_internal(Rconnection con)
 {
     gzFile fp = ((Rgzfileconn)(con->private))->fp;
+    Rblkfile blk = ((Rgzfileconn)(con->private))->blk;
     unsigned char c;
 
+    if(blk) return blk_read(blk, &c, 1) == 1 ? c : R_EOF;
     return R_gzread(fp, &c, 1) == 1 ? c : R_EOF;
 }
 
@@ -1494,9 +2166,20 @@ static int gzfile_fgetc_internal(Rconnection con)
 static double gzfile_seek(Rconnection con, double where, int origin, int rw)
 {
     gzFile  fp = ((Rgzfileconn)(con->private))->fp;
-    Rz_off_t pos = R_gztell(fp);
+    Rblkfile blk = ((Rgzfileconn)(con->private))->blk;
+    Rz_off_t pos;
     int res, whence = SEEK_SET;
 
+    if (blk) {
+	double bpos = blk_tell(blk);
+	if (ISNA(where)) return bpos;
+	if (origin == 3)
+	    error(_("whence = \"end\" is not implemented for gzfile connections"));
+	if (!blk_seek(blk, origin == 2 ? bpos + where : where))
+	    warning(_("seek on a gzfile connection returned an internal error"));
+	return bpos;
+    }
+    pos = R_gztell(fp);
     if (ISNA(where)) return (double) pos;
 
     switch(origin) {
@@ -1519,6 +2202,9 @@ static size_t gzfile_read(void *ptr, size_t size, size_t nitems,
 			Rconnection con)
 {
     gzFile fp = ((Rgzfileconn)(con->private))->fp;
+    Rblkfile blk = ((Rgzfileconn)(con->private))->blk;
+
+    if (blk) return blk_read(blk, ptr, size*nitems)/size;
     /* uses 'unsigned' for len */
     if ((double) size * (double) nitems > UINT_MAX)
 	error(_("too large a block specified"));
@@ -1529,6 +2215,9 @@ static size_t gzfile_write(const void *ptr, size_t size, size_t nitems,
 			   Rconnection con)
 {
     gzFile fp = ((Rgzfileconn)(con->private))->fp;
+    Rblkfile blk = ((Rgzfileconn)(con->private))->blk;
+
+    if (blk) return blk_write(blk, ptr, size*nitems) ? nitems : 0;
     /* uses 'unsigned' for len */
     if ((double) size * (double) nitems > UINT_MAX)
 	error(_("too large a block specified"));
@@ -1570,14 +2259,15 @@ static Rconnection newgzfile(const char *description, const char *mode,
 	error(_("allocation of gzfile connection failed"));
     }
     ((Rgzfileconn)new->private)->compress = compress;
+    ((Rgzfileconn)new->private)->blk = NULL;
     return new;
 }
 
-#include <bzlib.h>
 typedef struct bzfileconn {
     FILE *fp;
     BZFILE *bfp;
     int compress;
+    Rblkfile blk;
 } *Rbzfileconn;
 
 static Rboolean bzfile_open(Rconnection con)
@@ -1593,6 +2283,16 @@ static Rboolean bzfile_open(Rconnection con)
     /* regardless of the R view of the file, the file must be opened in
        binary mode where it matters */
     mode[0] = con->mode[0];
+    if(con->canwrite &&
+       (bz->blk = blk_open_write(R_ExpandFileName(con->description), mode,
+				 1, bz->compress))) {
+	con->isopen = TRUE;
+	con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
+	set_iconv(con);
+	set_buffer(con);
+	con->save = -1000;
+	return TRUE;
+    }
     errno = 0; /* precaution */
     fp = R_fopen(R_ExpandFileName(con->description), mode);
     if(!fp) {
@@ -1624,6 +2324,7 @@ static Rboolean bzfile_open(Rconnection con)
     con->isopen = TRUE;
     con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
     set_iconv(con);
+    set_buffer(con);
     con->save = -1000;
     return TRUE;
 }
@@ -1633,6 +2334,12 @@ static void bzfile_close(Rconnection con)
     int bzerror;
     Rbzfileconn bz = con->private;
 
+    if(bz->blk) {
+	blk_close(bz->blk);
+	bz->blk = NULL;
+	con->isopen = FALSE;
+	return;
+    }
     if(con->canread)
 	BZ2_bzReadClose(&bzerror, bz->bfp);
     else
@@ -1708,6 +2415,7 @@ static size_t bzfile_write(const void *ptr, size_t size, size_t nitems,
     Rbzfileconn bz = con->private;
     int bzerror;
 
+    if(bz->blk) return blk_write(bz->blk, ptr, size*nitems) ? nitems : 0;
     /* uses 'int' for len */
     if ((double) size * (double) nitems > INT_MAX)
 	error(_("too large a block specified"));
@@ -1751,11 +2459,10 @@ static Rconnection newbzfile(const char *description, const char *mode,
 	error(_("allocation of bzfile connection failed"));
     }
     ((Rbzfileconn)new->private)->compress = compress;
+    ((Rbzfileconn)new->private)->blk = NULL;
     return new;
 }
 
-#include <lzma.h>
-
 typedef struct xzfileconn {
     FILE *fp;
     lzma_stream stream;
@@ -1765,6 +2472,7 @@ typedef struct xzfileconn {
     lzma_filter filters[2];
     lzma_options_lzma opt_lzma;
     unsigned char buf[BUFSIZE];
+    Rblkfile blk;
 } *Rxzfileconn;
 
 static Rboolean xzfile_open(Rconnection con)
@@ -1778,6 +2486,19 @@ static Rboolean xzfile_open(Rconnection con)
     /* regardless of the R view of the file, the file must be opened in
        binary mode where it matters */
     mode[0] = con->mode[0];
+    if(con->canread && xz->type == 0)
+	xz->blk = blk_open_read(R_ExpandFileName(con->description), 2);
+    else if(con->canwrite)
+	xz->blk = blk_open_write(R_ExpandFileName(con->description), mode,
+				 2, xz->compress);
+    if(xz->blk) {
+	con->isopen = TRUE;
+	con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
+	set_iconv(con);
+	set_buffer(con);
+	con->save = -1000;
+	return TRUE;
+    }
     errno = 0; /* precaution */
     xz->fp = R_fopen(R_ExpandFileName(con->description), mode);
     if(!xz->fp) {
@@ -1817,6 +2538,7 @@ static Rboolean xzfile_open(Rconnection con)
     con->isopen = TRUE;
     con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
     set_iconv(con);
+    set_buffer(con);
     con->save = -1000;
     return TRUE;
 }
@@ -1825,6 +2547,12 @@ static void xzfile_close(Rconnection con)
 {
     Rxzfileconn xz = con->private;
 
+    if(xz->blk) {
+	blk_close(xz->blk);
+	xz->blk = NULL;
+	con->isopen = FALSE;
+	return;
+    }
     if(con->canwrite) {
 	lzma_ret ret;
 	lzma_stream *strm = &(xz->stream);
@@ -1854,6 +2582,7 @@ static size_t xzfile_read(void *ptr, size_t size, size_t nitems,
     unsigned char *p = ptr;
 
     if (!s) return 0;
+    if (xz->blk) return blk_read(xz->blk, ptr, s)/size;
 
     while(1) {
 	if (strm->avail_in == 0 && xz->action != LZMA_FINISH) {
@@ -1910,6 +2639,7 @@ static size_t xzfile_write(const void *ptr, size_t size, size_t nitems,
     unsigned char buf[BUFSIZE];
 
     if (!s) return 0;
+    if (xz->blk) return blk_write(xz->blk, ptr, s) ? nitems : 0;
 
     strm->avail_in = s;
     strm->next_in = p;
@@ -3327,6 +4057,7 @@ static void con_close1(Rconnection con)
     /* close inconv and outconv if open */
     if(con->inconv) Riconv_close(con->inconv);
     if(con->outconv) Riconv_close(con->outconv);
+    if(con->buff) free(con->buff);
     con->destroy(con);
     free(con->class);
     free(con->description);
@@ -3398,6 +4129,7 @@ SEXP attribute_hidden do_seek(SEXP call, SEXP op, SEXP args, SEXP env)
 	free(con->PushBack);
 	con->nPushBack = 0;
     }
+    if(con->buff) return ScalarReal(buff_seek(con, where, origin, rw));
     return ScalarReal(con->seek(con, where, origin, rw));
 }
 
@@ -3445,9 +4177,10 @@ int Rconn_fgetc(Rconnection con)
 	    con->save = -1000;
 	    return c;
 	}
-	c = con->fgetc(con);
+	/* inline the common case of a buffered connection */
+	c = (con->buff && !con->inconv) ? buff_fgetc(con) : con->fgetc(con);
 	if (c == '\r') {
-	    c = con->fgetc(con);
+	    c = (con->buff && !con->inconv) ? buff_fgetc(con) : con->fgetc(con);
 	    if (c != '\n') {
 		con->save = (c != '\r') ? c : '\n';
 		return('\n');
@@ -3522,6 +4255,8 @@ static void con_cleanup(void *data)
 
 /* readLines(con = stdin(), n = 1, ok = TRUE, warn = TRUE) */
 #define BUF_SIZE 1000
+#define READLINES_BATCH 1024
+
 SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP ans = R_NilValue, ans2;
@@ -3530,7 +4265,9 @@ SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
     Rconnection con = NULL;
     Rboolean wasopen;
     char *buf;
-    const char *encoding;
+    const char *encoding, *p, *lines[READLINES_BATCH];
+    int lens[READLINES_BATCH];
+    size_t avail;
     RCNTXT cntxt;
     R_xlen_t i, n, nn, nnn, nread;
 
@@ -3596,6 +4333,36 @@ SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
 	    UNPROTECT(1); /* old ans */
 	    PROTECT(ans = ans2);
 	}
+	/* Take as many complete lines as possible directly from the
+	   connection's buffer: lines with a CR or a nul are left to
+	   the general code below. */
+	avail = Rconn_peek(con, &p);
+	if(avail > 0) {
+	    const char *q = p, *eol, *s;
+	    R_xlen_t k = 0, kmax = nn - nread;
+	    if(kmax > nnn - nread) kmax = nnn - nread;
+	    if(kmax > READLINES_BATCH) kmax = READLINES_BATCH;
+	    while(k < kmax && (eol = memchr(q, '\n', p + avail - q))) {
+		lines[k] = q;
+		lens[k++] = (int)(eol - q);
+		q = eol + 1;
+	    }
+	    if((s = memchr(p, '\r', q - p))) q = s;
+	    if((s = memchr(p, '\0', q - p))) q = s;
+	    while(k > 0 && lines[k-1] + lens[k-1] >= q) k--;
+	    if(k > 0) {
+		/* Remove UTF-8 BOM */
+		if (nread == 0 && utf8locale && lens[0] >= 3 &&
+		    !memcmp(lines[0], "\xef\xbb\xbf", 3)) {
+		    lines[0] += 3;
+		    lens[0] -= 3;
+		}
+		mkCharLenCEs(ans, nread, lines, lens, k, oenc);
+		Rconn_skip(con, lines[k-1] + lens[k-1] + 1 - p);
+		nread += k - 1;
+		continue;
+	    }
+	}
 	nbuf = 0;
 	while((c = Rconn_fgetc(con)) != R_EOF) {
 	    if(nbuf == buf_size-1) {  /* need space for the terminator */
@@ -3739,7 +4506,7 @@ static SEXP readOneString(Rconnection con)
 
     for(pos = 0; pos < 10000; pos++) {
 	p = buf + pos;
-	m = (int) con->read(p, sizeof(char), 1, con);
+	m = (int) buff_read(p, sizeof(char), 1, con);
 	if (m < 0) error("error reading from the connection");
 	if(!m) {
 	    if(pos > 0)
@@ -3874,7 +4641,7 @@ SEXP attribute_hidden do_readbin(SEXP call, SEXP op, SEXP args, SEXP env)
 	    m = 0;
 	    while(n0) {
 		size_t n1 = (n0 < BLOCK) ? n0 : BLOCK;
-		m0 = con->read(pp, size, n1, con);
+		m0 = buff_read(pp, size, n1, con);
 		if (m0 < 0) error("error reading from the connection");
 		m += m0;
 		if (m0 < n1) break;
@@ -3965,7 +4732,7 @@ SEXP attribute_hidden do_readbin(SEXP call, SEXP op, SEXP args, SEXP env)
 		m = 0;
 		while(n0) {
 		    size_t n1 = (n0 < BLOCK) ? n0 : BLOCK;
-		    m0 = con->read(pp, size, n1, con);
+		    m0 = buff_read(pp, size, n1, con);
 		    if (m0 < 0) error("error reading from the connection");
 		    m += m0;
 		    if (m0 < n1) break;
@@ -3994,7 +4761,7 @@ SEXP attribute_hidden do_readbin(SEXP call, SEXP op, SEXP args, SEXP env)
 	    if(mode == 1) { /* integer result */
 		for(i = 0, m = 0; i < n; i++) {
 		    s = isRaw ? rawRead((char*) &u, size, 1, bytes, nbytes, &np)
-			: (int) con->read((char*) &u, size, 1, con);
+			: (int) buff_read((char*) &u, size, 1, con);
 		    if (s < 0) error("error reading from the connection");
 		    if(s) m++; else break;
 		    if(swap && size > 1) swapb((char *) &u, size);
@@ -4027,7 +4794,7 @@ SEXP attribute_hidden do_readbin(SEXP call, SEXP op, SEXP args, SEXP env)
 	    } else if (mode == 2) { /* double result */
 		for(i = 0, m = 0; i < n; i++) {
 		    s = isRaw ? rawRead((char*) &u, size, 1, bytes, nbytes, &np)
-			: (int) con->read((char*) &u, size, 1, con);
+			: (int) buff_read((char*) &u, size, 1, con);
 		    if (s < 0) error("error reading from the connection");
 		    if(s) m++; else break;
 		    if(swap && size > 1) swapb((char *) &u, size);
@@ -4327,11 +5094,11 @@ readFixedString(Rconnection con, int len, int useBytes)
 	memset(buf, 0, MB_CUR_MAX*len+1);
 	for(i = 0; i < len; i++) {
 	    q = p;
-	    m = (int) con->read(p, sizeof(char), 1, con);
+	    m = (int) buff_read(p, sizeof(char), 1, con);
 	    if(!m) { if(i == 0) return R_NilValue; else break;}
 	    clen = utf8clen(*p++);
 	    if(clen > 1) {
-		m = (int) con->read(p, sizeof(char), clen - 1, con);
+		m = (int) buff_read(p, sizeof(char), clen - 1, con);
 		if(m < clen - 1) error(_("invalid UTF-8 input in readChar()"));
 		p += clen - 1;
 		/* NB: this only checks validity of multi-byte characters */
@@ -4342,7 +5109,7 @@ readFixedString(Rconnection con, int len, int useBytes)
     } else {
 	buf = (char *) R_alloc(len+1, sizeof(char));
 	memset(buf, 0, len+1);
-	m = (int) con->read(buf, sizeof(char), len, con);
+	m = (int) buff_read(buf, sizeof(char), len, con);
 	if(len && !m) return R_NilValue;
     }
     /* String may contain nuls which we now (R >= 2.8.0) assume to be
@@ -5206,7 +5973,7 @@ size_t R_ReadConnection(Rconnection con, void *buf, size_t n)
     if(!con->isopen) error(_("connection is not open"));
     if(!con->canread) error(_("cannot read from this connection"));
 
-    return con->read(buf, 1, n, con);
+    return buff_read(buf, 1, n, con);
 }
 
 Rconnection R_GetConnection(SEXP sConn) {
@@ -5218,7 +5985,7 @@ Rconnection R_GetConnection(SEXP sConn) {
 
 /* Code for gzcon connections is modelled on gzio.c from zlib 1.2.3 */
 
-#define get_byte() (icon->read(&ccc, 1, 1, icon), ccc)
+#define get_byte() (buff_read(&ccc, 1, 1, icon), ccc)
 
 static Rboolean gzcon_open(Rconnection con)
 {
@@ -5247,7 +6014,7 @@ static Rboolean gzcon_open(Rconnection con)
 	unsigned char head[2];
 	uInt len;
 
-	icon->read(head, 1, 2, icon);
+	buff_read(head, 1, 2, icon);
 	if(head[0] != gz_magic[0] || head[1] != gz_magic[1]) {
 	    if(!priv->allow) {
 		warning(_("file stream does not have gzip magic number"));
@@ -5258,13 +6025,13 @@ static Rboolean gzcon_open(Rconnection con)
 	    priv->saved[1] = head[1];
 	    return TRUE;
 	}
-	icon->read(&method, 1, 1, icon);
-	icon->read(&flags, 1, 1, icon);
+	buff_read(&method, 1, 1, icon);
+	buff_read(&flags, 1, 1, icon);
 	if (method != Z_DEFLATED || (flags & RESERVED) != 0) {
 	    warning(_("file stream does not have valid gzip header"));
 	    return FALSE;
 	}
-	icon->read(dummy, 1, 6, icon);
+	buff_read(dummy, 1, 6, icon);
 	if ((flags & EXTRA_FIELD) != 0) { /* skip the extra field */
 	    len  =  (uInt) get_byte();
 	    len += ((uInt) get_byte()) << 8;
@@ -5357,7 +6124,7 @@ static int gzcon_byte(Rgzconn priv)
 
     if (priv->z_eof) return EOF;
     if (priv->s.avail_in == 0) {
-	priv->s.avail_in = (uInt) icon->read(priv->buffer, 1, Z_BUFSIZE, icon);
+	priv->s.avail_in = (uInt) buff_read(priv->buffer, 1, Z_BUFSIZE, icon);
 	if (priv->s.avail_in == 0) {
 	    priv->z_eof = 1;
 	    return EOF;
@@ -5391,7 +6158,7 @@ static size_t gzcon_read(void *ptr, size_t size, size_t nitems,
 	    for(i = 0; i < priv->nsaved; i++)
 		((char *)ptr)[i] = priv->saved[i];
 	    priv->nsaved = 0;
-	    return (nsaved + icon->read((char *) ptr+nsaved, 1, len - nsaved,
+	    return (nsaved + buff_read((char *) ptr+nsaved, 1, len - nsaved,
 					icon))/size;
 	}
 	if (len == 1) { /* size must be one */
@@ -5401,7 +6168,7 @@ static size_t gzcon_read(void *ptr, size_t size, size_t nitems,
 		priv->nsaved--;
 		return 1;
 	    } else
-		return icon->read(ptr, 1, 1, icon);
+		return buff_read(ptr, 1, 1, icon);
 	}
     }
 
@@ -5410,7 +6177,7 @@ static size_t gzcon_read(void *ptr, size_t size, size_t nitems,
 
     while (priv->s.avail_out != 0) {
 	if (priv->s.avail_in == 0 && !priv->z_eof) {
-	    priv->s.avail_in = (uInt)icon->read(priv->buffer, 1, Z_BUFSIZE, icon);
+	    priv->s.avail_in = (uInt)buff_read(priv->buffer, 1, Z_BUFSIZE, icon);
 	    if (priv->s.avail_in == 0) priv->z_eof = 1;
 	    priv->s.next_in = priv->buffer;
 	}
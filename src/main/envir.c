@@ -111,6 +111,11 @@
 /* use the same bits (15 and 14) in symbols and bindings */
 #define BINDING_VALUE(b) ((IS_ACTIVE_BINDING(b) ? getActiveValue(CAR(b)) : CAR(b)))
 
+/* Compiled closures bind all their local variables when called, to
+   R_UnboundValue until they are assigned (see bcBindFrameSlots in
+   eval.c).  Such bindings in unhashed frames are not visible. */
+#define UNASSIGNED_BINDING(b) (CAR(b) == R_UnboundValue)
+
 #define SYMBOL_BINDING_VALUE(s) ((IS_ACTIVE_BINDING(s) ? getActiveValue(SYMVALUE(s)) : SYMVALUE(s)))
 #define SYMBOL_HAS_BINDING(s) (IS_ACTIVE_BINDING(s) || (SYMVALUE(s) != R_UnboundValue))
 
@@ -191,6 +196,10 @@ Rboolean R_envHasNoSpecialSymbols (SEXP env)
 #define HASHTABLEGROWTHRATE  1.2
 #define HASHMINSIZE	     29
 #define SET_HASHPRI(x,v)     SET_TRUELENGTH(x,v)
+#define HASHSPLIT(x)	     ATTRIB(x)
+#define SET_HASHSPLIT(x,v)   SET_ATTRIB(x,v)
+#define HASHSPLITPOINT(s)    INTEGER(CAR(s))[0]
+#define HASHSPLITSTEPS	     2
 
 #define IS_HASHED(x)	     (HASHTAB(x) != R_NilValue)
 
@@ -223,17 +232,34 @@ int attribute_hidden R_Newhashpjw(const char *s)
     return h;
 }
 
+/* The bucket of 'table' for hash code 'hashcode'.  While a table is
+   being enlarged (see R_HashStartSplit) the buckets before the split
+   point have been split in two, and only those use the full size. */
+static R_INLINE int hashBucket(int hashcode, SEXP table)
+{
+    SEXP split = HASHSPLIT(table);
+    if (split == R_NilValue)
+	return hashcode % HASHSIZE(table);
+    else {
+	int bucket = hashcode % (HASHSIZE(table) / 2);
+	if (bucket < HASHSPLITPOINT(split))
+	    bucket = hashcode % HASHSIZE(table);
+	return bucket;
+    }
+}
+
 /*----------------------------------------------------------------------
 
   R_HashSet
 
   Hashtable set function.  Sets 'symbol' in 'table' to be 'value'.
   'hashcode' must be provided by user.	Allocates some memory for list
-  entries.
+  entries.  Returns the previous value, or R_NilValue for a new
+  binding.
 
 */
 
-static void R_HashSet(int hashcode, SEXP symbol, SEXP table, SEXP value,
+static SEXP R_HashSet(int hashcode, SEXP symbol, SEXP table, SEXP value,
 		      Rboolean frame_locked)
 {
     SEXP chain;
@@ -244,9 +270,10 @@ static void R_HashSet(int hashcode, SEXP symbol, SEXP table, SEXP value,
     /* Search for the value in the chain */
     for (; !ISNULL(chain); chain = CDR(chain))
 	if (TAG(chain) == symbol) {
+	    SEXP old = CAR(chain);
 	    SET_BINDING_VALUE(chain, value);
 	    SET_MISSING(chain, 0);	/* Over-ride for new value */
-	    return;
+	    return old;
 	}
     if (frame_locked)
 	error(_("cannot add bindings to a locked environment"));
@@ -255,7 +282,7 @@ static void R_HashSet(int hashcode, SEXP symbol, SEXP table, SEXP value,
     /* Add the value into the chain */
     SET_VECTOR_ELT(table, hashcode, CONS(value, VECTOR_ELT(table, hashcode)));
     SET_TAG(VECTOR_ELT(table, hashcode), symbol);
-    return;
+    return R_NilValue;
 }
 
 
@@ -390,11 +417,10 @@ static SEXP DeleteItem(SEXP symbol, SEXP lst)
 
 static void R_HashDelete(int hashcode, SEXP symbol, SEXP table)
 {
-    SEXP list = DeleteItem(symbol,
-			   VECTOR_ELT(table, hashcode % HASHSIZE(table)));
+    SEXP list = DeleteItem(symbol, VECTOR_ELT(table, hashcode));
     if (list == R_NilValue)
 	SET_HASHPRI(table, HASHPRI(table) - 1);
-    SET_VECTOR_ELT(table, hashcode % HASHSIZE(table), list);
+    SET_VECTOR_ELT(table, hashcode, list);
     return;
 }
 
@@ -484,6 +510,84 @@ static int R_HashSizeCheck(SEXP table)
 
 
 
+/*----------------------------------------------------------------------
+
+  R_HashStartSplit, R_HashSplit
+
+  Enlarging hashed frames by linear hashing.  R_HashResize moves
+  every binding at once, which makes a large table pause on each
+  growth.  Instead, R_HashStartSplit returns a table of twice the
+  size with the same chains in the first half, and the index of the
+  next bucket to split is kept in HASHSPLIT, the (otherwise unused)
+  attribute pairlist of the table.  Each later insertion calls R_HashSplit, which moves
+  the bindings of HASHSPLITSTEPS buckets that belong in the second
+  half, and when all are done the table is an ordinary one.  Only
+  the chain pointers are copied when the split starts.
+
+  The bindings are moved, not reallocated, so cached binding cells
+  stay valid.  Tables are split completely before they are
+  serialized (R_HashFinishSplit), so the format is unchanged.
+
+*/
+
+static SEXP R_HashStartSplit(SEXP table)
+{
+    int size = HASHSIZE(table);
+    if (size > INT_MAX / 2)
+	return R_HashResize(table);
+    SEXP new_table = PROTECT(R_NewHashTable(2 * size));
+    for (int i = 0; i < size; i++)
+	SET_VECTOR_ELT(new_table, i, VECTOR_ELT(table, i));
+    SET_HASHPRI(new_table, HASHPRI(table));
+    SET_HASHSPLIT(new_table, CONS(ScalarInteger(0), R_NilValue));
+    UNPROTECT(1);
+    return new_table;
+}
+
+static void R_HashSplit(SEXP table, int nsteps)
+{
+    SEXP split = HASHSPLIT(table);
+    int size = HASHSIZE(table), half = size / 2;
+    int bucket = HASHSPLITPOINT(split);
+
+    for (; nsteps > 0 && bucket < half; nsteps--, bucket++) {
+	SEXP chain = VECTOR_ELT(table, bucket), prev = R_NilValue;
+	if (chain == R_NilValue)
+	    continue;
+	while (chain != R_NilValue) {
+	    SEXP next = CDR(chain);
+	    if (HASHVALUE(PRINTNAME(TAG(chain))) % size != bucket) {
+		if (prev == R_NilValue)
+		    SET_VECTOR_ELT(table, bucket, next);
+		else
+		    SETCDR(prev, next);
+		SETCDR(chain, VECTOR_ELT(table, bucket + half));
+		SET_VECTOR_ELT(table, bucket + half, chain);
+	    }
+	    else prev = chain;
+	    chain = next;
+	}
+	if (VECTOR_ELT(table, bucket) == R_NilValue)
+	    SET_HASHPRI(table, HASHPRI(table) - 1);
+	if (VECTOR_ELT(table, bucket + half) != R_NilValue)
+	    SET_HASHPRI(table, HASHPRI(table) + 1);
+    }
+    if (bucket < half)
+	HASHSPLITPOINT(split) = bucket;
+    else
+	SET_HASHSPLIT(table, R_NilValue);
+}
+
+/* Complete the enlargement of the hash table of 'rho', if any. */
+void attribute_hidden R_HashFinishSplit(SEXP rho)
+{
+    SEXP table = HASHTAB(rho);
+    if (TYPEOF(table) == VECSXP && HASHSPLIT(table) != R_NilValue)
+	R_HashSplit(table, HASHSIZE(table));
+}
+
+
+
 /*----------------------------------------------------------------------
 
   R_HashFrame
@@ -511,7 +615,7 @@ static SEXP R_HashFrame(SEXP rho)
 			  R_Newhashpjw(CHAR(PRINTNAME(TAG(frame)))));
 	    SET_HASHASH(PRINTNAME(TAG(frame)), 1);
 	}
-	hashcode = HASHVALUE(PRINTNAME(TAG(frame))) % HASHSIZE(table);
+	hashcode = hashBucket(HASHVALUE(PRINTNAME(TAG(frame))), table);
 	chain = VECTOR_ELT(table, hashcode);
 	/* If using a primary slot then increase HASHPRI */
 	if (ISNULL(chain)) SET_HASHPRI(table, HASHPRI(table) + 1);
@@ -623,6 +727,13 @@ static SEXP R_HashProfile(SEXP table)
    from global frames must go through the interface functions in this
    file.
 
+   R_GlobalCacheVersion is incremented whenever an entry in use is
+   flushed.  The byte code interpreter keeps the places found by
+   R_GlobalCacheLoc for each code object (see bcEval), and they remain
+   valid while the version is unchanged.  Adding an entry does not
+   change the result of any earlier search, so does not count.  The
+   version is a double so that it cannot wrap around.
+
    Initially only the R_GlobalEnv frame is a global frame.  Additional
    global frames can only be created by attach.  All other frames are
    considered local.  Whether a frame is local or not is recorded in
@@ -646,6 +757,22 @@ static SEXP R_HashProfile(SEXP table)
 #define MARK_AS_LOCAL_FRAME(e) \
   SET_ENVFLAGS(e, ENVFLAGS(e) & (~ GLOBAL_FRAME_MASK))
 
+/* a binding changed from 'old' to 'new' in an environment S3 dispatch
+   may have cached methods from; 'old' is NULL if not known.  Only
+   functions, or promises for them, can be methods. */
+static R_INLINE void S3_FLUSH(SEXP rho, SEXP sym, SEXP old, SEXP new)
+{
+    if ((IS_GLOBAL_FRAME(rho) || IS_S3_LOOKUP_FRAME(rho)) &&
+	(old == NULL || MAYBE_S3_METHOD(old) || MAYBE_S3_METHOD(new)))
+	R_S3MethodChanged(sym);
+}
+
+void attribute_hidden R_S3BindingChanged(SEXP rho, SEXP sym, SEXP old,
+					 SEXP new)
+{
+    S3_FLUSH(rho, sym, old, new);
+}
+
 #define INITIAL_CACHE_SIZE 1000
 
 static SEXP R_GlobalCache, R_GlobalCachePreserve;
@@ -693,7 +820,7 @@ static int hashIndex(SEXP symbol, SEXP table)
 	SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	SET_HASHASH(c, 1);
     }
-    return HASHVALUE(c) % HASHSIZE(table);
+    return hashBucket(HASHVALUE(c), table);
 }
 
 static void R_FlushGlobalCache(SEXP sym)
@@ -701,6 +828,8 @@ static void R_FlushGlobalCache(SEXP sym)
     SEXP entry = R_HashGetLoc(hashIndex(sym, R_GlobalCache), sym,
 			      R_GlobalCache);
     if (entry != R_NilValue) {
+	if (CAR(entry) != R_UnboundValue)
+	    R_GlobalCacheVersion++;
 	SETCAR(entry, R_UnboundValue);
 #ifdef FAST_BASE_CACHE_LOOKUP
 	UNSET_BASE_SYM_CACHED(sym);
@@ -798,7 +927,7 @@ static SEXP RemoveFromList(SEXP thing, SEXP list, int *found)
 	*found = 0;
 	return R_NilValue;
     }
-    else if (TAG(list) == thing) {
+    else if (TAG(list) == thing && ! UNASSIGNED_BINDING(list)) {
 	*found = 1;
 	SETCAR(list, R_UnboundValue); /* in case binding is cached */
 	LOCK_BINDING(list);           /* in case binding is cached */
@@ -810,7 +939,7 @@ static SEXP RemoveFromList(SEXP thing, SEXP list, int *found)
 	SEXP last = list;
 	SEXP next = CDR(list);
 	while (next != R_NilValue) {
-	    if (TAG(next) == thing) {
+	    if (TAG(next) == thing && ! UNASSIGNED_BINDING(next)) {
 		*found = 1;
 		SETCAR(next, R_UnboundValue); /* in case binding is cached */
 		LOCK_BINDING(next);           /* in case binding is cached */
@@ -843,6 +972,7 @@ void attribute_hidden unbindVar(SEXP symbol, SEXP rho)
     if (IS_GLOBAL_FRAME(rho))
 	R_FlushGlobalCache(symbol);
 #endif
+    S3_FLUSH(rho, symbol, NULL, R_NilValue);
     if (HASHTAB(rho) == R_NilValue) {
 	int found;
 	SEXP list;
@@ -859,7 +989,7 @@ void attribute_hidden unbindVar(SEXP symbol, SEXP rho)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c, 1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	hashcode = hashBucket(HASHVALUE(c), HASHTAB(rho));
 	R_HashDelete(hashcode, symbol, HASHTAB(rho));
 	/* we have no record here if deletion worked */
 	if (rho == R_GlobalEnv) R_DirtyImage = 1;
@@ -921,7 +1051,8 @@ static SEXP findVarLocInFrame(SEXP rho, SEXP symbol, Rboolean *canCache)
 
     if (HASHTAB(rho) == R_NilValue) {
 	frame = FRAME(rho);
-	while (frame != R_NilValue && TAG(frame) != symbol)
+	while (frame != R_NilValue &&
+	       (TAG(frame) != symbol || UNASSIGNED_BINDING(frame)))
 	    frame = CDR(frame);
 	return frame;
     }
@@ -931,7 +1062,7 @@ static SEXP findVarLocInFrame(SEXP rho, SEXP symbol, Rboolean *canCache)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c,  1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	hashcode = hashBucket(HASHVALUE(c), HASHTAB(rho));
 	/* Will return 'R_NilValue' if not found */
 	return R_HashGetLoc(hashcode, symbol, HASHTAB(rho));
     }
@@ -974,6 +1105,8 @@ Rboolean R_GetVarLocMISSING(R_varloc_t vl)
 attribute_hidden
 void R_SetVarLocValue(R_varloc_t vl, SEXP value)
 {
+    if (MAYBE_S3_METHOD(value) || MAYBE_S3_METHOD(CAR(vl.cell)))
+	R_S3MethodChanged(TYPEOF(vl.cell) == SYMSXP ? vl.cell : TAG(vl.cell));
     SET_BINDING_VALUE(vl.cell, value);
 }
 
@@ -1037,7 +1170,7 @@ SEXP findVarInFrame3(SEXP rho, SEXP symbol, Rboolean doGet)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c, 1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	hashcode = hashBucket(HASHVALUE(c), HASHTAB(rho));
 	/* Will return 'R_UnboundValue' if not found */
 	return(R_HashGet(hashcode, symbol, HASHTAB(rho)));
     }
@@ -1076,7 +1209,7 @@ static Rboolean existsVarInFrame(SEXP rho, SEXP symbol)
 	frame = FRAME(rho);
 	while (frame != R_NilValue) {
 	    if (TAG(frame) == symbol)
-		return TRUE;
+		return ! UNASSIGNED_BINDING(frame);
 	    frame = CDR(frame);
 	}
     }
@@ -1086,7 +1219,7 @@ static Rboolean existsVarInFrame(SEXP rho, SEXP symbol)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c, 1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	hashcode = hashBucket(HASHVALUE(c), HASHTAB(rho));
 	/* Will return 'R_UnboundValue' if not found */
 	return R_HashExists(hashcode, symbol, HASHTAB(rho));
     }
@@ -1174,34 +1307,74 @@ slowpath:
 */
 
 #ifdef USE_GLOBAL_CACHE
-/* findGlobalVar searches for a symbol value starting at R_GlobalEnv,
-   so the cache can be used. */
-static SEXP findGlobalVar(SEXP symbol)
+/* findGlobalVarLoc searches for the binding of a symbol starting at
+   R_GlobalEnv, and enters it in the cache if it can.  It returns the
+   binding cell, the symbol if the binding is in the base environment,
+   or R_NilValue if there is none. */
+static SEXP findGlobalVarLoc(SEXP symbol, Rboolean *canCache)
 {
     SEXP vl, rho;
-    Rboolean canCache = TRUE;
-    vl = R_GetGlobalCache(symbol);
-    if (vl != R_UnboundValue)
-	return vl;
+    *canCache = TRUE;
     for (rho = R_GlobalEnv; rho != R_EmptyEnv; rho = ENCLOS(rho)) {
 	if (rho != R_BaseEnv) { /* we won't have R_BaseNamespace */
-	    vl = findVarLocInFrame(rho, symbol, &canCache);
+	    vl = findVarLocInFrame(rho, symbol, canCache);
 	    if (vl != R_NilValue) {
-		if(canCache)
+		if(*canCache)
 		    R_AddGlobalCache(symbol, vl);
-		return BINDING_VALUE(vl);
+		return vl;
 	    }
 	} else {
-	    vl = SYMBOL_BINDING_VALUE(symbol);
-	    if (vl != R_UnboundValue)
-		R_AddGlobalCache(symbol, symbol);
-	    return vl;
+	    if (! SYMBOL_HAS_BINDING(symbol))
+		return R_NilValue;
+	    R_AddGlobalCache(symbol, symbol);
+	    return symbol;
 	}
 
     }
-    return R_UnboundValue;
+    return R_NilValue;
 }
+
+/* findGlobalVar searches for a symbol value starting at R_GlobalEnv,
+   so the cache can be used. */
+static SEXP findGlobalVar(SEXP symbol)
+{
+    SEXP vl;
+    Rboolean canCache;
+    vl = R_GetGlobalCache(symbol);
+    if (vl != R_UnboundValue)
+	return vl;
+    vl = findGlobalVarLoc(symbol, &canCache);
+    if (vl == R_NilValue)
+	return R_UnboundValue;
+    else if (TYPEOF(vl) == SYMSXP)
+	return SYMBOL_BINDING_VALUE(vl);
+    else
+	return BINDING_VALUE(vl);
+}
+#endif
+
+/* The place of the binding of a symbol visible from R_GlobalEnv as
+   recorded in the global cache: a binding cell, or the symbol if the
+   binding is in the base environment.  R_NilValue if there is no
+   binding or it cannot be cached. */
+SEXP attribute_hidden R_GlobalCacheLoc(SEXP symbol)
+{
+#ifdef USE_GLOBAL_CACHE
+    SEXP vl;
+    Rboolean canCache;
+#ifdef FAST_BASE_CACHE_LOOKUP
+    if (BASE_SYM_CACHED(symbol))
+	return symbol;
+#endif
+    vl = R_HashGet(hashIndex(symbol, R_GlobalCache), symbol, R_GlobalCache);
+    if (vl != R_UnboundValue)
+	return vl;
+    vl = findGlobalVarLoc(symbol, &canCache);
+    return canCache ? vl : R_NilValue;
+#else
+    return R_NilValue;
 #endif
+}
 
 SEXP findVar(SEXP symbol, SEXP rho)
 {
@@ -1503,6 +1676,7 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 #ifdef USE_GLOBAL_CACHE
 	if (IS_GLOBAL_FRAME(rho)) R_FlushGlobalCache(symbol);
 #endif
+	S3_FLUSH(rho, symbol, NULL, value);
 	return;
     }
 
@@ -1521,6 +1695,7 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 	    frame = FRAME(rho);
 	    while (frame != R_NilValue) {
 		if (TAG(frame) == symbol) {
+		    S3_FLUSH(rho, symbol, CAR(frame), value);
 		    SET_BINDING_VALUE(frame, value);
 		    SET_MISSING(frame, 0);	/* Over-ride */
 		    return;
@@ -1529,6 +1704,7 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 	    }
 	    if (FRAME_IS_LOCKED(rho))
 		error(_("cannot add bindings to a locked environment"));
+	    S3_FLUSH(rho, symbol, R_NilValue, value);
 	    SET_FRAME(rho, CONS(value, FRAME(rho)));
 	    SET_TAG(FRAME(rho), symbol);
 	}
@@ -1538,11 +1714,14 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 		SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 		SET_HASHASH(c, 1);
 	    }
-	    hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
-	    R_HashSet(hashcode, symbol, HASHTAB(rho), value,
-		      FRAME_IS_LOCKED(rho));
-	    if (R_HashSizeCheck(HASHTAB(rho)))
-		SET_HASHTAB(rho, R_HashResize(HASHTAB(rho)));
+	    hashcode = hashBucket(HASHVALUE(c), HASHTAB(rho));
+	    SEXP old = R_HashSet(hashcode, symbol, HASHTAB(rho), value,
+				 FRAME_IS_LOCKED(rho));
+	    S3_FLUSH(rho, symbol, old, value);
+	    if (HASHSPLIT(HASHTAB(rho)) != R_NilValue)
+		R_HashSplit(HASHTAB(rho), HASHSPLITSTEPS);
+	    else if (R_HashSizeCheck(HASHTAB(rho)))
+		SET_HASHTAB(rho, R_HashStartSplit(HASHTAB(rho)));
 	}
     }
 }
@@ -1630,11 +1809,14 @@ static SEXP setVarInFrame(SEXP rho, SEXP symbol, SEXP value)
 	PROTECT(value);
 	SEXP result = table->assign(CHAR(PRINTNAME(symbol)), value, table);
 	UNPROTECT(1);
+	S3_FLUSH(rho, symbol, NULL, value);
 	return(result);
     }
 
     if (rho == R_BaseNamespace || rho == R_BaseEnv) {
 	if (SYMVALUE(symbol) == R_UnboundValue) return R_NilValue;
+	if (MAYBE_S3_METHOD(SYMVALUE(symbol)) || MAYBE_S3_METHOD(value))
+	    R_S3MethodChanged(symbol);
 	SET_SYMBOL_BINDING_VALUE(symbol, value);
 	return symbol;
     }
@@ -1643,6 +1825,9 @@ static SEXP setVarInFrame(SEXP rho, SEXP symbol, SEXP value)
 	frame = FRAME(rho);
 	while (frame != R_NilValue) {
 	    if (TAG(frame) == symbol) {
+		if (UNASSIGNED_BINDING(frame))
+		    break;
+		S3_FLUSH(rho, symbol, CAR(frame), value);
 		SET_BINDING_VALUE(frame, value);
 		SET_MISSING(frame, 0);	/* same as defineVar */
 		return symbol;
@@ -1656,9 +1841,10 @@ static SEXP setVarInFrame(SEXP rho, SEXP symbol, SEXP value)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c, 1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	hashcode = hashBucket(HASHVALUE(c), HASHTAB(rho));
 	frame = R_HashGetLoc(hashcode, symbol, HASHTAB(rho));
 	if (frame != R_NilValue) {
+	    S3_FLUSH(rho, symbol, CAR(frame), value);
 	    SET_BINDING_VALUE(frame, value);
 	    SET_MISSING(frame, 0);	/* same as defineVar */
 	    return symbol;
@@ -1716,6 +1902,8 @@ void gsetVar(SEXP symbol, SEXP value, SEXP rho)
 #ifdef USE_GLOBAL_CACHE
     R_FlushGlobalCache(symbol);
 #endif
+    if (MAYBE_S3_METHOD(SYMVALUE(symbol)) || MAYBE_S3_METHOD(value))
+	R_S3MethodChanged(symbol);
     SET_SYMBOL_BINDING_VALUE(symbol, value);
 }
 
@@ -1781,10 +1969,12 @@ SEXP attribute_hidden do_list2env(SEXP call, SEXP op, SEXP args, SEXP rho)
     if (TYPEOF(envir) != ENVSXP)
 	error(_("'envir' argument must be an environment"));
 
-    for(int i = 0; i < n; i++) {
-	SEXP name = installTrChar(STRING_ELT(xnms, i));
-	defineVar(name, VECTOR_ELT(x, i), envir);
-    }
+    const void *vmax = vmaxget();
+    SEXP *names = (SEXP *) R_alloc(n, sizeof(SEXP));
+    if (n) installN(xnms, names);
+    for(int i = 0; i < n; i++)
+	defineVar(names[i], VECTOR_ELT(x, i), envir);
+    vmaxset(vmax);
 
     return envir;
 }
@@ -1821,12 +2011,13 @@ static int RemoveVariable(SEXP name, int hashcode, SEXP env)
 	table = (R_ObjectTable *) R_ExternalPtrAddr(HASHTAB(env));
 	if(table->remove == NULL)
 	    error(_("cannot remove variables from this database"));
+	S3_FLUSH(env, name, NULL, R_NilValue);
 	return(table->remove(CHAR(PRINTNAME(name)), table));
     }
 
     if (IS_HASHED(env)) {
 	SEXP hashtab = HASHTAB(env);
-	int idx = hashcode % HASHSIZE(hashtab);
+	int idx = hashBucket(hashcode, hashtab);
 	list = RemoveFromList(name, VECTOR_ELT(hashtab, idx), &found);
 	if (found) {
 	    if(env == R_GlobalEnv) R_DirtyImage = 1;
@@ -1837,6 +2028,7 @@ static int RemoveVariable(SEXP name, int hashcode, SEXP env)
 	    if (IS_GLOBAL_FRAME(env))
 		R_FlushGlobalCache(name);
 #endif
+	    S3_FLUSH(env, name, NULL, R_NilValue);
 	}
     }
     else {
@@ -1848,6 +2040,7 @@ static int RemoveVariable(SEXP name, int hashcode, SEXP env)
 	    if (IS_GLOBAL_FRAME(env))
 		R_FlushGlobalCache(name);
 #endif
+	    S3_FLUSH(env, name, NULL, R_NilValue);
 	}
     }
     return found;
@@ -2010,19 +2203,17 @@ SEXP attribute_hidden do_get(SEXP call, SEXP op, SEXP args, SEXP rho)
 }
 #undef GET_VALUE
 
-static SEXP gfind(const char *name, SEXP env, SEXPTYPE mode,
+static SEXP gfind(SEXP t1, SEXP env, SEXPTYPE mode,
 		  SEXP ifnotfound, int inherits, SEXP enclos)
 {
-    SEXP rval, t1, R_fcall, var;
-
-    t1 = install(name);
+    SEXP rval, R_fcall, var;
 
     /* Search for the object - last arg is 1 to 'get' */
     rval = findVar1mode(t1, env, mode, inherits, 1);
 
     if (rval == R_UnboundValue) {
 	if( isFunction(ifnotfound) ) {
-	    PROTECT(var = mkString(name));
+	    PROTECT(var = ScalarString(PRINTNAME(t1)));
 	    PROTECT(R_fcall = LCONS(ifnotfound, LCONS(var, R_NilValue)));
 	    rval = eval(R_fcall, enclos);
 	    UNPROTECT(2);
@@ -2092,22 +2283,30 @@ SEXP attribute_hidden do_mget(SEXP call, SEXP op, SEXP args, SEXP rho)
     if (ginherits == NA_LOGICAL)
 	error(_("invalid '%s' argument"), "inherits");
 
-    PROTECT(ans = allocVector(VECSXP, nvals));
-
-    for(int i = 0; i < nvals; i++) {
-	SEXPTYPE gmode;
-	if (!strcmp(CHAR(STRING_ELT(CADDR(args), i % nmode)), "function"))
-	    gmode = FUNSXP;
+    /* Convert the modes and install the names once, not per element */
+    const void *vmax = vmaxget();
+    SEXPTYPE *gmodes = (SEXPTYPE *) R_alloc(nmode, sizeof(SEXPTYPE));
+    for(int i = 0; i < nmode; i++) {
+	if (!strcmp(CHAR(STRING_ELT(mode, i)), "function"))
+	    gmodes[i] = FUNSXP;
 	else {
-	    gmode = str2type(CHAR(STRING_ELT(CADDR(args), i % nmode)));
-	    if(gmode == (SEXPTYPE) (-1))
+	    gmodes[i] = str2type(CHAR(STRING_ELT(mode, i)));
+	    if(gmodes[i] == (SEXPTYPE) (-1))
 		error(_("invalid '%s' argument"), "mode");
 	}
-	SEXP ans_i = gfind(translateChar(STRING_ELT(x, i % nvals)), env,
-			   gmode, VECTOR_ELT(ifnotfound, i % nifnfnd),
+    }
+    SEXP *syms = (SEXP *) R_alloc(nvals, sizeof(SEXP));
+    installN(x, syms);
+
+    PROTECT(ans = allocVector(VECSXP, nvals));
+
+    for(int i = 0; i < nvals; i++) {
+	SEXP ans_i = gfind(syms[i], env, gmodes[i % nmode],
+			   VECTOR_ELT(ifnotfound, i % nifnfnd),
 			   ginherits, rho);
 	SET_VECTOR_ELT(ans, i, lazy_duplicate(ans_i));
     }
+    vmaxset(vmax);
 
     setAttrib(ans, R_NamesSymbol, lazy_duplicate(x));
     UNPROTECT(2);
@@ -2363,7 +2562,8 @@ SEXP attribute_hidden do_attach(SEXP call, SEXP op, SEXP args, SEXP env)
 		/* FIXME: duplicate the hash table and assign here */
 	    } else {
 		for(p = FRAME(loadenv); p != R_NilValue; p = CDR(p))
-		    defineVar(TAG(p), lazy_duplicate(CAR(p)), s);
+		    if (! UNASSIGNED_BINDING(p))
+			defineVar(TAG(p), lazy_duplicate(CAR(p)), s);
 	    }
 	} else {
 	    error(_("'attach' only works for lists, data frames and environments"));
@@ -2409,6 +2609,7 @@ SEXP attribute_hidden do_attach(SEXP call, SEXP op, SEXP args, SEXP env)
 	SET_ENCLOS(s, x);
     }
 
+    R_S3FlushCache();
     if(!isSpecial) { /* Temporary: need to remove the elements identified by objects(CAR(args)) */
 #ifdef USE_GLOBAL_CACHE
 	R_FlushGlobalCacheFromTable(HASHTAB(s));
@@ -2469,6 +2670,7 @@ SEXP attribute_hidden do_detach(SEXP call, SEXP op, SEXP args, SEXP env)
 
 	SET_ENCLOS(s, R_BaseEnv);
     }
+    R_S3FlushCache();
 #ifdef USE_GLOBAL_CACHE
     if(!isSpecial) {
 	R_FlushGlobalCacheFromTable(HASHTAB(s));
@@ -2535,7 +2737,8 @@ static int FrameSize(SEXP frame, int all)
     int count = 0;
     if (all) {
 	while (frame != R_NilValue) {
-	    count += 1;
+	    if (! UNASSIGNED_BINDING(frame))
+		count += 1;
 	    frame = CDR(frame);
 	}
     } else {
@@ -2552,8 +2755,10 @@ static void FrameNames(SEXP frame, int all, SEXP names, int *indx)
 {
     if (all) {
 	while (frame != R_NilValue) {
-	    SET_STRING_ELT(names, *indx, PRINTNAME(TAG(frame)));
-	    (*indx)++;
+	    if (! UNASSIGNED_BINDING(frame)) {
+		SET_STRING_ELT(names, *indx, PRINTNAME(TAG(frame)));
+		(*indx)++;
+	    }
 	    frame = CDR(frame);
 	}
     } else {
@@ -2581,7 +2786,9 @@ static void FrameValues(SEXP frame, int all, SEXP values, int *indx)
 	    SET_VECTOR_ELT(values, *indx, lazy_duplicate(value));	\
 	    (*indx)++
 
-	    DO_FrameValues;
+	    if (! UNASSIGNED_BINDING(frame)) {
+		DO_FrameValues;
+	    }
 	    frame = CDR(frame);
 	}
     } else {
@@ -2635,17 +2842,17 @@ static int BuiltinSize(int all, int intern)
     int count = 0;
     SEXP s;
     int j;
-    for (j = 0; j < HSIZE; j++) {
-	for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s)) {
-	    if (intern) {
-		if (INTERNAL(CAR(s)) != R_NilValue)
-		    count++;
-	    }
-	    else {
-		if ((all || CHAR(PRINTNAME(CAR(s)))[0] != '.')
-		    && SYMVALUE(CAR(s)) != R_UnboundValue)
-		    count++;
-	    }
+    for (j = 0; j < R_SymbolTableSize; j++) {
+	if ((s = R_SymbolTable[j]) == NULL)
+	    continue;
+	if (intern) {
+	    if (INTERNAL(s) != R_NilValue)
+		count++;
+	}
+	else {
+	    if ((all || CHAR(PRINTNAME(s))[0] != '.')
+		&& SYMVALUE(s) != R_UnboundValue)
+		count++;
 	}
     }
     return count;
@@ -2656,53 +2863,67 @@ BuiltinNames(int all, int intern, SEXP names, int *indx)
 {
     SEXP s;
     int j;
-    for (j = 0; j < HSIZE; j++) {
-	for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s)) {
-	    if (intern) {
-		if (INTERNAL(CAR(s)) != R_NilValue)
-		    SET_STRING_ELT(names, (*indx)++, PRINTNAME(CAR(s)));
-	    }
-	    else {
-		if ((all || CHAR(PRINTNAME(CAR(s)))[0] != '.')
-		    && SYMVALUE(CAR(s)) != R_UnboundValue)
-		    SET_STRING_ELT(names, (*indx)++, PRINTNAME(CAR(s)));
-	    }
+    for (j = 0; j < R_SymbolTableSize; j++) {
+	if ((s = R_SymbolTable[j]) == NULL)
+	    continue;
+	if (intern) {
+	    if (INTERNAL(s) != R_NilValue)
+		SET_STRING_ELT(names, (*indx)++, PRINTNAME(s));
+	}
+	else {
+	    if ((all || CHAR(PRINTNAME(s))[0] != '.')
+		&& SYMVALUE(s) != R_UnboundValue)
+		SET_STRING_ELT(names, (*indx)++, PRINTNAME(s));
 	}
     }
 }
 
+/* The names are stored in 'names' if it is not NULL, in the same order
+   as the values. */
 static void
-BuiltinValues(int all, int intern, SEXP values, int *indx)
+BuiltinValues(int all, int intern, SEXP values, SEXP names, int *indx)
 {
     SEXP s, vl;
-    int j;
-    for (j = 0; j < HSIZE; j++) {
-	for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s)) {
-	    if (intern) {
-		if (INTERNAL(CAR(s)) != R_NilValue) {
-		    vl = SYMVALUE(CAR(s));
-		    if (TYPEOF(vl) == PROMSXP) {
-			PROTECT(vl);
-			vl = eval(vl, R_BaseEnv);
-			UNPROTECT(1);
-		    }
-		    SET_VECTOR_ELT(values, (*indx)++, lazy_duplicate(vl));
+    int j, size = R_SymbolTableSize;
+    /* Work on a copy of the table, which evaluating the promises might
+       enlarge and so reorder: names taken from the table itself, before
+       or after, need not match the values.  Symbols are never
+       collected. */
+    const void *vmax = vmaxget();
+    SEXP *table = (SEXP *) R_alloc(size, sizeof(SEXP));
+    memcpy(table, R_SymbolTable, size * sizeof(SEXP));
+    for (j = 0; j < size; j++) {
+	if ((s = table[j]) == NULL)
+	    continue;
+	if (intern) {
+	    if (INTERNAL(s) != R_NilValue) {
+		vl = SYMVALUE(s);
+		if (TYPEOF(vl) == PROMSXP) {
+		    PROTECT(vl);
+		    vl = eval(vl, R_BaseEnv);
+		    UNPROTECT(1);
 		}
+		if (names != NULL)
+		    SET_STRING_ELT(names, *indx, PRINTNAME(s));
+		SET_VECTOR_ELT(values, (*indx)++, lazy_duplicate(vl));
 	    }
-	    else {
-		if ((all || CHAR(PRINTNAME(CAR(s)))[0] != '.')
-		    && SYMVALUE(CAR(s)) != R_UnboundValue) {
-		    vl = SYMVALUE(CAR(s));
-		    if (TYPEOF(vl) == PROMSXP) {
-			PROTECT(vl);
-			vl = eval(vl, R_BaseEnv);
-			UNPROTECT(1);
-		    }
-		    SET_VECTOR_ELT(values, (*indx)++, lazy_duplicate(vl));
+	}
+	else {
+	    if ((all || CHAR(PRINTNAME(s))[0] != '.')
+		&& SYMVALUE(s) != R_UnboundValue) {
+		vl = SYMVALUE(s);
+		if (TYPEOF(vl) == PROMSXP) {
+		    PROTECT(vl);
+		    vl = eval(vl, R_BaseEnv);
+		    UNPROTECT(1);
 		}
+		if (names != NULL)
+		    SET_STRING_ELT(names, *indx, PRINTNAME(s));
+		SET_VECTOR_ELT(values, (*indx)++, lazy_duplicate(vl));
 	    }
 	}
     }
+    vmaxset(vmax);
 }
 
 // .Internal(ls(envir, all.names, sorted)) :
@@ -2816,19 +3037,19 @@ SEXP attribute_hidden do_env2list(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     k = 0;
     if (env == R_BaseEnv || env == R_BaseNamespace)
-	BuiltinValues(all, 0, ans, &k);
-    else if (HASHTAB(env) != R_NilValue)
-	HashTableValues(HASHTAB(env), all, ans, &k);
-    else
-	FrameValues(FRAME(env), all, ans, &k);
+	BuiltinValues(all, 0, ans, names, &k);
+    else {
+	if (HASHTAB(env) != R_NilValue)
+	    HashTableValues(HASHTAB(env), all, ans, &k);
+	else
+	    FrameValues(FRAME(env), all, ans, &k);
 
-    k = 0;
-    if (env == R_BaseEnv || env == R_BaseNamespace)
-	BuiltinNames(all, 0, names, &k);
-    else if (HASHTAB(env) != R_NilValue)
-	HashTableNames(HASHTAB(env), all, names, &k);
-    else
-	FrameNames(FRAME(env), all, names, &k);
+	k = 0;
+	if (HASHTAB(env) != R_NilValue)
+	    HashTableNames(HASHTAB(env), all, names, &k);
+	else
+	    FrameNames(FRAME(env), all, names, &k);
+    }
 
     if(k == 0) { // no sorting, keep NULL names
 	UNPROTECT(2);
@@ -2866,7 +3087,7 @@ SEXP attribute_hidden do_env2list(SEXP call, SEXP op, SEXP args, SEXP rho)
 /* This is a special .Internal */
 SEXP attribute_hidden do_eapply(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
-    SEXP env, ans, R_fcall, FUN, tmp, tmp2, ind;
+    SEXP env, ans, R_fcall, FUN, tmp, tmp2, ind, names;
     int i, k, k2;
     int /* boolean */ all, useNms;
 
@@ -2899,14 +3120,25 @@ SEXP attribute_hidden do_eapply(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     PROTECT(ans  = allocVector(VECSXP, k));
     PROTECT(tmp2 = allocVector(VECSXP, k));
+    PROTECT(names = useNms ? allocVector(STRSXP, k) : R_NilValue);
 
     k2 = 0;
     if (env == R_BaseEnv || env == R_BaseNamespace)
-	BuiltinValues(all, 0, tmp2, &k2);
-    else if (HASHTAB(env) != R_NilValue)
-	HashTableValues(HASHTAB(env), all, tmp2, &k2);
-    else
-	FrameValues(FRAME(env), all, tmp2, &k2);
+	BuiltinValues(all, 0, tmp2, useNms ? names : NULL, &k2);
+    else {
+	if (HASHTAB(env) != R_NilValue)
+	    HashTableValues(HASHTAB(env), all, tmp2, &k2);
+	else
+	    FrameValues(FRAME(env), all, tmp2, &k2);
+
+	if (useNms) {
+	    k = 0;
+	    if (HASHTAB(env) != R_NilValue)
+		HashTableNames(HASHTAB(env), all, names, &k);
+	    else
+		FrameNames(FRAME(env), all, names, &k);
+	}
+    }
 
     SEXP Xsym = install("X");
     SEXP isym = install("i");
@@ -2930,21 +3162,9 @@ SEXP attribute_hidden do_eapply(SEXP call, SEXP op, SEXP args, SEXP rho)
 	SET_VECTOR_ELT(ans, i, tmp);
     }
 
-    if (useNms) {
-	SEXP names;
-	PROTECT(names = allocVector(STRSXP, k));
-	k = 0;
-	if (env == R_BaseEnv || env == R_BaseNamespace)
-	    BuiltinNames(all, 0, names, &k);
-	else if(HASHTAB(env) != R_NilValue)
-	    HashTableNames(HASHTAB(env), all, names, &k);
-	else
-	    FrameNames(FRAME(env), all, names, &k);
-
+    if (useNms)
 	setAttrib(ans, R_NamesSymbol, names);
-	UNPROTECT(1);
-    }
-    UNPROTECT(6);
+    UNPROTECT(7);
     return(ans);
 }
 
@@ -3127,6 +3347,30 @@ do_as_environment(SEXP call, SEXP op, SEXP args, SEXP rho)
     }
 }
 
+/* The frame of an unhashed environment without its unassigned
+   bindings, for writing it out: a copy if there are any */
+SEXP attribute_hidden R_VisibleFrame(SEXP env)
+{
+    SEXP frame = FRAME(env), head, last, cell;
+
+    for (cell = frame; cell != R_NilValue; cell = CDR(cell))
+	if (UNASSIGNED_BINDING(cell)) break;
+    if (cell == R_NilValue)
+	return frame;
+
+    PROTECT(head = last = CONS(R_NilValue, R_NilValue));
+    for (; frame != R_NilValue; frame = CDR(frame))
+	if (! UNASSIGNED_BINDING(frame)) {
+	    cell = CONS(CAR(frame), R_NilValue);
+	    SETCDR(last, cell);
+	    SET_TAG(cell, TAG(frame));
+	    SETLEVELS(cell, LEVELS(frame));
+	    last = cell;
+	}
+    UNPROTECT(1);
+    return CDR(head);
+}
+
 void R_LockEnvironment(SEXP env, Rboolean bindings)
 {
     if(IS_S4_OBJECT(env) && (TYPEOF(env) == S4SXP))
@@ -3135,10 +3379,10 @@ void R_LockEnvironment(SEXP env, Rboolean bindings)
 	if (bindings) {
 	    SEXP s;
 	    int j;
-	    for (j = 0; j < HSIZE; j++)
-		for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s))
-		    if(SYMVALUE(CAR(s)) != R_UnboundValue)
-			LOCK_BINDING(CAR(s));
+	    for (j = 0; j < R_SymbolTableSize; j++)
+		if ((s = R_SymbolTable[j]) != NULL &&
+		    SYMVALUE(s) != R_UnboundValue)
+		    LOCK_BINDING(s);
 	}
 #ifdef NOT_YET
 	/* causes problems with Matrix */
@@ -3149,6 +3393,24 @@ void R_LockEnvironment(SEXP env, Rboolean bindings)
 
     if (TYPEOF(env) != ENVSXP)
 	error(_("not an environment"));
+    if (! IS_HASHED(env)) {
+	/* unassigned variables of compiled closures can no longer be
+	   added, so remove them as rm() would */
+	SEXP frame = FRAME(env), prev = R_NilValue;
+	while (frame != R_NilValue) {
+	    SEXP next = CDR(frame);
+	    if (UNASSIGNED_BINDING(frame)) {
+		LOCK_BINDING(frame);	/* in case binding is cached */
+		if (prev == R_NilValue)
+		    SET_FRAME(env, next);
+		else
+		    SETCDR(prev, next);
+		SETCDR(frame, R_NilValue);
+	    }
+	    else prev = frame;
+	    frame = next;
+	}
+    }
     if (bindings) {
 	if (IS_HASHED(env)) {
 	    SEXP table, chain;
@@ -3257,6 +3519,7 @@ void R_MakeActiveBinding(SEXP sym, SEXP fun, SEXP env)
 	    error(_("cannot change active binding if binding is locked"));
 	SET_SYMVALUE(sym, fun);
 	SET_ACTIVE_BINDING_BIT(sym);
+	R_S3ActiveBinding(sym, env);
 	/* we don't need to worry about the global cache here as
 	   a regular binding cannot be changed */
     }
@@ -3273,6 +3536,7 @@ void R_MakeActiveBinding(SEXP sym, SEXP fun, SEXP env)
 	    error(_("cannot change active binding if binding is locked"));
 	else
 	    SETCAR(binding, fun);
+	R_S3ActiveBinding(sym, env);
     }
 }
 
@@ -3410,6 +3674,7 @@ SEXP attribute_hidden do_mkUnbound(SEXP call, SEXP op, SEXP args, SEXP rho)
 #ifdef USE_GLOBAL_CACHE
     R_FlushGlobalCache(sym);
 #endif
+    R_S3MethodChanged(sym);
     return R_NilValue;
 }
 
@@ -3726,12 +3991,34 @@ SEXP mkChar(const char *name)
    and a power of 2 for the hash size.
 */
 
-/* char_hash_size MUST be a power of 2 and char_hash_mask ==
-   char_hash_size - 1 for x & char_hash_mask to be equivalent to x %
-   char_hash_size.
+/* The cache is an open-addressed table with linear probing whose size
+   is a power of 2.  Empty slots are NULL, and slots whose CHARSXP was
+   released by the garbage collector (see RunGenCollect) are set to
+   R_NilValue, which insertion re-uses.  The full hash value of each
+   entry is kept alongside it so that probes rarely need to look at
+   the strings and rehashing does not recompute them.
+
+   When more than half of the slots are in use or deleted the table is
+   replaced by one twice the size (or of the same size, if most are
+   deleted entries) and the old table becomes R_StringHash[1].  Each
+   insertion then moves a few of its slots to the new table, so there
+   is no pause to rehash the whole cache; until that is done lookups
+   try both.
 */
-static unsigned int char_hash_size = 65536;
-static unsigned int char_hash_mask = 65535;
+
+#define CHAR_HASH_MINSIZE 65536
+#define CHAR_HASH_MIGRATE 16	/* old slots moved per insertion */
+/* would adding n entries take t over the maximal load? */
+#define CHAR_HASH_FULL(t, n) \
+    ((t)->used + (t)->deleted + (n) > (t)->size / 2)
+
+static R_size_t char_hash_migrated; /* slots of R_StringHash[1] moved */
+
+static struct {
+    double lookups, probes;
+    R_size_t maxprobe;
+    int growths;
+} char_hash_stats;
 
 static unsigned int char_hash(const char *s, int len)
 {
@@ -3741,65 +4028,127 @@ static unsigned int char_hash(const char *s, int len)
     unsigned int h = 5381;
     for (p = (char *) s, i = 0; i < len; p++, i++)
 	h = ((h << 5) + h) + (*p);
+    /* mix the high bits into the low ones used for the slot, as
+       similar strings otherwise form long runs under linear probing */
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
     return h;
 }
 
+static Rboolean StringTableAlloc(R_StringTable *t, R_size_t size)
+{
+    t->slots = (R_StringSlot *) calloc(size, sizeof(R_StringSlot));
+    if (t->slots == NULL) return FALSE;
+    t->size = size;
+    t->used = t->deleted = 0;
+    return TRUE;
+}
+
+static void StringTableFree(R_StringTable *t)
+{
+    free(t->slots);
+    t->slots = NULL;
+    t->size = t->used = t->deleted = 0;
+}
+
 void attribute_hidden InitStringHash()
 {
-    R_StringHash = R_NewHashTable(char_hash_size);
+    if (!StringTableAlloc(&R_StringHash[0], CHAR_HASH_MINSIZE))
+	R_Suicide("couldn't allocate the CHARSXP cache");
+    R_StringHash[1].slots = NULL;
 }
 
-/* #define DEBUG_GLOBAL_STRING_HASH 1 */
+/* Find a CHARSXP for name, len and encoding in table t, or NULL */
+static R_INLINE SEXP
+StringTableGet(R_StringTable *t, const char *name, int len, int need_enc,
+	       unsigned int h)
+{
+    R_size_t mask = t->size - 1, i, np = 1;
+    SEXP val;
+    for (i = h & mask; (val = t->slots[i].c) != NULL; i = (i + 1) & mask, np++)
+	if (t->slots[i].hash == h && val != R_NilValue &&
+	    need_enc == (ENC_KNOWN(val) | IS_BYTES(val)) &&
+	    LENGTH(val) == len &&  /* quick pretest */
+	    (!len || (memcmp(CHAR(val), name, len) == 0))) // called with len = 0
+	    break;
+    char_hash_stats.probes += np;
+    if (np > char_hash_stats.maxprobe) char_hash_stats.maxprobe = np;
+    return val;
+}
 
-/* Resize the global R_StringHash CHARSXP cache */
-static void R_StringHash_resize(unsigned int newsize)
+/* Add c, which is not in table t */
+static void StringTablePut(R_StringTable *t, SEXP c, unsigned int h)
 {
-    SEXP old_table = R_StringHash;
-    SEXP new_table, chain, new_chain, val, next;
-    unsigned int counter, new_hashcode, newmask;
-#ifdef DEBUG_GLOBAL_STRING_HASH
-    unsigned int oldsize = HASHSIZE(R_StringHash);
-    unsigned int oldpri = HASHPRI(R_StringHash);
-    unsigned int newsize, newpri;
-#endif
+    R_size_t mask = t->size - 1, i;
+    for (i = h & mask; t->slots[i].c != NULL && t->slots[i].c != R_NilValue;
+	 i = (i + 1) & mask);
+    if (t->slots[i].c == R_NilValue) t->deleted--;
+    t->slots[i].c = c;
+    t->slots[i].hash = h;
+    t->used++;
+}
 
-    /* Allocate the new hash table.  This could fail to allocate
-       enough memory, and ideally we would recover from that and
-       carry over with a table that was getting full.
-     */
-    /* When using the ATTRIB fields to maintain the chains the chain
-       moving is destructive and does not involve allocation.  This is
-       therefore the only point where GC can occur. */
-    new_table = R_NewHashTable(newsize);
-    newmask = newsize - 1;
-
-    /* transfer chains from old table to new table */
-    for (counter = 0; counter < LENGTH(old_table); counter++) {
-	chain = VECTOR_ELT(old_table, counter);
-	while (!ISNULL(chain)) {
-	    val = CXHEAD(chain);
-	    next = CXTAIL(chain);
-	    new_hashcode = char_hash(CHAR(val), LENGTH(val)) & newmask;
-	    new_chain = VECTOR_ELT(new_table, new_hashcode);
-	    /* If using a primary slot then increase HASHPRI */
-	    if (ISNULL(new_chain))
-		SET_HASHPRI(new_table, HASHPRI(new_table) + 1);
-	    /* move the current chain link to the new chain */
-	    /* this is a destrictive modification */
-	    new_chain = SET_CXTAIL(val, new_chain);
-	    SET_VECTOR_ELT(new_table, new_hashcode, new_chain);
-	    chain = next;
+/* Move up to n more slots of the old table to the current one */
+static void R_StringHash_migrate(R_size_t n)
+{
+    R_StringTable *old = &R_StringHash[1];
+    R_size_t i, end = char_hash_migrated + n;
+    if (end > old->size) end = old->size;
+    for (i = char_hash_migrated; i < end; i++) {
+	SEXP c = old->slots[i].c;
+	if (c != NULL && c != R_NilValue) {
+	    StringTablePut(&R_StringHash[0], c, old->slots[i].hash);
+	    old->slots[i].c = R_NilValue;
+	    old->used--;
+	    old->deleted++;
 	}
     }
-    R_StringHash = new_table;
-    char_hash_size = newsize;
-    char_hash_mask = newmask;
-#ifdef DEBUG_GLOBAL_STRING_HASH
-    newsize = HASHSIZE(new_table);
-    newpri = HASHPRI(new_table);
-    Rprintf("Resized: size %d => %d\tpri %d => %d\n",
-	    oldsize, newsize, oldpri, newpri);
-#endif
+    char_hash_migrated = end;
+    if (end == old->size) StringTableFree(old);
+}
+
+/* Start growing the cache so that it has room for n more entries */
+static void R_StringHash_resize(R_size_t n)
+{
+    R_StringTable *t = &R_StringHash[0], newt;
+    R_size_t newsize = t->size;
+
+    /* complete any earlier resize */
+    if (R_StringHash[1].slots != NULL)
+	R_StringHash_migrate(R_StringHash[1].size);
+    while (newsize / 2 < t->used + n) newsize *= 2;
+    /* A table which is full only because of deleted slots is rebuilt
+       at the same size to clear them, unless a quarter or more of it
+       is in use: then it is doubled, so that a rebuild leaves room for
+       at least a quarter of its size in new entries. */
+    if (newsize == t->size && t->used >= t->size / 4) newsize *= 2;
+    if (!StringTableAlloc(&newt, newsize))
+	error(_("cannot allocate memory for the CHARSXP cache"));
+    R_StringHash[1] = *t;
+    R_StringHash[0] = newt;
+    char_hash_migrated = 0;
+    char_hash_stats.growths++;
+}
+
+static R_INLINE SEXP
+R_StringHash_get(const char *name, int len, int need_enc, unsigned int h)
+{
+    SEXP val = StringTableGet(&R_StringHash[0], name, len, need_enc, h);
+    if (val == NULL && R_StringHash[1].slots != NULL)
+	val = StringTableGet(&R_StringHash[1], name, len, need_enc, h);
+    char_hash_stats.lookups++;
+    return val;
+}
+
+static void R_StringHash_put(SEXP c, unsigned int h)
+{
+    R_StringTable *t = &R_StringHash[0];
+    StringTablePut(t, c, h);
+    if (R_StringHash[1].slots != NULL)
+	R_StringHash_migrate(CHAR_HASH_MIGRATE);
+    if (CHAR_HASH_FULL(t, 0))
+	R_StringHash_resize(0);
 }
 
 /* mkCharCE - make a character (CHARSXP) variable and set its
@@ -3810,7 +4159,7 @@ static void R_StringHash_resize(unsigned int newsize)
 
 SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
 {
-    SEXP cval, chain;
+    SEXP cval;
     unsigned int hashcode;
     int need_enc;
     Rboolean embedNul = FALSE, is_ascii = TRUE;
@@ -3856,22 +4205,11 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
     default: need_enc = 0;
     }
 
-    hashcode = char_hash(name, len) & char_hash_mask;
+    hashcode = char_hash(name, len);
 
     /* Search for a cached value */
-    cval = R_NilValue;
-    chain = VECTOR_ELT(R_StringHash, hashcode);
-    for (; !ISNULL(chain) ; chain = CXTAIL(chain)) {
-	SEXP val = CXHEAD(chain);
-	if (TYPEOF(val) != CHARSXP) break; /* sanity check */
-	if (need_enc == (ENC_KNOWN(val) | IS_BYTES(val)) &&
-	    LENGTH(val) == len &&  /* quick pretest */
-	    (!len || (memcmp(CHAR(val), name, len) == 0))) { // called with len = 0
-	    cval = val;
-	    break;
-	}
-    }
-    if (cval == R_NilValue) {
+    cval = R_StringHash_get(name, len, need_enc, hashcode);
+    if (cval == NULL) {
 	/* no cached value; need to allocate one and add to the cache */
 	PROTECT(cval = allocCharsxp(len));
 	memcpy(CHAR_RW(cval), name, len);
@@ -3893,82 +4231,95 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
 	if (is_ascii) SET_ASCII(cval);
 	SET_CACHED(cval);  /* Mark it */
 	/* add the new value to the cache */
-	chain = VECTOR_ELT(R_StringHash, hashcode);
-	if (ISNULL(chain))
-	    SET_HASHPRI(R_StringHash, HASHPRI(R_StringHash) + 1);
-	/* this is a destrictive modification */
-	chain = SET_CXTAIL(cval, chain);
-	SET_VECTOR_ELT(R_StringHash, hashcode, chain);
-
-	/* resize the hash table if necessary with the new entry still
-	   protected.
-	   Maximum possible power of two is 2^30 for a VECSXP.
-	   FIXME: this has changed with long vectors.
-	*/
-	if (R_HashSizeCheck(R_StringHash)
-	    && char_hash_size < 1073741824 /* 2^30 */)
-	    R_StringHash_resize(char_hash_size * 2);
-
+	R_StringHash_put(cval, hashcode);
 	UNPROTECT(1);
     }
     return cval;
 }
 
+/* Make CHARSXPs for n strings at once, as ans[start + i] for i < n:
+   for readers which produce many strings together.  The cache is
+   grown once, beforehand, if they might not fit. */
+void attribute_hidden
+mkCharLenCEs(SEXP ans, R_xlen_t start, const char * const *names,
+	     const int *lens, R_xlen_t n, cetype_t enc)
+{
+    R_StringTable *t = &R_StringHash[0];
+    if (CHAR_HASH_FULL(t, n))
+	R_StringHash_resize(n);
+    for (R_xlen_t i = 0; i < n; i++)
+	SET_STRING_ELT(ans, start + i, mkCharLenCE(names[i], lens[i], enc));
+}
+
+/* .Internal(stringCacheInfo()) */
+SEXP attribute_hidden do_stringcacheinfo(SEXP call, SEXP op, SEXP args,
+					 SEXP env)
+{
+    const char *nms[] = {"size", "entries", "deleted", "load", "lookups",
+			 "mean.probes", "max.probes", "growths", ""};
+    R_StringTable *t = &R_StringHash[0], *old = &R_StringHash[1];
+    double size = (double) t->size + old->size,
+	used = (double) t->used + old->used;
+
+    checkArity(op, args);
+    SEXP ans = PROTECT(mkNamed(REALSXP, nms));
+    REAL(ans)[0] = size;
+    REAL(ans)[1] = used;
+    REAL(ans)[2] = (double) t->deleted + old->deleted;
+    REAL(ans)[3] = (double) t->used / t->size;
+    REAL(ans)[4] = char_hash_stats.lookups;
+    REAL(ans)[5] = char_hash_stats.lookups > 0 ?
+	char_hash_stats.probes / char_hash_stats.lookups : 0;
+    REAL(ans)[6] = (double) char_hash_stats.maxprobe;
+    REAL(ans)[7] = char_hash_stats.growths;
+    UNPROTECT(1);
+    return ans;
+}
+
 
 #ifdef DEBUG_SHOW_CHARSXP_CACHE
+static void show_entry(FILE *f, R_size_t i, SEXP c, unsigned int h)
+{
+    fprintf(f, "Slot %lu [%08x]: ", (unsigned long) i, h);
+    if (IS_UTF8(c))
+	fprintf(f, "U");
+    else if (IS_LATIN1(c))
+	fprintf(f, "L");
+    else if (IS_BYTES(c))
+	fprintf(f, "B");
+    fprintf(f, "|%s|\n", CHAR(c));
+}
+
 /* Call this from gdb with
 
        call do_show_cache(10)
 
-   for the first 10 cache chains in use. */
+   for the first 10 cache entries in use. */
 void do_show_cache(int n)
 {
-    int i, j;
-    Rprintf("Cache size: %d\n", LENGTH(R_StringHash));
-    Rprintf("Cache pri:  %d\n", HASHPRI(R_StringHash));
-    for (i = 0, j = 0; j < n && i < LENGTH(R_StringHash); i++) {
-	SEXP chain = VECTOR_ELT(R_StringHash, i);
-	if (! ISNULL(chain)) {
-	    Rprintf("Line %d: ", i);
-	    do {
-		if (IS_UTF8(CXHEAD(chain)))
-		    Rprintf("U");
-		else if (IS_LATIN1(CXHEAD(chain)))
-		    Rprintf("L");
-		else if (IS_BYTES(CXHEAD(chain)))
-		    Rprintf("B");
-		Rprintf("|%s| ", CHAR(CXHEAD(chain)));
-		chain = CXTAIL(chain);
-	    } while(! ISNULL(chain));
-	    Rprintf("\n");
+    R_StringTable *t = &R_StringHash[0];
+    R_size_t i;
+    int j;
+    Rprintf("Cache size: %lu\n", (unsigned long) t->size);
+    Rprintf("Cache used: %lu\n", (unsigned long) t->used);
+    for (i = 0, j = 0; j < n && i < t->size; i++)
+	if (t->slots[i].c != NULL && t->slots[i].c != R_NilValue) {
+	    show_entry(stdout, i, t->slots[i].c, t->slots[i].hash);
 	    j++;
 	}
-    }
 }
 
 void do_write_cache()
 {
-    int i;
     FILE *f = fopen("/tmp/CACHE", "w");
     if (f != NULL) {
-	fprintf(f, "Cache size: %d\n", LENGTH(R_StringHash));
-	fprintf(f, "Cache pri:  %d\n", HASHPRI(R_StringHash));
-	for (i = 0; i < LENGTH(R_StringHash); i++) {
-	    SEXP chain = VECTOR_ELT(R_StringHash, i);
-	    if (! ISNULL(chain)) {
-		fprintf(f, "Line %d: ", i);
-		do {
-		    if (IS_UTF8(CXHEAD(chain)))
-			fprintf(f, "U");
-		    else if (IS_LATIN1(CXHEAD(chain)))
-			fprintf(f, "L");
-		    else if (IS_BYTES(CXHEAD(chain)))
-			fprintf(f, "B");
-		    fprintf(f, "|%s| ", CHAR(CXHEAD(chain)));
-		    chain = CXTAIL(chain);
-		} while(! ISNULL(chain));
-		fprintf(f, "\n");
-	    }
+	for (int k = 0; k < 2; k++) {
+	    R_StringTable *t = &R_StringHash[k];
+	    fprintf(f, "Cache size: %lu\n", (unsigned long) t->size);
+	    fprintf(f, "Cache used: %lu\n", (unsigned long) t->used);
+	    for (R_size_t i = 0; i < t->size; i++)
+		if (t->slots[i].c != NULL && t->slots[i].c != R_NilValue)
+		    show_entry(f, i, t->slots[i].c, t->slots[i].hash);
 	}
 	fclose(f);
     }
@@ -108,6 +108,11 @@ static char **R_Srcfiles;			   /* an array of pointers into the filename buffer
 static size_t R_Srcfile_bufcount;                  /* how big is the array above? */
 static SEXP R_Srcfiles_buffer = NULL;              /* a big RAWSXP to use as a buffer for filenames and pointers to them */
 static int R_Profiling_Error;		   /* record errors here */
+#ifndef Win32
+static int R_Profiling_Signal = SIGPROF;	   /* SIGALRM for elapsed time */
+static int R_Profiling_Timer = ITIMER_PROF;	   /* ITIMER_REAL for elapsed time */
+#endif
+static int R_Profiling_Collapsed = 0;		   /* using the ring buffer */
 
 #ifdef Win32
 HANDLE MainThread;
@@ -180,17 +185,10 @@ static void lineprof(char* buf, SEXP srcref)
     }
 }
 
-/* FIXME: This should be done wih a proper configure test, also making
-   sure that the pthreads library is linked in. LT */
-#ifndef Win32
-#if (defined(__APPLE__) || defined(_REENTRANT) || defined(HAVE_OPENMP)) && \
-     ! defined(HAVE_PTHREAD)
-# define HAVE_PTHREAD
-#endif
+/* HAVE_PTHREAD is set in Defn.h */
 #ifdef HAVE_PTHREAD
 # include <pthread.h>
 static pthread_t R_profiled_thread;
-# endif
 #endif
 
 static void doprof(int sig)  /* sig is ignored in Windows */
@@ -314,7 +312,7 @@ static void doprof(int sig)  /* sig is ignored in Windows */
 	fprintf(R_ProfileOutfile, "%s\n", buf);
 
 #ifndef Win32
-    signal(SIGPROF, doprof);
+    signal(sig, doprof);
 #endif /* not Win32 */
 
 }
@@ -333,10 +331,269 @@ static void __cdecl ProfileThread(void *pwait)
 #else /* not Win32 */
 static void doprof_null(int sig)
 {
-    signal(SIGPROF, doprof_null);
+    signal(sig, doprof_null);
 }
 #endif /* not Win32 */
 
+/* Collapsed stack profiling.  With format = "collapsed" the signal
+   handler only copies the call stack into a ring buffer it shares
+   with a writer thread, without taking locks, allocating or doing
+   output.  The functions are recorded by the symbols naming them,
+   which are never freed and so can be read later by the writer, and
+   optionally by the return addresses of the innermost native frames.
+   The writer thread counts the samples of each distinct stack, and
+   when profiling ends formats a line for each stack with its frames
+   separated by semicolons, outermost first, followed by its count,
+   which is the input format of flame graph tools.
+   Samples arriving when the buffer is full are dropped and counted. */
+
+#if !defined(Win32) && defined(HAVE_PTHREAD) && defined(__GNUC__)
+# define PROF_RING
+#endif
+
+#ifdef PROF_RING
+# include <time.h>		/* for nanosleep */
+# if defined(__GLIBC__) || defined(__APPLE__)
+#  include <execinfo.h>		/* for backtrace */
+#  include <dlfcn.h>		/* for dladdr */
+#  define PROF_NATIVE
+# endif
+
+#define PROF_MAX_DEPTH 100	/* R frames recorded */
+#define PROF_MAX_NATIVE 40	/* native frames recorded */
+#define PROF_RING_SIZE 256	/* samples; a power of two */
+#define PROF_STACK_BUCKETS 4096
+
+typedef struct {
+    int nframes, nnative;
+    Rboolean gc;
+    /* three words for each R frame, innermost first: the symbol naming
+       the function, and for a::f, a:::f, a$f and a[[f]] the symbols a
+       and ::, :::, $ or [[ (a name which is not a symbol is recorded as
+       NULL).  Then the return addresses of the native frames. */
+    void *words[3 * PROF_MAX_DEPTH + PROF_MAX_NATIVE];
+} prof_sample;
+
+/* the distinct stacks seen, with the words of their samples as keys */
+typedef struct prof_stack {
+    struct prof_stack *next;
+    unsigned long count;
+    unsigned int hash;
+    int nframes, nnative;
+    Rboolean gc;
+    void *key[];
+} prof_stack;
+
+static prof_sample *prof_ring = NULL;
+static unsigned int prof_head, prof_tail; /* advanced by handler, writer */
+static unsigned int prof_dropped;
+static int prof_stop;
+static Rboolean prof_native;
+static pthread_t prof_writer;
+static prof_stack *prof_stacks[PROF_STACK_BUCKETS];
+
+static void doprof_ring(int sig)
+{
+    unsigned int head = prof_head;
+    prof_sample *p;
+    RCNTXT *cptr;
+    int n = 0;
+
+    if (! pthread_equal(pthread_self(), R_profiled_thread)) {
+	pthread_kill(R_profiled_thread, sig);
+	return;
+    }
+    if (head - __atomic_load_n(&prof_tail, __ATOMIC_ACQUIRE) ==
+	PROF_RING_SIZE) {
+	prof_dropped++;
+	return;
+    }
+    p = prof_ring + (head & (PROF_RING_SIZE - 1));
+    p->gc = R_GC_Profiling && R_gc_running();
+    for (cptr = R_GlobalContext; cptr && n < PROF_MAX_DEPTH;
+	 cptr = cptr->nextcontext)
+	if ((cptr->callflag & (CTXT_FUNCTION | CTXT_BUILTIN))
+	    && TYPEOF(cptr->call) == LANGSXP) {
+	    SEXP fun = CAR(cptr->call);
+	    void **frame = p->words + 3 * n++;
+	    frame[0] = frame[1] = frame[2] = NULL;
+	    if (TYPEOF(fun) == SYMSXP)
+		frame[0] = fun;
+	    else if (TYPEOF(fun) == LANGSXP &&
+		     (CAR(fun) == R_DoubleColonSymbol ||
+		      CAR(fun) == R_TripleColonSymbol ||
+		      CAR(fun) == R_DollarSymbol ||
+		      CAR(fun) == R_Bracket2Symbol) &&
+		     TYPEOF(CADR(fun)) == SYMSXP) {
+		frame[1] = CADR(fun);
+		frame[2] = CAR(fun);
+		if (TYPEOF(CADDR(fun)) == SYMSXP)
+		    frame[0] = CADDR(fun);
+	    }
+	}
+    p->nframes = n;
+    p->nnative = 0;
+#ifdef PROF_NATIVE
+    if (prof_native)
+	p->nnative = backtrace(p->words + 3 * n, PROF_MAX_NATIVE);
+#endif
+    __atomic_store_n(&prof_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* the rest runs in the writer thread */
+
+static size_t ProfAppend(char *buf, size_t len, size_t size,
+			 const char *s)
+{
+    size_t n = strlen(s);
+    if (len + n >= size)
+	n = len < size - 1 ? size - 1 - len : 0;
+    memcpy(buf + len, s, n);
+    buf[len + n] = '\0';
+    return len + n;
+}
+
+static void ProfCount(prof_sample *p)
+{
+    int nwords = 3 * p->nframes + p->nnative;
+    void **words = p->words;
+    unsigned int hash = p->gc;
+    prof_stack *stack;
+
+    for (int i = 0; i < nwords; i++)
+	hash = 31 * hash + (unsigned int) ((uintptr_t) words[i] >> 3);
+    for (stack = prof_stacks[hash % PROF_STACK_BUCKETS]; stack != NULL;
+	 stack = stack->next)
+	if (stack->hash == hash && stack->nframes == p->nframes &&
+	    stack->nnative == p->nnative && stack->gc == p->gc &&
+	    memcmp(stack->key, words, nwords * sizeof(void *)) == 0) {
+	    stack->count++;
+	    return;
+	}
+    if ((stack = malloc(sizeof(prof_stack) + nwords * sizeof(void *))) == NULL)
+	return;
+    memcpy(stack->key, words, nwords * sizeof(void *));
+    stack->count = 1;
+    stack->hash = hash;
+    stack->nframes = p->nframes;
+    stack->nnative = p->nnative;
+    stack->gc = p->gc;
+    stack->next = prof_stacks[hash % PROF_STACK_BUCKETS];
+    prof_stacks[hash % PROF_STACK_BUCKETS] = stack;
+}
+
+static void ProfWriteStack(prof_stack *stack)
+{
+    char buf[PROFBUFSIZ];
+    size_t len = 0;
+    int i;
+
+    buf[0] = '\0';
+    for (i = stack->nframes - 1; i >= 0; i--) {
+	SEXP *frame = (SEXP *) stack->key + 3 * i;
+	if (len > 0)
+	    len = ProfAppend(buf, len, PROFBUFSIZ, ";");
+	if (frame[1] != NULL) {
+	    len = ProfAppend(buf, len, PROFBUFSIZ, CHAR(PRINTNAME(frame[1])));
+	    len = ProfAppend(buf, len, PROFBUFSIZ,
+			     frame[2] == R_Bracket2Symbol ? "[[" :
+			     CHAR(PRINTNAME(frame[2])));
+	}
+	len = ProfAppend(buf, len, PROFBUFSIZ, frame[0] != NULL ?
+			 CHAR(PRINTNAME(frame[0])) :
+			 frame[1] != NULL ? "..." : "<Anonymous>");
+	if (frame[2] == R_Bracket2Symbol)
+	    len = ProfAppend(buf, len, PROFBUFSIZ, "]]");
+    }
+#ifdef PROF_NATIVE
+    /* innermost first; the first two are the handler and the signal
+       trampoline */
+    void **native = stack->key + 3 * stack->nframes;
+    for (i = stack->nnative - 1; i >= 2; i--) {
+	Dl_info info;
+	char addr[32];
+	if (len > 0)
+	    len = ProfAppend(buf, len, PROFBUFSIZ, ";");
+	if (dladdr(native[i], &info) && info.dli_sname != NULL)
+	    len = ProfAppend(buf, len, PROFBUFSIZ, info.dli_sname);
+	else {
+	    snprintf(addr, 32, "%p", native[i]);
+	    len = ProfAppend(buf, len, PROFBUFSIZ, addr);
+	}
+    }
+#endif
+    if (stack->gc)
+	len = ProfAppend(buf, len, PROFBUFSIZ, len > 0 ? ";<GC>" : "<GC>");
+    if (len == 0)
+	len = ProfAppend(buf, len, PROFBUFSIZ, "<Top level>");
+    fprintf(R_ProfileOutfile, "%s %lu\n", buf, stack->count);
+}
+
+static void *ProfWriterThread(void *unused)
+{
+    struct timespec pause = { 0, 10000000 }; /* 10ms */
+    int i;
+
+    for (;;) {
+	int stop = __atomic_load_n(&prof_stop, __ATOMIC_ACQUIRE);
+	unsigned int head = __atomic_load_n(&prof_head, __ATOMIC_ACQUIRE);
+	while (prof_tail != head) {
+	    ProfCount(prof_ring + (prof_tail & (PROF_RING_SIZE - 1)));
+	    __atomic_store_n(&prof_tail, prof_tail + 1, __ATOMIC_RELEASE);
+	}
+	if (stop)
+	    break;
+	nanosleep(&pause, NULL);
+    }
+    for (i = 0; i < PROF_STACK_BUCKETS; i++) {
+	prof_stack *stack = prof_stacks[i];
+	while (stack != NULL) {
+	    prof_stack *next = stack->next;
+	    ProfWriteStack(stack);
+	    free(stack);
+	    stack = next;
+	}
+	prof_stacks[i] = NULL;
+    }
+    return NULL;
+}
+
+static Rboolean StartProfWriter(Rboolean native)
+{
+    sigset_t all, old;
+    int res;
+
+    if (prof_ring == NULL &&
+	(prof_ring = malloc(PROF_RING_SIZE * sizeof(prof_sample))) == NULL)
+	return FALSE;
+    prof_head = prof_tail = prof_dropped = 0;
+    prof_stop = 0;
+    prof_native = native;
+#ifdef PROF_NATIVE
+    if (native) {
+	/* the first call may load libgcc, which must not happen in the
+	   signal handler */
+	void *frames[2];
+	backtrace(frames, 2);
+    }
+#endif
+    /* the signals are for the R thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    res = pthread_create(&prof_writer, NULL, ProfWriterThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return res == 0;
+}
+
+static void StopProfWriter(void)
+{
+    __atomic_store_n(&prof_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(prof_writer, NULL);
+    free(prof_ring);
+    prof_ring = NULL;
+}
+#endif /* PROF_RING */
+
 
 static void R_EndProfiling(void)
 {
@@ -350,10 +607,18 @@ static void R_EndProfiling(void)
     itv.it_interval.tv_usec = 0;
     itv.it_value.tv_sec = 0;
     itv.it_value.tv_usec = 0;
-    setitimer(ITIMER_PROF, &itv, NULL);
-    signal(SIGPROF, doprof_null);
+    setitimer(R_Profiling_Timer, &itv, NULL);
+    /* SIGALRM may be used by other code, so give it back its default */
+    if (R_Profiling_Signal == SIGALRM)
+	signal(SIGALRM, SIG_DFL);
+    else
+	signal(SIGPROF, doprof_null);
 
 #endif /* not Win32 */
+#ifdef PROF_RING
+    if (R_Profiling_Collapsed)
+	StopProfWriter();
+#endif
     if(R_ProfileOutfile) fclose(R_ProfileOutfile);
     R_ProfileOutfile = NULL;
     R_Profiling = 0;
@@ -364,14 +629,24 @@ static void R_EndProfiling(void)
     if (R_Profiling_Error)
 	warning(_("source files skipped by Rprof; please increase '%s'"),
 		R_Profiling_Error == 1 ? "numfiles" : "bufsize");
+#ifdef PROF_RING
+    if (R_Profiling_Collapsed && prof_dropped > 0)
+	warning(_("%u samples dropped by Rprof"), prof_dropped);
+#endif
+    R_Profiling_Collapsed = 0;
 }
 
 static void R_InitProfiling(SEXP filename, int append, double dinterval,
 			    int mem_profiling, int gc_profiling,
-			    int line_profiling, int numfiles, int bufsize)
+			    int line_profiling, int numfiles, int bufsize,
+			    Rboolean elapsed, Rboolean collapsed,
+			    Rboolean native)
 {
 #ifndef Win32
     struct itimerval itv;
+#ifdef PROF_RING
+    struct sigaction sa;
+#endif
 #else
     int wait;
     HANDLE Proc = GetCurrentProcess();
@@ -379,18 +654,36 @@ static void R_InitProfiling(SEXP filename, int append, double dinterval,
     int interval;
 
     interval = (int)(1e6 * dinterval + 0.5);
+    if (collapsed) {
+#ifdef PROF_RING
+	if (mem_profiling || line_profiling)
+	    error(_("memory and line profiling are not available with format \"collapsed\""));
+#else
+	error(_("format \"collapsed\" is not supported on this platform"));
+#endif
+    }
     if(R_ProfileOutfile != NULL) R_EndProfiling();
     R_ProfileOutfile = RC_fopen(filename, append ? "a" : "w", TRUE);
     if (R_ProfileOutfile == NULL)
 	error(_("Rprof: cannot open profile file '%s'"),
 	      translateChar(filename));
-    if(mem_profiling)
-	fprintf(R_ProfileOutfile, "memory profiling: ");
-    if(gc_profiling)
-	fprintf(R_ProfileOutfile, "GC profiling: ");
-    if(line_profiling)
-	fprintf(R_ProfileOutfile, "line profiling: ");
-    fprintf(R_ProfileOutfile, "sample.interval=%d\n", interval);
+#ifdef PROF_RING
+    if (collapsed && ! StartProfWriter(native)) {
+	fclose(R_ProfileOutfile);
+	R_ProfileOutfile = NULL;
+	error(_("Rprof: cannot start the profile writer"));
+    }
+    R_Profiling_Collapsed = collapsed;
+#endif
+    if (! collapsed) {
+	if(mem_profiling)
+	    fprintf(R_ProfileOutfile, "memory profiling: ");
+	if(gc_profiling)
+	    fprintf(R_ProfileOutfile, "GC profiling: ");
+	if(line_profiling)
+	    fprintf(R_ProfileOutfile, "line profiling: ");
+	fprintf(R_ProfileOutfile, "sample.interval=%d\n", interval);
+    }
 
     R_Mem_Profiling=mem_profiling;
     if (mem_profiling)
@@ -424,14 +717,25 @@ static void R_InitProfiling(SEXP filename, int append, double dinterval,
 #ifdef HAVE_PTHREAD
     R_profiled_thread = pthread_self();
 #endif
+    R_Profiling_Signal = elapsed ? SIGALRM : SIGPROF;
+    R_Profiling_Timer = elapsed ? ITIMER_REAL : ITIMER_PROF;
 
-    signal(SIGPROF, doprof);
+#ifdef PROF_RING
+    if (collapsed) {
+	sa.sa_handler = doprof_ring;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(R_Profiling_Signal, &sa, NULL);
+    }
+    else
+#endif
+	signal(R_Profiling_Signal, doprof);
 
     itv.it_interval.tv_sec = 0;
     itv.it_interval.tv_usec = interval;
     itv.it_value.tv_sec = 0;
     itv.it_value.tv_usec = interval;
-    if (setitimer(ITIMER_PROF, &itv, NULL) == -1)
+    if (setitimer(R_Profiling_Timer, &itv, NULL) == -1)
 	R_Suicide("setting profile timer failed");
 #endif /* not Win32 */
     R_Profiling = 1;
@@ -443,6 +747,7 @@ SEXP do_Rprof(SEXP args)
     int append_mode, mem_profiling, gc_profiling, line_profiling;
     double dinterval;
     int numfiles, bufsize;
+    Rboolean elapsed, collapsed, native;
 
 #ifdef BC_PROFILING
     if (bc_profiling) {
@@ -461,14 +766,18 @@ SEXP do_Rprof(SEXP args)
     numfiles = asInteger(CAR(args));	      args = CDR(args);
     if (numfiles < 0)
 	error(_("invalid '%s' argument"), "numfiles");
-    bufsize = asInteger(CAR(args));
+    bufsize = asInteger(CAR(args));	      args = CDR(args);
     if (bufsize < 0)
 	error(_("invalid '%s' argument"), "bufsize");
+    elapsed = streql(CHAR(asChar(CAR(args))), "elapsed"); args = CDR(args);
+    collapsed = streql(CHAR(asChar(CAR(args))), "collapsed"); args = CDR(args);
+    native = asLogical(CAR(args)) == TRUE;
 
     filename = STRING_ELT(filename, 0);
     if (LENGTH(filename))
 	R_InitProfiling(filename, append_mode, dinterval, mem_profiling,
-			gc_profiling, line_profiling, numfiles, bufsize);
+			gc_profiling, line_profiling, numfiles, bufsize,
+			elapsed, collapsed, native);
     else
 	R_EndProfiling();
     return R_NilValue;
@@ -1559,11 +1868,13 @@ static R_INLINE SEXP GET_BINDING_CELL(SEXP symbol, SEXP rho)
     }
 }
 
-static R_INLINE Rboolean SET_BINDING_VALUE(SEXP loc, SEXP value) {
+static R_INLINE Rboolean SET_BINDING_VALUE(SEXP loc, SEXP value, SEXP rho) {
     /* This depends on the current implementation of bindings */
     if (loc != R_NilValue &&
 	! BINDING_IS_LOCKED(loc) && ! IS_ACTIVE_BINDING(loc)) {
 	if (CAR(loc) != value) {
+	    if (MAYBE_S3_METHOD(value) || MAYBE_S3_METHOD(CAR(loc)))
+		R_S3BindingChanged(rho, TAG(loc), CAR(loc), value);
 	    SETCAR(loc, value);
 	    if (MISSING(loc))
 		SET_MISSING(loc, 0);
@@ -1686,7 +1997,7 @@ SEXP attribute_hidden do_for(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    default:
 		errorcall(call, _("invalid for() loop sequence"));
 	    }
-	    if (CAR(cell) == R_UnboundValue || ! SET_BINDING_VALUE(cell, v))
+	    if (CAR(cell) == R_UnboundValue || ! SET_BINDING_VALUE(cell, v, rho))
 		defineVar(sym, v, rho);
 	}
 	if (!bgn && RDEBUG(rho) && !R_GlobalContext->browserfinish) {
@@ -3058,7 +3369,7 @@ int DispatchGroup(const char* group, SEXP call, SEXP op, SEXP args, SEXP rho,
 }
 
 /* start of bytecode section */
-static int R_bcVersion = 8;
+static int R_bcVersion = 11;
 static int R_bcMinVersion = 6;
 
 static SEXP R_AddSym = NULL;
@@ -3066,6 +3377,8 @@ static SEXP R_SubSym = NULL;
 static SEXP R_MulSym = NULL;
 static SEXP R_DivSym = NULL;
 static SEXP R_ExptSym = NULL;
+static SEXP R_ModSym = NULL;
+static SEXP R_IDivSym = NULL;
 static SEXP R_SqrtSym = NULL;
 static SEXP R_ExpSym = NULL;
 static SEXP R_EqSym = NULL;
@@ -3092,6 +3405,8 @@ void R_initialize_bcode(void)
   R_MulSym = install("*");
   R_DivSym = install("/");
   R_ExptSym = install("^");
+  R_ModSym = install("%%");
+  R_IDivSym = install("%/%");
   R_SqrtSym = install("sqrt");
   R_ExpSym = install("exp");
   R_EqSym = install("==");
@@ -3235,12 +3550,21 @@ enum {
   COLON_OP,
   SEQALONG_OP,
   SEQLEN_OP,
+  MOD_OP,
+  IDIV_OP,
+  ARITH1ST_OP,
+  ARITH2ND_OP,
+  REL1ST_OP,
+  RELAND_OP,
+  FRAMESLOTS_OP,
   OPCOUNT
 };
 
 
 SEXP R_unary(SEXP, SEXP, SEXP);
 SEXP R_binary(SEXP, SEXP, SEXP, SEXP);
+double myfmod(double, double);
+double myfloor(double, double);
 SEXP do_math1(SEXP, SEXP, SEXP, SEXP);
 SEXP do_relop_dflt(SEXP, SEXP, SEXP, SEXP);
 SEXP do_logic(SEXP, SEXP, SEXP, SEXP);
@@ -3470,6 +3794,30 @@ static R_INLINE int bcStackScalarEx(R_bcstack_t *s, scalar_value_t *v,
 
 #define bcStackScalar(s, v) bcStackScalarEx(s, v, NULL)
 
+/* bcStackUnboxScalar() replaces a simple scalar on the stack that is
+   referenced from elsewhere, typically the value of a local variable
+   or of a for() loop variable, by its value.  Assigning the value
+   then copies it into the box of the target variable (or a new box)
+   instead of sharing the box, which would force the next update of
+   either variable, or the next step of the loop, to allocate. */
+static R_INLINE void bcStackUnboxScalar(R_bcstack_t *s)
+{
+#ifdef TYPED_STACK
+    if (s->tag == 0) {
+	SEXP x = s->u.sxpval;
+	if (ATTRIB(x) != R_NilValue || XLENGTH(x) != 1 || NO_REFERENCES(x))
+	    return;
+	switch (TYPEOF(x)) {
+	case REALSXP: s->u.dval = REAL(x)[0]; break;
+	case INTSXP: s->u.ival = INTEGER(x)[0]; break;
+	case LGLSXP: s->u.ival = LOGICAL(x)[0]; break;
+	default: return;
+	}
+	s->tag = TYPEOF(x);
+    }
+#endif
+}
+
 #define INTEGER_TO_LOGICAL(x) \
     ((x) == NA_INTEGER ? NA_LOGICAL : (x) ? TRUE : FALSE)
 #define INTEGER_TO_REAL(x) ((x) == NA_INTEGER ? NA_REAL : (x))
@@ -3760,6 +4108,380 @@ static SEXP cmp_arith2(SEXP call, int opval, SEXP opsym, SEXP x, SEXP y,
 # define R_sqrt sqrt
 #endif
 
+/* Fused arithmetic and comparisons.
+
+   For (x op1 y) op2 z with op1 and op2 among +, -, * and /, the
+   compiler emits ARITH1ST after the code for x and y and ARITH2ND
+   after that for z, and for z op2 (x op1 y) only ARITH2ND, with 4
+   added to op2.  Similarly REL1ST and RELAND are emitted for
+   (x r1 y) & (u r2 v) with comparisons r1 and r2.  The compiler only
+   does this if z, or u and v, are symbols or constants, as x and y
+   may be left on the stack while they are evaluated.  Arithmetic and
+   comparisons on plain double or integer vectors of compatible
+   lengths cannot signal errors or warnings, so in that case ARITH1ST
+   and REL1ST leave x and y on the stack, and the whole expression is
+   evaluated in blocks of elements without allocating the intermediate
+   vectors.  Otherwise the first operation is done at once, with the
+   scalar fast paths or the usual dispatch, and R_NilValue is left in
+   place of y. */
+
+static const int bcArithOp[] = { PLUSOP, MINUSOP, TIMESOP, DIVOP };
+static SEXP * const bcArithSym[] = { &R_AddSym, &R_SubSym, &R_MulSym,
+				     &R_DivSym };
+static const int bcRelOp[] = { EQOP, NEOP, LTOP, LEOP, GEOP, GTOP };
+static SEXP * const bcRelSym[] = { &R_EqSym, &R_NeSym, &R_LtSym, &R_LeSym,
+				   &R_GeSym, &R_GtSym };
+
+#define BC_FUSE_BLOCK 512
+
+typedef struct {
+    R_xlen_t n;
+    Rboolean isint;
+    double s;          /* the value if n == 1 */
+    const double *d;   /* otherwise one of these */
+    const int *i;
+} bcfuse_arg_t;
+
+static R_INLINE Rboolean bcStackIsNull(R_bcstack_t *s)
+{
+#ifdef TYPED_STACK
+    return s->tag == 0 && s->u.sxpval == R_NilValue;
+#else
+    return *s == R_NilValue;
+#endif
+}
+
+/* is the stack value a plain double or integer vector? */
+static R_INLINE Rboolean bcFuseArg(R_bcstack_t *s, bcfuse_arg_t *a)
+{
+    a->d = NULL;
+    a->i = NULL;
+#ifdef TYPED_STACK
+    switch (s->tag) {
+    case 0: break;
+    case REALSXP:
+	a->n = 1; a->isint = FALSE; a->s = s->u.dval;
+	return TRUE;
+    case INTSXP:
+	a->n = 1; a->isint = TRUE; a->s = INTEGER_TO_REAL(s->u.ival);
+	return TRUE;
+    default: return FALSE;
+    }
+#endif
+    SEXP x = GETSTACK_SXPVAL_PTR(s);
+    if (ATTRIB(x) != R_NilValue) return FALSE;
+    switch (TYPEOF(x)) {
+    case REALSXP: a->isint = FALSE; a->d = REAL(x); break;
+    case INTSXP: a->isint = TRUE; a->i = INTEGER(x); break;
+    default: return FALSE;
+    }
+    if ((a->n = XLENGTH(x)) == 0) return FALSE;
+    if (a->n == 1) a->s = a->d ? a->d[0] : INTEGER_TO_REAL(a->i[0]);
+    return TRUE;
+}
+
+/* the common length of the arguments, or 0 if they would be recycled
+   or are all scalars, which the scalar fast paths handle */
+static R_INLINE R_xlen_t bcFuseLength(bcfuse_arg_t *a, int k)
+{
+    R_xlen_t n = 1;
+    for (int j = 0; j < k; j++)
+	if (a[j].n != 1) {
+	    if (n != 1 && a[j].n != n) return 0;
+	    n = a[j].n;
+	}
+    return n == 1 ? 0 : n;
+}
+
+/* the elements i0, ..., i0 + m - 1 of an argument as doubles; a
+   scalar is returned as itself, to be used for all elements */
+static R_INLINE const double *bcFuseGet(double *buf, bcfuse_arg_t *a,
+					R_xlen_t i0, int m)
+{
+    if (a->n == 1)
+	return &a->s;
+    else if (a->d)
+	return a->d + i0;
+    for (int k = 0; k < m; k++) buf[k] = INTEGER_TO_REAL(a->i[i0 + k]);
+    return buf;
+}
+
+/* r = x op y for m elements, where x or y can be a scalar if sx or sy
+   is true; r may be x or y */
+#define FUSE_LOOP(r, x, sx, y, sy, m, expr) do {			\
+	if (sx) {							\
+	    double a = (x)[0];						\
+	    for (int k = 0; k < (m); k++) {				\
+		double b = (y)[k];					\
+		(r)[k] = expr;						\
+	    }								\
+	}								\
+	else if (sy) {							\
+	    double b = (y)[0];						\
+	    for (int k = 0; k < (m); k++) {				\
+		double a = (x)[k];					\
+		(r)[k] = expr;						\
+	    }								\
+	}								\
+	else								\
+	    for (int k = 0; k < (m); k++) {				\
+		double a = (x)[k], b = (y)[k];				\
+		(r)[k] = expr;						\
+	    }								\
+    } while (0)
+
+static void bcFuseArith(int op, double *r, const double *x, Rboolean sx,
+			const double *y, Rboolean sy, int m)
+{
+    switch (op) {
+    case PLUSOP: FUSE_LOOP(r, x, sx, y, sy, m, a + b); break;
+    case MINUSOP: FUSE_LOOP(r, x, sx, y, sy, m, a - b); break;
+    case TIMESOP: FUSE_LOOP(r, x, sx, y, sy, m, a * b); break;
+    case DIVOP: FUSE_LOOP(r, x, sx, y, sy, m, a / b); break;
+    }
+}
+
+#define FUSE_RELOP(op)     (ISNAN(a) || ISNAN(b)) ? NA_LOGICAL : (a op b)
+
+static void bcFuseRelop(int op, int *r, const double *x, Rboolean sx,
+			const double *y, Rboolean sy, int m)
+{
+    switch (op) {
+    case EQOP: FUSE_LOOP(r, x, sx, y, sy, m, FUSE_RELOP(==)); break;
+    case NEOP: FUSE_LOOP(r, x, sx, y, sy, m, FUSE_RELOP(!=)); break;
+    case LTOP: FUSE_LOOP(r, x, sx, y, sy, m, FUSE_RELOP(<)); break;
+    case LEOP: FUSE_LOOP(r, x, sx, y, sy, m, FUSE_RELOP(<=)); break;
+    case GEOP: FUSE_LOOP(r, x, sx, y, sy, m, FUSE_RELOP(>=)); break;
+    case GTOP: FUSE_LOOP(r, x, sx, y, sy, m, FUSE_RELOP(>)); break;
+    }
+}
+
+/* (x op1 y) op2 z, or z op2 (x op1 y) if 'swap' is true.  The
+   intermediate values are kept in the result vector. */
+static SEXP bcFusedArith(int op1, int op2, Rboolean swap, bcfuse_arg_t *a,
+			 R_xlen_t n)
+{
+    double bx[BC_FUSE_BLOCK], by[BC_FUSE_BLOCK], bz[BC_FUSE_BLOCK];
+    SEXP ans = PROTECT(allocVector(REALSXP, n));
+    double *r = REAL(ans);
+    Rboolean sx = a[0].n == 1, sy = a[1].n == 1, sz = a[2].n == 1;
+
+    for (R_xlen_t i0 = 0; i0 < n; i0 += BC_FUSE_BLOCK) {
+	int m = (int) (n - i0 < BC_FUSE_BLOCK ? n - i0 : BC_FUSE_BLOCK);
+	double *t = r + i0;
+	const double *z = bcFuseGet(bz, a + 2, i0, m);
+	if (sx && sy) {
+	    /* only z is a vector */
+	    double v = a[0].s;
+	    bcFuseArith(op1, &v, &v, TRUE, &a[1].s, TRUE, 1);
+	    if (swap) bcFuseArith(op2, t, z, FALSE, &v, TRUE, m);
+	    else bcFuseArith(op2, t, &v, TRUE, z, FALSE, m);
+	}
+	else {
+	    bcFuseArith(op1, t, bcFuseGet(bx, a, i0, m), sx,
+			bcFuseGet(by, a + 1, i0, m), sy, m);
+	    if (swap) bcFuseArith(op2, t, z, sz, t, FALSE, m);
+	    else bcFuseArith(op2, t, t, FALSE, z, sz, m);
+	}
+	if ((i0 + BC_FUSE_BLOCK) % (1 << 20) == 0) R_CheckUserInterrupt();
+    }
+    UNPROTECT(1);
+    return ans;
+}
+
+/* (x r1 y) & (u r2 v) */
+static SEXP bcFusedRelAnd(int r1, int r2, bcfuse_arg_t *a, R_xlen_t n)
+{
+    double bx[BC_FUSE_BLOCK], by[BC_FUSE_BLOCK];
+    int b1[BC_FUSE_BLOCK], b2[BC_FUSE_BLOCK];
+    SEXP ans = PROTECT(allocVector(LGLSXP, n));
+    int *r = LOGICAL(ans);
+
+    for (R_xlen_t i0 = 0; i0 < n; i0 += BC_FUSE_BLOCK) {
+	int m = (int) (n - i0 < BC_FUSE_BLOCK ? n - i0 : BC_FUSE_BLOCK);
+	/* a scalar comparison is done for all elements, so that the
+	   same code is used for every operand shape */
+	bcFuseRelop(r1, b1, bcFuseGet(bx, a, i0, m), a[0].n == 1,
+		    bcFuseGet(by, a + 1, i0, m), a[1].n == 1,
+		    a[0].n == 1 && a[1].n == 1 ? 1 : m);
+	if (a[0].n == 1 && a[1].n == 1)
+	    for (int k = 1; k < m; k++) b1[k] = b1[0];
+	bcFuseRelop(r2, b2, bcFuseGet(bx, a + 2, i0, m), a[2].n == 1,
+		    bcFuseGet(by, a + 3, i0, m), a[3].n == 1,
+		    a[2].n == 1 && a[3].n == 1 ? 1 : m);
+	if (a[2].n == 1 && a[3].n == 1)
+	    for (int k = 1; k < m; k++) b2[k] = b2[0];
+	for (int k = 0; k < m; k++) {
+	    int x1 = b1[k], x2 = b2[k];
+	    r[i0 + k] = (x1 == 0 || x2 == 0) ? 0 :
+		(x1 == NA_LOGICAL || x2 == NA_LOGICAL) ? NA_LOGICAL : 1;
+	}
+	if ((i0 + BC_FUSE_BLOCK) % (1 << 20) == 0) R_CheckUserInterrupt();
+    }
+    UNPROTECT(1);
+    return ans;
+}
+
+static R_INLINE Rboolean bcScalarNum(R_bcstack_t *s, int *type, double *x)
+{
+    scalar_value_t v;
+    switch (*type = bcStackScalar(s, &v)) {
+    case REALSXP: *x = v.dval; return TRUE;
+    case INTSXP: *x = v.ival; return v.ival != NA_INTEGER;
+    default: return FALSE;
+    }
+}
+
+/* *sx op *sy, left in *sx, with the fast paths of the arithmetic
+   instructions for scalars */
+static void bcArith(SEXP call, int op, R_bcstack_t *sx, R_bcstack_t *sy,
+		    SEXP rho)
+{
+    int tx, ty, opval = bcArithOp[op];
+    double x, y;
+
+    if (bcScalarNum(sx, &tx, &x) && bcScalarNum(sy, &ty, &y)) {
+	double d = 0;
+	switch (opval) {
+	case PLUSOP: d = x + y; break;
+	case MINUSOP: d = x - y; break;
+	case TIMESOP: d = x * y; break;
+	case DIVOP: d = x / y; break;
+	}
+	if (tx == REALSXP || ty == REALSXP || opval == DIVOP) {
+	    SETSTACK_REAL_PTR(sx, d);
+	    return;
+	}
+	else if (d <= INT_MAX && d >= INT_MIN + 1) {
+	    SETSTACK_INTEGER_PTR(sx, (int) d);
+	    return;
+	}
+    }
+    SEXP vx = GETSTACK_PTR(sx);
+    SEXP vy = GETSTACK_PTR(sy);
+    SETSTACK_PTR(sx, cmp_arith2(call, opval, *bcArithSym[op], vx, vy, rho));
+}
+
+/* *sx r *sy, left in *sx */
+static void bcRelop(SEXP call, int r, R_bcstack_t *sx, R_bcstack_t *sy,
+		    SEXP rho)
+{
+    int tx, ty, opval = bcRelOp[r];
+    double x, y;
+
+    if (bcScalarNum(sx, &tx, &x) && bcScalarNum(sy, &ty, &y) &&
+	! ISNAN(x) && ! ISNAN(y)) {
+	int v = 0;
+	switch (opval) {
+	case EQOP: v = x == y; break;
+	case NEOP: v = x != y; break;
+	case LTOP: v = x < y; break;
+	case LEOP: v = x <= y; break;
+	case GEOP: v = x >= y; break;
+	case GTOP: v = x > y; break;
+	}
+	SETSTACK_LOGICAL_PTR(sx, v);
+	return;
+    }
+    SEXP vx = GETSTACK_PTR(sx);
+    SEXP vy = GETSTACK_PTR(sy);
+    SETSTACK_PTR(sx, cmp_relop(call, opval, *bcRelSym[r], vx, vy, rho));
+}
+
+/* *sx & *sy, left in *sx */
+static void bcAnd(SEXP call, R_bcstack_t *sx, R_bcstack_t *sy, SEXP rho)
+{
+    scalar_value_t vx, vy;
+
+    if (bcStackScalar(sx, &vx) == LGLSXP && bcStackScalar(sy, &vy) == LGLSXP) {
+	int x1 = vx.ival, x2 = vy.ival;
+	SETSTACK_LOGICAL_PTR(sx, (x1 == 0 || x2 == 0) ? 0 :
+			     (x1 == NA_LOGICAL || x2 == NA_LOGICAL) ?
+			     NA_LOGICAL : 1);
+	return;
+    }
+    SEXP args = CONS_NR(GETSTACK_PTR(sy), R_NilValue);
+    SETSTACK_PTR(sy, args); /* for protection */
+    args = CONS_NR(GETSTACK_PTR(sx), args);
+    SETSTACK_PTR(sy, args);
+    SETSTACK_PTR(sx, do_logic(call, getPrimitive(R_AndSym, BUILTINSXP),
+			      args, rho));
+}
+
+static void bcArith1st(SEXP call, int op, SEXP rho)
+{
+    R_bcstack_t *s = R_BCNodeStackTop - 2;
+    bcfuse_arg_t a[2];
+
+    if (op < 0 || op > 3) error(_("invalid fused operator"));
+    if (bcFuseArg(s, a) && bcFuseArg(s + 1, a + 1) && bcFuseLength(a, 2) &&
+	(! a[0].isint || ! a[1].isint || bcArithOp[op] == DIVOP))
+	return;
+    bcArith(call, op, s, s + 1, rho);
+    SETSTACK_PTR(s + 1, R_NilValue);
+}
+
+static void bcArith2nd(SEXP call, int op1, int op2, SEXP rho)
+{
+    R_bcstack_t *s = R_BCNodeStackTop - 3;
+    Rboolean swap = op2 >= 4;
+    bcfuse_arg_t a[3];
+    R_xlen_t n;
+
+    if (swap) op2 -= 4;
+    if (op1 < 0 || op1 > 3 || op2 < 0 || op2 > 3)
+	error(_("invalid fused operator"));
+    if (! swap && bcStackIsNull(s + 1)) {
+	bcArith(call, op2, s, s + 2, rho);
+	return;
+    }
+    /* x, y and z in a[], in this order */
+    R_bcstack_t *sx = swap ? s + 1 : s, *sy = sx + 1, *sz = swap ? s : s + 2;
+    if (bcFuseArg(sx, a) && bcFuseArg(sy, a + 1) && bcFuseArg(sz, a + 2) &&
+	(n = bcFuseLength(a, 3)) &&
+	(! a[0].isint || ! a[1].isint || bcArithOp[op1] == DIVOP)) {
+	SETSTACK_PTR(s, bcFusedArith(bcArithOp[op1], bcArithOp[op2], swap,
+				     a, n));
+	return;
+    }
+    bcArith(swap ? CADDR(call) : CADR(call), op1, sx, sy, rho);
+    if (swap) bcArith(call, op2, s, s + 1, rho);
+    else bcArith(call, op2, s, s + 2, rho);
+}
+
+static void bcRel1st(SEXP call, int r, SEXP rho)
+{
+    R_bcstack_t *s = R_BCNodeStackTop - 2;
+    bcfuse_arg_t a[2];
+
+    if (r < 0 || r > 5) error(_("invalid fused operator"));
+    if (bcFuseArg(s, a) && bcFuseArg(s + 1, a + 1) && bcFuseLength(a, 2))
+	return;
+    bcRelop(call, r, s, s + 1, rho);
+    SETSTACK_PTR(s + 1, R_NilValue);
+}
+
+static void bcRelAnd(SEXP call, int r1, int r2, SEXP rho)
+{
+    R_bcstack_t *s = R_BCNodeStackTop - 4;
+    bcfuse_arg_t a[4];
+    R_xlen_t n;
+
+    if (r1 < 0 || r1 > 5 || r2 < 0 || r2 > 5)
+	error(_("invalid fused operator"));
+    if (! bcStackIsNull(s + 1)) {
+	if (bcFuseArg(s, a) && bcFuseArg(s + 1, a + 1) &&
+	    bcFuseArg(s + 2, a + 2) && bcFuseArg(s + 3, a + 3) &&
+	    (n = bcFuseLength(a, 4))) {
+	    SETSTACK_PTR(s, bcFusedRelAnd(bcRelOp[r1], bcRelOp[r2], a, n));
+	    return;
+	}
+	bcRelop(CADR(call), r1, s, s + 1, rho);
+    }
+    bcRelop(CADDR(call), r2, s + 2, s + 3, rho);
+    bcAnd(call, s, s + 2, rho);
+}
+
 #define DO_LOG() do {							\
 	scalar_value_t vx;						\
 	SEXP sa = NULL;							\
@@ -4231,6 +4953,56 @@ static R_INLINE SEXP GET_BINDING_CELL_CACHE(SEXP symbol, SEXP rho,
     }
 }
 
+/* The code for the body of a closure starts with a FRAMESLOTS
+   instruction giving the constant pool indices of the symbols of its
+   arguments and of the local variables the compiler found.  On entry
+   all of these are bound in the frame, those not yet assigned to
+   R_UnboundValue, and the bindings are entered in the cache.  Then
+   GETVAR and SETVAR for local variables find their bindings in the
+   cache without searching the frame, however many variables it has.
+
+   Bindings with value R_UnboundValue are not visible in envir.c: they
+   are found by defineVar, which assigns them, but not by
+   findVarLocInFrame, setVar, ls() or rm().  The frame is usually the
+   arguments in order, so each is checked against the next slot first.
+   This is only done with the small cache, where the cache index of a
+   symbol is its constant pool index and no two slots share an
+   entry. */
+
+#define FRAME_LOCK_MASK (1<<14)
+#define FRAME_IS_LOCKED(e) (ENVFLAGS(e) & FRAME_LOCK_MASK)
+
+static Rboolean bcBindFrameSlots(SEXP rho, SEXP slots, SEXP constants,
+				 R_binding_cache_t vcache)
+{
+    if (HASHTAB(rho) != R_NilValue || FRAME_IS_LOCKED(rho) ||
+	rho == R_BaseEnv || rho == R_BaseNamespace)
+	return FALSE;
+
+    int n = LENGTH(slots), *idx = INTEGER(slots);
+    int j = 0;
+    Rboolean all = TRUE;
+    for (SEXP f = FRAME(rho); f != R_NilValue; f = CDR(f)) {
+	SEXP tag = TAG(f);
+	int k = j;
+	if (k >= n || VECTOR_ELT(constants, idx[k]) != tag)
+	    for (k = 0; k < n && VECTOR_ELT(constants, idx[k]) != tag; k++);
+	if (k < n) {
+	    SET_CACHED_BINDING(vcache, idx[k], f);
+	    j = k + 1;
+	}
+	else all = FALSE;
+    }
+    for (int k = n - 1; k >= 0; k--)
+	if (GET_SMALLCACHE_BINDING_CELL(vcache, idx[k]) == R_NilValue) {
+	    SEXP cell = CONS(R_UnboundValue, FRAME(rho));
+	    SET_TAG(cell, VECTOR_ELT(constants, idx[k]));
+	    SET_FRAME(rho, cell);
+	    SET_CACHED_BINDING(vcache, idx[k], cell);
+	}
+    return all;
+}
+
 static void NORET MISSING_ARGUMENT_ERROR(SEXP symbol)
 {
     const char *n = CHAR(PRINTNAME(symbol));
@@ -4302,6 +5074,115 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
     return value;
 }
 
+/* Lookups of global variables and functions.  R_GlobalCacheLoc gives
+   the place of the binding visible from R_GlobalEnv of a symbol, and
+   that place is kept for each constant pool index in a vector stored
+   in the (otherwise unused) TAG of the code object, so it is not
+   serialized.  Element 0 of the vector holds the value of
+   R_GlobalCacheVersion when the places were found; when it changes
+   all places are forgotten.  R_UnboundValue records that there is no
+   place that can be used.
+
+   The places can be used when evaluating at top level, or in the
+   frame of a closure defined at top level if FRAMESLOTS has bound all
+   the variables in the frame, no binding has been added since, and
+   the symbol is not bound locally. */
+
+static SEXP bcGlobalCacheLoc(SEXP body, SEXP symbol, int sidx)
+{
+    SEXP cache = TAG(body);
+    if (cache == R_NilValue ||
+	REAL(VECTOR_ELT(cache, 0))[0] != R_GlobalCacheVersion) {
+	if (cache == R_NilValue) {
+	    cache = allocVector(VECSXP, LENGTH(BCCONSTS(body)) + 1);
+	    SET_TAG(body, cache);
+	    SET_VECTOR_ELT(cache, 0, allocVector(REALSXP, 1));
+	}
+	else
+	    for (R_xlen_t i = 1; i < XLENGTH(cache); i++)
+		SET_VECTOR_ELT(cache, i, R_NilValue);
+	REAL(VECTOR_ELT(cache, 0))[0] = R_GlobalCacheVersion;
+    }
+    SEXP loc = VECTOR_ELT(cache, sidx + 1);
+    if (loc == R_NilValue) {
+	loc = R_GlobalCacheLoc(symbol);
+	/* user database tables may have run R code */
+	if (REAL(VECTOR_ELT(cache, 0))[0] != R_GlobalCacheVersion)
+	    return R_UnboundValue;
+	if (loc == R_NilValue)
+	    loc = R_UnboundValue;
+	SET_VECTOR_ELT(cache, sidx + 1, loc);
+    }
+    return loc;
+}
+
+/* The value of the global binding, or R_UnboundValue if the cache
+   cannot be used.  Active bindings are left to the usual search. */
+static R_INLINE SEXP bcGlobalValue(SEXP body, SEXP constants, int sidx)
+{
+    SEXP cache = TAG(body);
+    SEXP loc;
+    if (cache != R_NilValue &&
+	REAL(VECTOR_ELT(cache, 0))[0] == R_GlobalCacheVersion &&
+	VECTOR_ELT(cache, sidx + 1) != R_NilValue)
+	loc = VECTOR_ELT(cache, sidx + 1);
+    else
+	loc = bcGlobalCacheLoc(body, VECTOR_ELT(constants, sidx), sidx);
+    if (loc == R_UnboundValue || IS_ACTIVE_BINDING(loc))
+	return R_UnboundValue;
+    else if (TYPEOF(loc) == SYMSXP)
+	return SYMVALUE(loc);
+    else
+	return CAR(loc);
+}
+
+static R_INLINE Rboolean bcSlotUnbound(R_binding_cache_t vcache, int sidx)
+{
+    SEXP cell = GET_SMALLCACHE_BINDING_CELL(vcache, sidx);
+    return cell == R_NilValue ||
+	(! IS_ACTIVE_BINDING(cell) && CAR(cell) == R_UnboundValue);
+}
+
+#define GLOBAL_LOOKUP_OK(sidx) \
+    (rho == R_GlobalEnv || \
+     (slotframe == FRAME(rho) && ENCLOS(rho) == R_GlobalEnv && \
+      bcSlotUnbound(vcache, sidx)))
+
+/* The value of a global variable if it is bound to something other
+   than a promise that has not been forced, or R_UnboundValue */
+static R_INLINE SEXP bcGlobalVar(SEXP body, SEXP constants, int sidx)
+{
+    SEXP value = bcGlobalValue(body, constants, sidx);
+    if (TYPEOF(value) == PROMSXP) {
+	if (PRVALUE(value) == R_UnboundValue)
+	    return R_UnboundValue;
+	value = PRVALUE(value);
+	SET_NAMED(value, 2);
+    }
+    else if (TYPEOF(value) == SYMSXP)  /* R_UnboundValue, R_MissingArg */
+	return R_UnboundValue;
+    else if (NAMED(value) == 0 && value != R_NilValue)
+	SET_NAMED(value, 1);
+    return value;
+}
+
+/* Likewise for a global function, or R_UnboundValue if the binding
+   is not to a function and the search must continue */
+static R_INLINE SEXP bcGlobalFun(SEXP body, SEXP constants, int sidx)
+{
+    SEXP value = bcGlobalValue(body, constants, sidx);
+    if (TYPEOF(value) == PROMSXP)
+	value = PRVALUE(value);
+    switch (TYPEOF(value)) {
+    case CLOSXP:
+    case BUILTINSXP:
+    case SPECIALSXP:
+	return value;
+    default:
+	return R_UnboundValue;
+    }
+}
+
 #define INLINE_GETVAR
 #ifdef INLINE_GETVAR
 /* Try to handle the most common case as efficiently as possible.  If
@@ -4350,6 +5231,12 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
 	    }								\
 	}								\
     }									\
+    if (!dd && GLOBAL_LOOKUP_OK(sidx) &&				\
+	(value = bcGlobalVar(body, constants, sidx)) != R_UnboundValue) { \
+	R_Visible = TRUE;						\
+	BCNPUSH(value);							\
+	NEXT();								\
+    }									\
     SEXP symbol = VECTOR_ELT(constants, sidx);				\
     R_Visible = TRUE;							\
     BCNPUSH(getvar(symbol, rho, dd, keepmiss, vcache, sidx));		\
@@ -4358,6 +5245,12 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
 #else
 #define DO_GETVAR(dd,keepmiss) do { \
   int sidx = GETOP(); \
+  if (!dd && GLOBAL_LOOKUP_OK(sidx) && \
+      (value = bcGlobalVar(body, constants, sidx)) != R_UnboundValue) { \
+      R_Visible = TRUE; \
+      BCNPUSH(value); \
+      NEXT(); \
+  } \
   SEXP symbol = VECTOR_ELT(constants, sidx); \
   R_Visible = TRUE; \
   BCNPUSH(getvar(symbol, rho, dd, keepmiss, vcache, sidx));	\
@@ -5204,6 +6097,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 
   R_binding_cache_t vcache = NULL;
   Rboolean smallcache = TRUE;
+  SEXP slotframe = NULL; /* FRAME(rho) after FRAMESLOTS, see above */
 #ifdef USE_BINDING_CACHE
   if (useCache) {
       R_len_t n = LENGTH(constants);
@@ -5382,7 +6276,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	  default:
 	    error(_("invalid sequence argument in for loop"));
 	  }
-	  if (CAR(cell) == R_UnboundValue || ! SET_BINDING_VALUE(cell, value))
+	  if (CAR(cell) == R_UnboundValue || ! SET_BINDING_VALUE(cell, value, rho))
 	      defineVar(BINDING_SYMBOL(cell), value, rho);
 	  BC_CHECK_SIGINT();
 	  pc = codebase + label;
@@ -5426,6 +6320,8 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	}
 #ifdef TYPED_STACK
 	R_bcstack_t *s = R_BCNodeStackTop - 1;
+	if (CAR(loc) != GETSTACK_SXPVAL_PTR(s))
+	    bcStackUnboxScalar(s);
 	/* reading the locked bit is OK even if cell is R_NilValue */
 	if (s->tag && ! BINDING_IS_LOCKED(loc)) {
 	    /* if cell is R_NilValue or an active binding, or if the value
@@ -5447,7 +6343,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 #endif
 	value = GETSTACK(-1);
 	INCREMENT_NAMED(value);
-	if (! SET_BINDING_VALUE(loc, value)) {
+	if (! SET_BINDING_VALUE(loc, value, rho)) {
 	    SEXP symbol = VECTOR_ELT(constants, sidx);
 	    PROTECT(value);
 	    defineVar(symbol, value, rho);
@@ -5458,8 +6354,11 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(GETFUN, 1):
       {
 	/* get the function */
-	SEXP symbol = VECTOR_ELT(constants, GETOP());
-	value = findFun(symbol, rho);
+	int sidx = GETOP();
+	SEXP symbol = VECTOR_ELT(constants, sidx);
+	if (! GLOBAL_LOOKUP_OK(sidx) ||
+	    (value = bcGlobalFun(body, constants, sidx)) == R_UnboundValue)
+	    value = findFun(symbol, rho);
 	if(RTRACE(value)) {
 	  Rprintf("trace: ");
 	  PrintValue(symbol);
@@ -5470,8 +6369,10 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(GETGLOBFUN, 1):
       {
 	/* get the function */
-	SEXP symbol = VECTOR_ELT(constants, GETOP());
-	value = findFun(symbol, R_GlobalEnv);
+	int sidx = GETOP();
+	SEXP symbol = VECTOR_ELT(constants, sidx);
+	if ((value = bcGlobalFun(body, constants, sidx)) == R_UnboundValue)
+	    value = findFun(symbol, R_GlobalEnv);
 	if(RTRACE(value)) {
 	  Rprintf("trace: ");
 	  PrintValue(symbol);
@@ -5714,6 +6615,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 #endif
 	    )
 	    value = EnsureLocal(symbol, rho);
+	bcStackUnboxScalar(R_BCNodeStackTop - 1);
 	BCNPUSH(value);
 	BCNDUP2ND();
 	/* top three stack entries are now RHS value, LHS value, RHS value */
@@ -5730,7 +6632,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	SEXP cell = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
 	value = GETSTACK(-1); /* leave on stack for GC protection */
 	INCREMENT_NAMED(value);
-	if (! SET_BINDING_VALUE(cell, value))
+	if (! SET_BINDING_VALUE(cell, value, rho))
 	    defineVar(symbol, value, rho);
 	R_BCNodeStackTop--; /* now pop LHS value off the stack */
 	/* original right-hand side value is now on top of stack again */
@@ -6123,6 +7025,51 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(COLON, 1): DO_COLON(); NEXT();
     OP(SEQALONG, 1): DO_SEQ_ALONG(); NEXT();
     OP(SEQLEN, 1): DO_SEQ_LEN(); NEXT();
+    OP(MOD, 1): FastBinary(myfmod, MODOP, R_ModSym);
+    OP(IDIV, 1): FastBinary(myfloor, IDIVOP, R_IDivSym);
+    OP(ARITH1ST, 2):
+      {
+	SEXP call = VECTOR_ELT(constants, GETOP());
+	int op = GETOP();
+	bcArith1st(call, op, rho);
+	NEXT();
+      }
+    OP(ARITH2ND, 3):
+      {
+	SEXP call = VECTOR_ELT(constants, GETOP());
+	int op1 = GETOP();
+	int op2 = GETOP();
+	bcArith2nd(call, op1, op2, rho);
+	R_BCNodeStackTop -= 2;
+	NEXT();
+      }
+    OP(REL1ST, 2):
+      {
+	SEXP call = VECTOR_ELT(constants, GETOP());
+	int r = GETOP();
+	bcRel1st(call, r, rho);
+	NEXT();
+      }
+    OP(RELAND, 3):
+      {
+	SEXP call = VECTOR_ELT(constants, GETOP());
+	int r1 = GETOP();
+	int r2 = GETOP();
+	bcRelAnd(call, r1, r2, rho);
+	R_BCNodeStackTop -= 3;
+	NEXT();
+      }
+    OP(FRAMESLOTS, 1):
+      {
+	SEXP slots = VECTOR_ELT(constants, GETOP());
+	if (vcache != NULL && smallcache &&
+	    bcBindFrameSlots(rho, slots, constants, vcache)) {
+	    /* keep the frame protected so the pointer stays unique */
+	    slotframe = FRAME(rho);
+	    BCNPUSH(slotframe);
+	}
+	NEXT();
+      }
     LASTOP;
   }
 
@@ -128,7 +128,9 @@ static void inspect_tree(int pre, SEXP v, int deep, int pvec) {
 	if (IS_CACHED(v)) Rprintf("[cached] ");
 	Rprintf("\"%s\"", CHAR(v));
     }
-    if (TYPEOF(v) == SYMSXP)
+    if (v == R_UnboundValue) /* unassigned bindings of compiled closures */
+	Rprintf("<unbound value>");
+    else if (TYPEOF(v) == SYMSXP)
 	Rprintf("\"%s\"%s", EncodeChar(PRINTNAME(v)), (SYMVALUE(v) == R_UnboundValue) ? "" : " (has value)");
     switch (TYPEOF(v)) { /* for native vectors print the first elements in-line */
     case LGLSXP:
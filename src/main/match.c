@@ -180,16 +180,154 @@ SEXP attribute_hidden matchArgExact(SEXP tag, SEXP * list)
 #define SET_ARGUSED(x,v) SETLEVELS(x,v)
 
 
+/* Argument matching plans.
+
+   What matchArgs() does depends only on the formals, the tags of the
+   supplied arguments and which of these are empty.  So for each
+   supplied argument it records the formal it was matched to (or -1
+   if it went into '...'), and later calls with the same formals and
+   the same shape of arguments go straight to placing them.  Entries
+   keep their formals alive, so these can be compared by address.
+   Plans involving partial matches are not used when these are to be
+   warned about.
+*/
+
+#define MATCH_CACHE_SIZE 1024
+#define MATCH_CACHE_MAXARGS 32
+
+static SEXP MatchCache = NULL;
+
+/* returns -1 if the arguments are not to be looked up */
+static int matchCacheIndex(SEXP formals, SEXP supplied, int *n)
+{
+    uintptr_t h = (uintptr_t) formals >> 4;
+    int i = 0;
+
+    if (supplied == R_NilValue) return -1;
+    for (SEXP b = supplied; b != R_NilValue; b = CDR(b), i++) {
+	if (i == MATCH_CACHE_MAXARGS) return -1;
+	h = h * 31 + ((uintptr_t) TAG(b) >> 4) * 2 + (CAR(b) == R_MissingArg);
+    }
+    *n = i;
+    h ^= h >> 17;
+    return (int)(h % MATCH_CACHE_SIZE);
+}
+
+/* Entries are lists of the formals, the tags of the supplied
+   arguments and an integer vector of the formals they were matched
+   to, whether they were empty, the position of '...' in the formals
+   (or -1) and whether there were partial matches. */
+static SEXP matchCacheGet(int h, SEXP formals, SEXP supplied, int n)
+{
+    SEXP entry = VECTOR_ELT(MatchCache, h), tags, b;
+    int i, *plan;
+
+    if (entry == R_NilValue || VECTOR_ELT(entry, 0) != formals)
+	return R_NilValue;
+    tags = VECTOR_ELT(entry, 1);
+    if (LENGTH(tags) != n) return R_NilValue;
+    plan = INTEGER(VECTOR_ELT(entry, 2));
+    for (b = supplied, i = 0; i < n; b = CDR(b), i++)
+	if (VECTOR_ELT(tags, i) != TAG(b) ||
+	    plan[n + i] != (CAR(b) == R_MissingArg))
+	    return R_NilValue;
+    if (plan[2 * n + 1] && R_warn_partial_match_args) return R_NilValue;
+    return entry;
+}
+
+static void matchCachePut(int h, SEXP formals, SEXP supplied, int n,
+			  int *target, int dotspos, Rboolean partial)
+{
+    SEXP entry, tags, b;
+    int i, *plan;
+
+    PROTECT(entry = allocVector(VECSXP, 3));
+    SET_VECTOR_ELT(entry, 0, formals);
+    SET_VECTOR_ELT(entry, 1, tags = allocVector(VECSXP, n));
+    for (b = supplied, i = 0; i < n; b = CDR(b), i++)
+	SET_VECTOR_ELT(tags, i, TAG(b));
+    SET_VECTOR_ELT(entry, 2, allocVector(INTSXP, 2 * n + 2));
+    plan = INTEGER(VECTOR_ELT(entry, 2));
+    for (b = supplied, i = 0; i < n; b = CDR(b), i++) {
+	plan[i] = target[i];
+	plan[n + i] = CAR(b) == R_MissingArg;
+    }
+    plan[2 * n] = dotspos;
+    plan[2 * n + 1] = partial;
+    SET_VECTOR_ELT(MatchCache, h, entry);
+    UNPROTECT(1);
+}
+
+/* The same result as matchArgs() from a plan it recorded.  Empty
+   arguments are not placed, as they leave the formal unmatched. */
+static SEXP matchArgsByPlan(SEXP formals, SEXP supplied, SEXP entry, int n)
+{
+    SEXP f, a, b, actuals = R_NilValue;
+    int i, nf = 0, ndots = 0, *plan;
+
+    PROTECT(entry);
+    for (f = formals; f != R_NilValue; f = CDR(f), nf++) {
+	actuals = CONS_NR(R_MissingArg, actuals);
+	SET_MISSING(actuals, 1);
+    }
+    PROTECT(actuals);
+    SEXP cell[nf ? nf : 1];
+    for (a = actuals, i = 0; a != R_NilValue; a = CDR(a), i++) cell[i] = a;
+
+    plan = INTEGER(VECTOR_ELT(entry, 2));
+    for (b = supplied, i = 0; i < n; b = CDR(b), i++) {
+	if (plan[i] < 0) {
+	    SET_ARGUSED(b, 0);
+	    ndots++;
+	} else {
+	    SET_ARGUSED(b, 1);
+	    if (CAR(b) != R_MissingArg) {
+		SETCAR(cell[plan[i]], CAR(b));
+		SET_MISSING(cell[plan[i]], 0);
+	    }
+	}
+    }
+    if (plan[2 * n] >= 0) {
+	SEXP dots = cell[plan[2 * n]];
+	SET_MISSING(dots, 0);
+	if (ndots) {
+	    a = allocList(ndots);
+	    SET_TYPEOF(a, DOTSXP);
+	    SETCAR(dots, a);
+	    for (b = supplied, i = 0; i < n; b = CDR(b), i++)
+		if (plan[i] < 0) {
+		    SETCAR(a, CAR(b));
+		    SET_TAG(a, TAG(b));
+		    a = CDR(a);
+		}
+	}
+    }
+    UNPROTECT(2);
+    return actuals;
+}
+
 /* We need to leave 'supplied' unchanged in case we call UseMethod */
 /* MULTIPLE_MATCHES was added by RI in Jan 2005 but never activated:
    code in R-2-8-branch */
 
 SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 {
-    Rboolean seendots;
-    int i, arg_i = 0;
+    Rboolean seendots, partial = FALSE;
+    int i, j, arg_i = 0, h, n = 0, dotspos = -1;
+    int target[MATCH_CACHE_MAXARGS];
     SEXP f, a, b, dots, actuals;
 
+    if ((h = matchCacheIndex(formals, supplied, &n)) >= 0) {
+	if (!MatchCache) {
+	    MatchCache = allocVector(VECSXP, MATCH_CACHE_SIZE);
+	    R_PreserveObject(MatchCache);
+	}
+	SEXP entry = matchCacheGet(h, formals, supplied, n);
+	if (entry != R_NilValue)
+	    return matchArgsByPlan(formals, supplied, entry, n);
+	for (i = 0; i < n; i++) target[i] = -1;
+    }
+
     actuals = R_NilValue;
     for (f = formals ; f != R_NilValue ; f = CDR(f), arg_i++) {
 	/* CONS_NR is used since argument lists created here are only
@@ -233,6 +371,7 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 		    if(CAR(b) != R_MissingArg) SET_MISSING(a, 0);
 		    SET_ARGUSED(b, 2);
 		    fargused[arg_i] = 2;
+		    if (h >= 0) target[i - 1] = arg_i;
 		}
 	    }
 	}
@@ -255,6 +394,7 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 	    if (TAG(f) == R_DotsSymbol && !seendots) {
 		/* Record where ... value goes */
 		dots = a;
+		dotspos = arg_i;
 		seendots = TRUE;
 	    } else {
 		for (b = supplied, i = 1; b != R_NilValue; b = CDR(b), i++) {
@@ -275,6 +415,8 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 			if (CAR(b) != R_MissingArg) SET_MISSING(a, 0);
 			SET_ARGUSED(b, 1);
 			fargused[arg_i] = 1;
+			if (h >= 0) target[i - 1] = arg_i;
+			partial = TRUE;
 		    }
 		}
 	    }
@@ -295,6 +437,8 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
     a = actuals;
     b = supplied;
     seendots = FALSE;
+    arg_i = 0;
+    j = 0;
 
     while (f != R_NilValue && b != R_NilValue && !seendots) {
 	if (TAG(f) == R_DotsSymbol) {
@@ -302,11 +446,13 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 	    seendots = TRUE;
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	} else if (CAR(a) != R_MissingArg) {
 	    /* Already matched by tag */
 	    /* skip to next formal */
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	} else if (ARGUSED(b) || TAG(b) != R_NilValue) {
 	    /* This value used or tagged , skip to next value */
 	    /* The second test above is needed because we */
@@ -314,14 +460,18 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 	    /* matches. */
 	    /* The formal being considered remains the same */
 	    b = CDR(b);
+	    j++;
 	} else {
 	    /* We have a positional match */
 	    SETCAR(a, CAR(b));
 	    if(CAR(b) != R_MissingArg) SET_MISSING(a, 0);
 	    SET_ARGUSED(b, 1);
+	    if (h >= 0) target[j] = arg_i;
 	    b = CDR(b);
+	    j++;
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	}
     }
 
@@ -383,6 +533,8 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 		      strchr(CHAR(asChar(deparse1line(unusedForError, 0))), '('));
 	}
     }
+    if (h >= 0)
+	matchCachePut(h, formals, supplied, n, target, dotspos, partial);
     UNPROTECT(1);
     return(actuals);
 }
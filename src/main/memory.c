@@ -101,6 +101,11 @@ extern void *Rm_realloc(void * p, size_t n);
 #define free Rm_free
 #endif
 
+/* HAVE_PTHREAD is set in Defn.h */
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 /* malloc uses size_t.  We are assuming here that size_t is at least
    as large as unsigned long.  Changed from int at 1.6.0 to (i) allow
    2-4Gb objects on 32-bit system and (ii) objects limited only by
@@ -237,6 +242,19 @@ static Rboolean gc_inhibit_release = FALSE;
 #ifdef R_MEMORY_PROFILING
 static void R_ReportAllocation(R_size_t);
 static void R_ReportNewPage();
+
+/* The heap profiler samples an allocation when the count of bytes
+   allocated since the previous sample runs out. */
+static R_xlen_t R_HeapSampleCountdown = R_XLEN_T_MAX;
+static int R_HeapNSamples = 0;
+static Rboolean R_HeapProfiling = FALSE;
+static void R_HeapSample(SEXP, R_size_t);
+static void R_HeapProfileCollect(Rboolean);
+# define HEAP_SAMPLE(s, bytes) do { \
+    if ((R_HeapSampleCountdown -= (bytes)) < 0) R_HeapSample(s, bytes); \
+} while (0)
+#else
+# define HEAP_SAMPLE(s, bytes) do { } while (0)
 #endif
 
 #define GC_PROT(X) do { \
@@ -294,9 +312,13 @@ static double R_MinFreeFrac = 0.2;
    R_MaxKeepFrac times the number of allocated nodes for each class is
    retained.  Pages not needed to meet this requirement are released.
    An attempt to release pages is made every R_PageReleaseFreq level 1
-   or level 2 collections. */
+   or level 2 collections.  An attempt examines at most
+   R_PageReleaseBatch pages of each class, resuming where the previous
+   one stopped, so the cost of returning the pages of a large heap that
+   has died is spread over several collections. */
 static double R_MaxKeepFrac = 0.5;
 static int R_PageReleaseFreq = 1;
+static int R_PageReleaseBatch = 1024;
 
 /* The heap size constants R_NSize and R_VSize are used for triggering
    collections.  The initial values set by defaults or command line
@@ -545,8 +567,19 @@ typedef union PAGE_HEADER {
    collection.  This is the default.  The first option is simpler in
    some ways, but will create more floating garbage and add a bit to
    the execution time, though the difference is probably marginal on
-   both counts.*/
+   both counts.
+
+   After a full collection the free nodes of the small node classes are
+   not linked back into New space by the collector: that is left to
+   GetNewPage(), which sweeps the pages a page at a time as allocation
+   needs them (see SweepPage).  The pages still to be swept are those
+   from unswept on in the page list; the free nodes on them are exactly
+   their unmarked ones, and are in no list.  This is enabled by
+   defining LAZY_SWEEP. */
 /*#define EXPEL_OLD_TO_NEW*/
+#if ! defined(PROTECTCHECK) && ! defined(DEBUG_GC)
+# define LAZY_SWEEP
+#endif
 static struct {
     SEXP Old[NUM_OLD_GENERATIONS], New, Free;
     SEXPREC OldPeg[NUM_OLD_GENERATIONS], NewPeg;
@@ -555,7 +588,7 @@ static struct {
     SEXPREC OldToNewPeg[NUM_OLD_GENERATIONS];
 #endif
     int OldCount[NUM_OLD_GENERATIONS], AllocCount, PageCount;
-    PAGE_HEADER *pages;
+    PAGE_HEADER *pages, *unswept;
 } R_GenHeap[NUM_NODE_CLASSES];
 
 static R_size_t R_NodesInUse = 0;
@@ -608,21 +641,11 @@ static R_size_t R_NodesInUse = 0;
 
 /* This macro calls dc__action__ for each child of __n__, passing
    dc__extra__ as a second argument for each call. */
-/* When the CHARSXP hash chains are maintained through the ATTRIB
-   field it is important that we NOT trace those fields otherwise too
-   many CHARSXPs will be kept alive artificially. As a safety we don't
-   ignore all non-NULL ATTRIB values for CHARSXPs but only those that
-   are themselves CHARSXPs, which is what they will be if they are
-   part of a hash chain.  Theoretically, for CHARSXPs the ATTRIB field
-   should always be either R_NilValue or a CHARSXP. */
 #ifdef PROTECTCHECK
 # define HAS_GENUINE_ATTRIB(x) \
-    (TYPEOF(x) != FREESXP && ATTRIB(x) != R_NilValue && \
-     (TYPEOF(x) != CHARSXP || TYPEOF(ATTRIB(x)) != CHARSXP))
+    (TYPEOF(x) != FREESXP && ATTRIB(x) != R_NilValue)
 #else
-# define HAS_GENUINE_ATTRIB(x) \
-    (ATTRIB(x) != R_NilValue && \
-     (TYPEOF(x) != CHARSXP || TYPEOF(ATTRIB(x)) != CHARSXP))
+# define HAS_GENUINE_ATTRIB(x) (ATTRIB(x) != R_NilValue)
 #endif
 
 #ifdef PROTECTCHECK
@@ -725,6 +748,7 @@ static R_size_t R_NodesInUse = 0;
   R_GenHeap[c].Free = NEXT_NODE(__n__); \
   R_NodesInUse++; \
   (s) = __n__; \
+  HEAP_SAMPLE(__n__, NODE_SIZE(c)); \
 } while (0)
 
 #define NO_FREE_NODES() (R_NodesInUse >= R_NSize)
@@ -847,6 +871,39 @@ static void DEBUG_RELEASE_PRINT(int rel_pages, int maxrel_pages, int i)
 
 /* Page Allocation and Release. */
 
+#ifdef LAZY_SWEEP
+/* Link the free nodes of the next unswept page into New space.  The
+   free list is in page order, as SortNodes would leave it. */
+static void SweepPage(int node_class)
+{
+    PAGE_HEADER *page = R_GenHeap[node_class].unswept;
+    SEXP new = R_GenHeap[node_class].New, last = PREV_NODE(new);
+    int node_size = NODE_SIZE(node_class);
+    int page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
+    char *data = PAGE_DATA(page);
+
+    R_GenHeap[node_class].unswept = page->next;
+    for (int i = 0; i < page_count; i++, data += node_size) {
+	SEXP s = (SEXP) data;
+	if (! NODE_IS_MARKED(s))
+	    SNAP_NODE(s, new);
+    }
+    if (R_GenHeap[node_class].Free == new)
+	R_GenHeap[node_class].Free = NEXT_NODE(last);
+}
+
+/* Sweep all remaining pages; needed before a collection that unmarks
+   the nodes of old generations by following their lists. */
+static void FinishSweep(void)
+{
+    for (int i = 0; i < NUM_SMALL_NODE_CLASSES; i++)
+	while (R_GenHeap[i].unswept != NULL)
+	    SweepPage(i);
+}
+#endif
+
+/* Make free nodes of a small node class available, by sweeping pages
+   left from the last full collection or else by allocating a page. */
 static void GetNewPage(int node_class)
 {
     SEXP s, base;
@@ -854,6 +911,14 @@ static void GetNewPage(int node_class)
     PAGE_HEADER *page;
     int node_size, page_count, i;  // FIXME: longer type?
 
+#ifdef LAZY_SWEEP
+    while (R_GenHeap[node_class].unswept != NULL) {
+	SweepPage(node_class);
+	if (R_GenHeap[node_class].Free != R_GenHeap[node_class].New)
+	    return;
+    }
+#endif
+
     node_size = NODE_SIZE(node_class);
     page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
 
@@ -892,7 +957,8 @@ static void GetNewPage(int node_class)
     }
 }
 
-static void ReleasePage(PAGE_HEADER *page, int node_class)
+/* The nodes of an unswept page are in no list. */
+static void ReleasePage(PAGE_HEADER *page, int node_class, Rboolean linked)
 {
     SEXP s;
     char *data;
@@ -904,7 +970,8 @@ static void ReleasePage(PAGE_HEADER *page, int node_class)
 
     for (i = 0; i < page_count; i++, data += node_size) {
 	s = (SEXP) data;
-	UNSNAP_NODE(s);
+	if (linked)
+	    UNSNAP_NODE(s);
 	R_GenHeap[node_class].AllocCount--;
     }
     R_GenHeap[node_class].PageCount--;
@@ -916,6 +983,11 @@ static void TryToReleasePages(void)
     SEXP s;
     int i;
     static int release_count = 0;
+    /* the page preceding the one the next scan starts at, or NULL to
+       start at the beginning of the list.  Pages are only unlinked
+       here and never the one in last, so it stays valid. */
+    static PAGE_HEADER *release_last[NUM_SMALL_NODE_CLASSES];
+    static Rboolean release_resume[NUM_SMALL_NODE_CLASSES];
 
     if (release_count == 0) {
 	release_count = R_PageReleaseFreq;
@@ -924,16 +996,29 @@ static void TryToReleasePages(void)
 	    PAGE_HEADER *page, *last, *next;
 	    int node_size = NODE_SIZE(i);
 	    int page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
-	    int maxrel, maxrel_pages, rel_pages, gen;
+	    int maxrel, maxrel_pages, rel_pages, gen, budget;
+	    /* pages are released after a full collection, when none has
+	       been swept, or after a level 1 one, when all have been */
+	    Rboolean linked = R_GenHeap[i].unswept == NULL;
 
 	    maxrel = R_GenHeap[i].AllocCount;
 	    for (gen = 0; gen < NUM_OLD_GENERATIONS; gen++)
 		maxrel -= (1.0 + R_MaxKeepFrac) * R_GenHeap[i].OldCount[gen];
 	    maxrel_pages = maxrel > 0 ? maxrel / page_count : 0;
 
+	    if (release_resume[i]) {
+		last = release_last[i];
+		page = last == NULL ? R_GenHeap[i].pages : last->next;
+	    }
+	    else {
+		last = NULL;
+		page = R_GenHeap[i].pages;
+	    }
+
 	    /* all nodes in New space should be both free and unmarked */
-	    for (page = R_GenHeap[i].pages, rel_pages = 0, last = NULL;
-		 rel_pages < maxrel_pages && page != NULL;) {
+	    for (rel_pages = 0, budget = R_PageReleaseBatch;
+		 rel_pages < maxrel_pages && page != NULL && budget > 0;
+		 budget--) {
 		int j, in_use;
 		char *data = PAGE_DATA(page);
 
@@ -947,7 +1032,9 @@ static void TryToReleasePages(void)
 		    }
 		}
 		if (! in_use) {
-		    ReleasePage(page, i);
+		    if (page == R_GenHeap[i].unswept)
+			R_GenHeap[i].unswept = next;
+		    ReleasePage(page, i, linked);
 		    if (last == NULL)
 			R_GenHeap[i].pages = next;
 		    else
@@ -958,6 +1045,9 @@ static void TryToReleasePages(void)
 		else last = page;
 		page = next;
 	    }
+	    /* resume after last if the scan was cut short by the budget */
+	    release_resume[i] = page != NULL && budget == 0;
+	    release_last[i] = last;
 	    DEBUG_RELEASE_PRINT(rel_pages, maxrel_pages, i);
 	    R_GenHeap[i].Free = NEXT_NODE(R_GenHeap[i].New);
 	}
@@ -998,6 +1088,572 @@ static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
     return BYTE2VEC(size);
 }
 
+/* Vector Arenas.  Large vectors of up to ARENA_MAX_SIZE bytes are not
+   obtained from malloc one at a time but from slabs divided into slots
+   of one of ARENA_NUM_CLASSES sizes, eight for each power of two, so
+   that at most an eighth of a slot is wasted.  A slab hands out its
+   slots by bumping a pointer and then from the list of the slots
+   freed by the collector.  Slabs that have become empty are released
+   together at the end of a collection, except that one of the
+   smaller sizes is kept if that size has been allocated since the
+   previous collection.  As the collector does not move objects the
+   arenas are shared by all generations.  The slab of a vector is
+   found by a binary search of a table of the slabs sorted by address.
+   Arenas are not used with valgrind instrumentation, which needs to
+   see each vector. */
+
+#if VALGRIND_LEVEL == 0
+# define VECTOR_ARENAS
+#endif
+
+#ifdef VECTOR_ARENAS
+#define ARENA_MIN_SHIFT 7	/* the smallest slots have 144 bytes */
+#define ARENA_MAX_SHIFT 16
+#define ARENA_MAX_SIZE ((R_size_t) 1 << ARENA_MAX_SHIFT)
+#define ARENA_NUM_CLASSES (8 * (ARENA_MAX_SHIFT - ARENA_MIN_SHIFT))
+#define ARENA_SLAB_SIZE (256 * 1024)
+#define ARENA_MIN_SLOTS 4
+#define ARENA_SLAB_HEADER 64
+
+typedef struct arena_slab {
+    struct arena_slab *next, *prev; /* in the list of slabs with free slots */
+    char *data;
+    void *free;			/* slots freed by the collector */
+    int size_class, nslots, used, bumped;
+} arena_slab;
+
+static struct {
+    arena_slab *avail;		/* slabs with free slots */
+    R_size_t size;		/* of the slots */
+    int allocated;		/* slots allocated since the last collection */
+} R_Arenas[ARENA_NUM_CLASSES];
+
+static arena_slab **R_ArenaSlabs = NULL; /* sorted by address */
+static int R_ArenaNSlabs = 0, R_ArenaSlabsSize = 0;
+static R_size_t R_ArenaBytes = 0, R_ArenaBytesUsed = 0;
+
+static void InitArenas(void)
+{
+    for (int c = 0; c < ARENA_NUM_CLASSES; c++) {
+	int e = ARENA_MIN_SHIFT + c / 8;
+	R_Arenas[c].size = ((R_size_t) 1 << e) +
+	    (c % 8 + 1) * ((R_size_t) 1 << (e - 3));
+    }
+}
+
+/* the class of the smallest slots holding bytes, which must be more
+   than 1 << ARENA_MIN_SHIFT and at most ARENA_MAX_SIZE */
+static R_INLINE int ArenaClass(R_size_t bytes)
+{
+    int e = ARENA_MIN_SHIFT;
+    while (((R_size_t) 1 << (e + 1)) < bytes) e++;
+    return 8 * (e - ARENA_MIN_SHIFT) +
+	(int) ((bytes - 1 - ((R_size_t) 1 << e)) >> (e - 3));
+}
+
+static R_INLINE void LinkArenaSlab(arena_slab *slab)
+{
+    arena_slab **head = &R_Arenas[slab->size_class].avail;
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL) (*head)->prev = slab;
+    *head = slab;
+}
+
+static R_INLINE void UnlinkArenaSlab(arena_slab *slab)
+{
+    if (slab->prev != NULL) slab->prev->next = slab->next;
+    else R_Arenas[slab->size_class].avail = slab->next;
+    if (slab->next != NULL) slab->next->prev = slab->prev;
+}
+
+/* the index of the last slab starting at or before p, or -1 */
+static R_INLINE int ArenaSlabIndex(void *p)
+{
+    int lo = 0, hi = R_ArenaNSlabs - 1;
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if ((char *) R_ArenaSlabs[mid] <= (char *) p) lo = mid + 1;
+	else hi = mid - 1;
+    }
+    return hi;
+}
+
+static arena_slab *NewArenaSlab(int c)
+{
+    R_size_t size = R_Arenas[c].size;
+    int i, nslots = (int) (ARENA_SLAB_SIZE / size);
+    arena_slab *slab;
+
+    if (nslots < ARENA_MIN_SLOTS)
+	nslots = ARENA_MIN_SLOTS;
+    if (R_ArenaNSlabs == R_ArenaSlabsSize) {
+	int n = R_ArenaSlabsSize ? 2 * R_ArenaSlabsSize : 64;
+	arena_slab **slabs = realloc(R_ArenaSlabs, n * sizeof(arena_slab *));
+	if (slabs == NULL)
+	    return NULL;
+	R_ArenaSlabs = slabs;
+	R_ArenaSlabsSize = n;
+    }
+    slab = malloc(ARENA_SLAB_HEADER + nslots * size);
+    if (slab == NULL)
+	return NULL;
+    slab->data = ((char *) slab) + ARENA_SLAB_HEADER;
+    slab->free = NULL;
+    slab->size_class = c;
+    slab->nslots = nslots;
+    slab->used = slab->bumped = 0;
+    i = ArenaSlabIndex(slab) + 1;
+    memmove(R_ArenaSlabs + i + 1, R_ArenaSlabs + i,
+	    (R_ArenaNSlabs - i) * sizeof(arena_slab *));
+    R_ArenaSlabs[i] = slab;
+    R_ArenaNSlabs++;
+    R_ArenaBytes += ARENA_SLAB_HEADER + nslots * size;
+    LinkArenaSlab(slab);
+    return slab;
+}
+
+static void *ArenaAlloc(R_size_t bytes)
+{
+    int c = ArenaClass(bytes);
+    arena_slab *slab = R_Arenas[c].avail;
+    void *p;
+
+    if (slab == NULL && (slab = NewArenaSlab(c)) == NULL)
+	return NULL;
+    if (slab->free != NULL) {
+	p = slab->free;
+	slab->free = *(void **) p;
+    }
+    else p = slab->data + slab->bumped++ * R_Arenas[c].size;
+    if (++slab->used == slab->nslots)
+	UnlinkArenaSlab(slab);
+    R_Arenas[c].allocated++;
+    R_ArenaBytesUsed += R_Arenas[c].size;
+    return p;
+}
+
+/* Return a vector's memory to its slab; FALSE if it is not in one. */
+static Rboolean ArenaFree(void *p)
+{
+    int i = ArenaSlabIndex(p);
+    arena_slab *slab;
+
+    if (i < 0)
+	return FALSE;
+    slab = R_ArenaSlabs[i];
+    if ((char *) p >= slab->data + slab->nslots *
+	R_Arenas[slab->size_class].size)
+	return FALSE;
+    if (slab->used-- == slab->nslots)
+	LinkArenaSlab(slab);
+    *(void **) p = slab->free;
+    slab->free = p;
+    R_ArenaBytesUsed -= R_Arenas[slab->size_class].size;
+    return TRUE;
+}
+
+static void ReleaseArenaSlabs(void)
+{
+    int c, i, j, released = 0;
+
+    for (c = 0; c < ARENA_NUM_CLASSES; c++) {
+	int keep = R_Arenas[c].allocated > 0 &&
+	    R_Arenas[c].size * ARENA_MIN_SLOTS <= ARENA_SLAB_SIZE;
+	arena_slab *slab, *next;
+	R_Arenas[c].allocated = 0;
+	for (slab = R_Arenas[c].avail; slab != NULL; slab = next) {
+	    next = slab->next;
+	    if (slab->used == 0) {
+		if (keep > 0) {
+		    /* start again from the beginning of the slab */
+		    slab->free = NULL;
+		    slab->bumped = 0;
+		    keep -= slab->nslots;
+		}
+		else {
+		    UnlinkArenaSlab(slab);
+		    slab->used = -1; /* marks it for release */
+		    released++;
+		}
+	    }
+	}
+    }
+    if (released > 0) {
+	for (i = 0, j = 0; i < R_ArenaNSlabs; i++) {
+	    arena_slab *slab = R_ArenaSlabs[i];
+	    if (slab->used < 0) {
+		R_ArenaBytes -= ARENA_SLAB_HEADER +
+		    slab->nslots * R_Arenas[slab->size_class].size;
+		free(slab);
+	    }
+	    else R_ArenaSlabs[j++] = slab;
+	}
+	R_ArenaNSlabs = j;
+    }
+}
+#endif
+
+
+/* Mapped Vectors.  On Linux vectors of at least R_VectorMapSize bytes
+   (from the environment variable R_VECTOR_MMAP_SIZE; by default none)
+   are each given a mapping of their own, starting at a huge page
+   boundary and advised to be backed by transparent huge pages, which
+   saves TLB misses on vectors of many Gb.  With R_VECTOR_NUMA set to
+   "interleave" the pages are spread over the NUMA nodes the process
+   may use, and with "local" each page is placed on the node of the
+   thread that first touches it, whatever the policy of the process.
+   Both are only advice, and are ignored where the kernel does not
+   support them.  The mappings are kept in a table sorted by address,
+   which gives the length to unmap when the vector is collected. */
+
+#if defined(__linux__) && defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+# define VECTOR_MMAP
+#endif
+
+#ifdef VECTOR_MMAP
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+
+#define HUGE_PAGE_SIZE ((R_size_t) 2 * 1024 * 1024)
+
+/* NUMA placement of mapped vectors, and the values needed from
+   <linux/mempolicy.h>, which need not be installed */
+#define VMAP_NUMA_DEFAULT 0
+#define VMAP_NUMA_INTERLEAVE 1
+#define VMAP_NUMA_LOCAL 2
+#define VMAP_MPOL_INTERLEAVE 3
+#define VMAP_MPOL_LOCAL 4
+#define VMAP_MPOL_F_MEMS_ALLOWED 4
+#define VMAP_MAX_NODES 1024
+
+static R_size_t R_VectorMapSize = 0; /* 0: vectors are not mapped */
+static int R_VectorMapNuma = VMAP_NUMA_DEFAULT;
+static unsigned long vmap_nodes[VMAP_MAX_NODES / (8 * sizeof(unsigned long))];
+
+typedef struct {
+    char *base;
+    R_size_t size;
+} vector_map;
+
+static vector_map *R_VectorMaps = NULL;
+static int R_VectorNMaps = 0, R_VectorMapsSize = 0;
+
+static void InitVectorMaps(void)
+{
+    char *arg = getenv("R_VECTOR_MMAP_SIZE");
+    int ierr;
+
+    if (arg == NULL)
+	return;
+    R_VectorMapSize = R_Decode2Long(arg, &ierr);
+    if (ierr != 0)
+	R_VectorMapSize = 0;
+    else if (R_VectorMapSize > 0 && R_VectorMapSize < HUGE_PAGE_SIZE)
+	R_VectorMapSize = HUGE_PAGE_SIZE;
+    arg = getenv("R_VECTOR_NUMA");
+    if (R_VectorMapSize > 0 && arg != NULL) {
+#ifdef SYS_mbind
+	if (streql(arg, "interleave")) {
+	    if (syscall(SYS_get_mempolicy, NULL, vmap_nodes,
+			(unsigned long) VMAP_MAX_NODES, NULL,
+			(unsigned long) VMAP_MPOL_F_MEMS_ALLOWED) == 0)
+		R_VectorMapNuma = VMAP_NUMA_INTERLEAVE;
+	}
+	else if (streql(arg, "local"))
+	    R_VectorMapNuma = VMAP_NUMA_LOCAL;
+#endif
+    }
+}
+
+/* the index of the last mapping starting at or before p, or -1 */
+static R_INLINE int VectorMapIndex(void *p)
+{
+    int lo = 0, hi = R_VectorNMaps - 1;
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if (R_VectorMaps[mid].base <= (char *) p) lo = mid + 1;
+	else hi = mid - 1;
+    }
+    return hi;
+}
+
+static void *MapVector(R_size_t bytes)
+{
+    static R_size_t pagesize = 0;
+    R_size_t size;
+    char *p, *base;
+    int i;
+
+    if (pagesize == 0)
+	pagesize = (R_size_t) sysconf(_SC_PAGESIZE);
+    if (bytes > R_SIZE_T_MAX - 2 * HUGE_PAGE_SIZE)
+	return NULL;
+    /* the tail after the last huge page uses small pages */
+    size = (bytes + pagesize - 1) & ~(pagesize - 1);
+    if (R_VectorNMaps == R_VectorMapsSize) {
+	int n = R_VectorMapsSize ? 2 * R_VectorMapsSize : 64;
+	vector_map *maps = realloc(R_VectorMaps, n * sizeof(vector_map));
+	if (maps == NULL)
+	    return NULL;
+	R_VectorMaps = maps;
+	R_VectorMapsSize = n;
+    }
+    /* map a huge page more than needed and trim both ends */
+    p = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+    base = p + ((HUGE_PAGE_SIZE - (R_size_t) p % HUGE_PAGE_SIZE)
+		% HUGE_PAGE_SIZE);
+    if (base > p)
+	munmap(p, base - p);
+    if (base + size < p + size + HUGE_PAGE_SIZE)
+	munmap(base + size, p + HUGE_PAGE_SIZE - base);
+#ifdef MADV_HUGEPAGE
+    madvise(base, size, MADV_HUGEPAGE);
+#endif
+#ifdef SYS_mbind
+    if (R_VectorMapNuma == VMAP_NUMA_INTERLEAVE)
+	syscall(SYS_mbind, base, size, VMAP_MPOL_INTERLEAVE, vmap_nodes,
+		(unsigned long) VMAP_MAX_NODES, 0);
+    else if (R_VectorMapNuma == VMAP_NUMA_LOCAL)
+	syscall(SYS_mbind, base, size, VMAP_MPOL_LOCAL, NULL, 0, 0);
+#endif
+    i = VectorMapIndex(base) + 1;
+    memmove(R_VectorMaps + i + 1, R_VectorMaps + i,
+	    (R_VectorNMaps - i) * sizeof(vector_map));
+    R_VectorMaps[i].base = base;
+    R_VectorMaps[i].size = size;
+    R_VectorNMaps++;
+    return base;
+}
+
+/* Remove the mapping of a vector from the table and return its length,
+   or 0 if p was not mapped. */
+static R_size_t UnlinkVectorMap(void *p)
+{
+    int i = VectorMapIndex(p);
+    R_size_t size;
+
+    if (i < 0 || R_VectorMaps[i].base != (char *) p)
+	return 0;
+    size = R_VectorMaps[i].size;
+    memmove(R_VectorMaps + i, R_VectorMaps + i + 1,
+	    (R_VectorNMaps - i - 1) * sizeof(vector_map));
+    R_VectorNMaps--;
+    return size;
+}
+#endif
+/* Returning a large vector to the system (for a block obtained by
+   mmap, unmapping it) can take longer than marking a small heap.
+   Where threads are available the blocks of large vectors are
+   therefore handed to a helper thread and freed there, outside the
+   collector's pause; the heap accounting is updated at once.  Blocks
+   below R_BgFreeMinSize VECRECs are cheap to free and are released
+   directly, as are those of custom allocators, which need not be
+   thread-safe.  Mapped vectors are always unmapped by the helper.
+   R_gc_full() waits for the helper, as it is called when an
+   allocation has failed. */
+
+#ifdef HAVE_PTHREAD
+# include <signal.h>
+
+static R_size_t R_BgFreeMinSize = 8192; /* 64Kb */
+
+typedef struct {
+    void *p;
+    R_size_t mapped;		/* length of a mapping, or 0 */
+} bgfree_block;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work, idle;
+    bgfree_block *queue;	/* blocks waiting to be freed */
+    size_t n, size;
+    Rboolean busy;		/* is the helper freeing a batch? */
+    int state;			/* 0 not started, 1 running, -1 unavailable */
+} bgfree = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	     PTHREAD_COND_INITIALIZER, NULL, 0, 0, FALSE, 0 };
+
+static void BgFreeBlocks(bgfree_block *queue, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+#ifdef VECTOR_MMAP
+	if (queue[i].mapped > 0) {
+	    munmap(queue[i].p, queue[i].mapped);
+	    continue;
+	}
+#endif
+	free(queue[i].p);
+    }
+    free(queue);
+}
+
+static void *BgFreeThread(void *unused)
+{
+    pthread_mutex_lock(&bgfree.lock);
+    for (;;) {
+	while (bgfree.n == 0) {
+	    bgfree.busy = FALSE;
+	    pthread_cond_broadcast(&bgfree.idle);
+	    pthread_cond_wait(&bgfree.work, &bgfree.lock);
+	}
+	bgfree_block *queue = bgfree.queue;
+	size_t n = bgfree.n;
+	bgfree.queue = NULL;
+	bgfree.n = bgfree.size = 0;
+	bgfree.busy = TRUE;
+	pthread_mutex_unlock(&bgfree.lock);
+	BgFreeBlocks(queue, n);
+	pthread_mutex_lock(&bgfree.lock);
+    }
+    return NULL;
+}
+
+static void BgFreeAtForkPrepare(void) { pthread_mutex_lock(&bgfree.lock); }
+static void BgFreeAtForkParent(void) { pthread_mutex_unlock(&bgfree.lock); }
+static void BgFreeAtForkChild(void)
+{
+    /* the helper does not exist in the child; a new one is started
+       for the blocks still queued.  A batch the helper was freeing
+       at the time of the fork is not freed in the child. */
+    pthread_cond_init(&bgfree.work, NULL);
+    pthread_cond_init(&bgfree.idle, NULL);
+    bgfree.busy = FALSE;
+    if (bgfree.state == 1) bgfree.state = 0;
+    pthread_mutex_unlock(&bgfree.lock);
+}
+
+static void StartBgFreeThread(void)
+{
+    static Rboolean atfork = FALSE;
+    pthread_attr_t attr;
+    pthread_t thread;
+    sigset_t all, old;
+
+    if (! atfork) {
+	if (pthread_atfork(BgFreeAtForkPrepare, BgFreeAtForkParent,
+			   BgFreeAtForkChild) != 0) {
+	    bgfree.state = -1;
+	    return;
+	}
+	atfork = TRUE;
+    }
+    /* signals such as SIGINT and SIGPROF are for the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 256 * 1024); /* it only frees */
+    bgfree.state = pthread_create(&thread, &attr, BgFreeThread, NULL) == 0 ?
+	1 : -1;
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Queue a block for the helper, with the length of its mapping if it
+   was mapped; returns FALSE if it should be freed by the caller. */
+static Rboolean BgFreeQueue(void *p, R_size_t mapped)
+{
+    if (bgfree.state < 0)
+	return FALSE;
+    pthread_mutex_lock(&bgfree.lock);
+    if (bgfree.n == bgfree.size) {
+	size_t size = bgfree.size ? 2 * bgfree.size : 64;
+	bgfree_block *queue = realloc(bgfree.queue,
+				      size * sizeof(bgfree_block));
+	if (queue == NULL) {
+	    pthread_mutex_unlock(&bgfree.lock);
+	    return FALSE;
+	}
+	bgfree.queue = queue;
+	bgfree.size = size;
+    }
+    bgfree.queue[bgfree.n].p = p;
+    bgfree.queue[bgfree.n++].mapped = mapped;
+    pthread_mutex_unlock(&bgfree.lock);
+    return TRUE;
+}
+
+/* Wake up the helper for the blocks queued by a collection, starting
+   it if need be; without one they are freed here. */
+static void BgFreeRelease(void)
+{
+    pthread_mutex_lock(&bgfree.lock);
+    if (bgfree.n > 0) {
+	if (bgfree.state == 0)
+	    StartBgFreeThread();
+	if (bgfree.state == 1) {
+	    bgfree.busy = TRUE;
+	    pthread_cond_signal(&bgfree.work);
+	}
+	else {
+	    BgFreeBlocks(bgfree.queue, bgfree.n);
+	    bgfree.queue = NULL;
+	    bgfree.n = bgfree.size = 0;
+	}
+    }
+    pthread_mutex_unlock(&bgfree.lock);
+}
+
+static void BgFreeWait(void)
+{
+    if (bgfree.state != 1)
+	return;
+    pthread_mutex_lock(&bgfree.lock);
+    while (bgfree.busy || bgfree.n > 0)
+	pthread_cond_wait(&bgfree.idle, &bgfree.lock);
+    pthread_mutex_unlock(&bgfree.lock);
+}
+#endif
+
+static R_INLINE void *AllocLargeVector(R_size_t bytes)
+{
+#ifdef VECTOR_ARENAS
+    if (bytes > ((R_size_t) 1 << ARENA_MIN_SHIFT) && bytes <= ARENA_MAX_SIZE) {
+	void *p = ArenaAlloc(bytes);
+	if (p != NULL)
+	    return p;
+    }
+#endif
+#ifdef VECTOR_MMAP
+    if (R_VectorMapSize > 0 && bytes >= R_VectorMapSize) {
+	void *p = MapVector(bytes);
+	if (p != NULL)
+	    return p;
+    }
+#endif
+    return malloc(bytes);
+}
+
+static R_INLINE void FreeLargeVector(void *p, R_size_t size)
+{
+#ifdef VECTOR_ARENAS
+    if (size * sizeof(VECREC) < ARENA_MAX_SIZE && ArenaFree(p))
+	return;
+#endif
+#ifdef VECTOR_MMAP
+    if (R_VectorNMaps > 0) {
+	R_size_t mapped = UnlinkVectorMap(p);
+	if (mapped > 0) {
+#ifdef HAVE_PTHREAD
+	    if (BgFreeQueue(p, mapped))
+		return;
+#endif
+	    munmap(p, mapped);
+	    return;
+	}
+    }
+#endif
+#ifdef HAVE_PTHREAD
+    if (size >= R_BgFreeMinSize && BgFreeQueue(p, 0))
+	return;
+#endif
+    free(p);
+}
+
 static void custom_node_free(void *ptr);
 
 static void ReleaseLargeFreeVectors()
@@ -1023,11 +1679,12 @@ static void ReleaseLargeFreeVectors()
 		    R_LargeVallocSize -= size;
 #ifdef LONG_VECTOR_SUPPORT
 		    if (IS_LONG_VEC(s))
-			free(((char *) s) - sizeof(R_long_vec_hdr_t));
+			FreeLargeVector(((char *) s) - sizeof(R_long_vec_hdr_t),
+					size);
 		    else
-			free(s);
+			FreeLargeVector(s, size);
 #else
-		    free(s);
+		    FreeLargeVector(s, size);
 #endif
 		} else {
 #ifdef LONG_VECTOR_SUPPORT
@@ -1043,6 +1700,12 @@ static void ReleaseLargeFreeVectors()
 	    s = next;
 	}
     }
+#ifdef VECTOR_ARENAS
+    ReleaseArenaSlabs();
+#endif
+#ifdef HAVE_PTHREAD
+    BgFreeRelease();
+#endif
 }
 
 
@@ -1160,7 +1823,7 @@ static void old_to_new(SEXP x, SEXP y)
 */
 
 #define SORT_NODES
-#ifdef SORT_NODES
+#if defined(SORT_NODES) && ! defined(LAZY_SWEEP)
 static void SortNodes(void)
 {
     SEXP s;
@@ -1484,6 +2147,384 @@ SEXP attribute_hidden do_regFinaliz(SEXP call, SEXP op, SEXP args, SEXP rho)
 }
 
 
+#define PAGE_NODE_COUNT(c) \
+    ((R_PAGE_SIZE - sizeof(PAGE_HEADER)) / NODE_SIZE(c))
+
+/* Unmark the nodes of the old generations of the small node class i,
+   moving them to the next generation, and move them to New space, for
+   a full collection.  The nodes are found by walking the pages, which
+   is much faster than following the lists. */
+static void UnmarkClassPages(int i)
+{
+    int gen, k, n = PAGE_NODE_COUNT(i), size = NODE_SIZE(i);
+    for (PAGE_HEADER *page = R_GenHeap[i].pages; page; page = page->next) {
+	char *data = PAGE_DATA(page);
+	for (k = 0; k < n; k++, data += size) {
+	    SEXP s = (SEXP) data;
+	    if (NODE_IS_MARKED(s)) {
+		if (NODE_GENERATION(s) < NUM_OLD_GENERATIONS - 1)
+		    SET_NODE_GENERATION(s, NODE_GENERATION(s) + 1);
+		UNMARK_NODE(s);
+	    }
+	}
+    }
+    for (gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+	R_GenHeap[i].OldCount[gen] = 0;
+	if (NEXT_NODE(R_GenHeap[i].Old[gen]) != R_GenHeap[i].Old[gen])
+	    BULK_MOVE(R_GenHeap[i].Old[gen], R_GenHeap[i].New);
+    }
+}
+
+/* Parallel Marking.  With more than one GC thread (set by the
+   environment variable R_GC_NUM_THREADS) the main marking pass of
+   large collections is done by several threads.  Nodes are marked by
+   an atomic update of their sxpinfo word, and nodes still to be
+   scanned are kept in chunks of a mark stack: each thread works on
+   its own chunk and passes full chunks, or half of its chunk when
+   other threads are idle, to a shared pool from which idle threads
+   take their work.  Leaf nodes without attributes are marked but
+   never pushed.  The node lists cannot be changed while marking, so
+   the nodes are moved to their generations afterwards, with the node
+   classes divided between the threads.  In full collections the
+   lists of the small node classes are rebuilt by walking their pages,
+   which is much faster than unlinking scattered nodes; in other
+   collections each thread records the nodes it marks. */
+
+#if defined(_OPENMP) && !defined(PROTECTCHECK)
+# define GC_PARALLEL_MARK
+# include <omp.h>
+# ifdef HAVE_SCHED_H
+#  include <sched.h>
+# endif
+#endif
+
+static int R_GCNumThreads = 1;
+
+#ifdef GC_PARALLEL_MARK
+/* collections of heaps with fewer nodes in use are done serially */
+#define GC_PARALLEL_MIN_NODES 100000
+#define GC_MARK_CHUNK_SIZE 1022
+#define GC_MARK_KEEP_CHUNKS 64
+
+typedef struct gc_mark_chunk {
+    struct gc_mark_chunk *next;
+    int n;
+    SEXP s[GC_MARK_CHUNK_SIZE];
+} gc_mark_chunk;
+
+typedef struct {
+    gc_mark_chunk *work;		     /* nodes to be scanned */
+    Rboolean record;
+    gc_mark_chunk *marked[NUM_NODE_CLASSES]; /* nodes marked, by class */
+} gc_mark_state;
+
+static gc_mark_chunk *gc_mark_full = NULL, *gc_mark_empty = NULL;
+static gc_mark_chunk *gc_marked[NUM_NODE_CLASSES];
+static int gc_mark_nempty = 0, gc_mark_idle, gc_mark_team;
+static unsigned int gc_mark_mask;  /* the mark bit of an sxpinfo word */
+
+static R_INLINE Rboolean TryMarkNode(SEXP s)
+{
+    unsigned int *w = (unsigned int *) &s->sxpinfo, old;
+#pragma omp atomic capture
+    { old = *w; *w |= gc_mark_mask; }
+    return (old & gc_mark_mask) == 0;
+}
+
+static R_INLINE Rboolean IsLeafNode(SEXP s)
+{
+    if (ATTRIB(s) != R_NilValue) return FALSE;
+    switch (TYPEOF(s)) {
+    case CHARSXP:
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP:
+    case CPLXSXP:
+    case RAWSXP:
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
+static gc_mark_chunk *NewMarkChunk(gc_mark_chunk *next)
+{
+    gc_mark_chunk *c = NULL;
+#pragma omp critical(gc_mark)
+    if (gc_mark_empty != NULL) {
+	c = gc_mark_empty;
+	gc_mark_empty = c->next;
+	gc_mark_nempty--;
+    }
+    if (c == NULL && (c = malloc(sizeof(gc_mark_chunk))) == NULL)
+	R_Suicide("couldn't allocate mark stack");
+    c->n = 0;
+    c->next = next;
+    return c;
+}
+
+static void PublishMarkChunk(gc_mark_chunk *c)
+{
+#pragma omp critical(gc_mark)
+    {
+	c->next = gc_mark_full;
+	gc_mark_full = c;
+    }
+}
+
+/* Return the empty chunk 'c' and wait for a chunk with work; NULL
+   means that all threads are out of work and marking is done. */
+static gc_mark_chunk *TakeMarkChunk(gc_mark_chunk *c, int nthreads)
+{
+    Rboolean idle = FALSE;
+    for (;;) {
+	gc_mark_chunk *w = NULL;
+	Rboolean done = FALSE;
+#pragma omp critical(gc_mark)
+	{
+	    if (c != NULL) {
+		c->next = gc_mark_empty;
+		gc_mark_empty = c;
+		gc_mark_nempty++;
+		c = NULL;
+	    }
+	    if (gc_mark_full != NULL) {
+		w = gc_mark_full;
+		gc_mark_full = w->next;
+		if (idle) gc_mark_idle--;
+	    }
+	    else {
+		if (! idle) {
+		    idle = TRUE;
+		    gc_mark_idle++;
+		}
+		done = gc_mark_idle == nthreads;
+	    }
+	}
+	if (w != NULL || done)
+	    return w;
+#ifdef HAVE_SCHED_H
+	sched_yield();
+#endif
+    }
+}
+
+static R_INLINE void PushMarkedNode(gc_mark_state *st, SEXP s)
+{
+    if (st->record) {
+	gc_mark_chunk **m = st->marked + NODE_CLASS(s);
+	if (*m == NULL || (*m)->n == GC_MARK_CHUNK_SIZE)
+	    *m = NewMarkChunk(*m);
+	(*m)->s[(*m)->n++] = s;
+    }
+    if (! IsLeafNode(s)) {
+	if (st->work->n == GC_MARK_CHUNK_SIZE) {
+	    PublishMarkChunk(st->work);
+	    st->work = NewMarkChunk(NULL);
+	}
+	st->work->s[st->work->n++] = s;
+    }
+}
+
+#define PM_FORWARD_NODE(x, st) do {					\
+	SEXP pm__n__ = (x);						\
+	if (pm__n__ && ! NODE_IS_MARKED(pm__n__) && TryMarkNode(pm__n__)) \
+	    PushMarkedNode(st, pm__n__);				\
+    } while (0)
+
+static void MarkWorker(int nthreads, Rboolean record)
+{
+    gc_mark_state st;
+    int i;
+
+    st.work = NULL;
+    st.record = record;
+    for (i = 0; i < NUM_NODE_CLASSES; i++) st.marked[i] = NULL;
+    for (;;) {
+	if (st.work == NULL || st.work->n == 0) {
+	    /* chunks in the pool can be empty */
+	    if ((st.work = TakeMarkChunk(st.work, nthreads)) == NULL)
+		break;
+	    continue;
+	}
+	else if (st.work->n > 16) {
+	    int idle;
+#pragma omp atomic read
+	    idle = gc_mark_idle;
+	    if (idle > 0) {
+		/* give half of the work to the idle threads */
+		gc_mark_chunk *h = NewMarkChunk(NULL);
+		h->n = st.work->n / 2;
+		st.work->n -= h->n;
+		memcpy(h->s, st.work->s + st.work->n, h->n * sizeof(SEXP));
+		PublishMarkChunk(h);
+	    }
+	}
+	SEXP s = st.work->s[--st.work->n];
+	DO_CHILDREN(s, PM_FORWARD_NODE, &st);
+    }
+
+#pragma omp critical(gc_mark)
+    for (i = 0; i < NUM_NODE_CLASSES; i++)
+	while (st.marked[i] != NULL) {
+	    gc_mark_chunk *m = st.marked[i];
+	    st.marked[i] = m->next;
+	    m->next = gc_marked[i];
+	    gc_marked[i] = m;
+	}
+}
+
+/* Rebuild the lists of the small node class i from its pages after
+   marking for a full collection, when all its nodes are in the New
+   and Old lists. */
+static void RebuildClassLists(int i)
+{
+    int gen, k, n = PAGE_NODE_COUNT(i), size = NODE_SIZE(i);
+    SEXP peg = R_GenHeap[i].New;
+    SET_NEXT_NODE(peg, peg);
+    SET_PREV_NODE(peg, peg);
+    for (gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+	peg = R_GenHeap[i].Old[gen];
+	SET_NEXT_NODE(peg, peg);
+	SET_PREV_NODE(peg, peg);
+	R_GenHeap[i].OldCount[gen] = 0;
+    }
+    for (PAGE_HEADER *page = R_GenHeap[i].pages; page; page = page->next) {
+	char *data = PAGE_DATA(page);
+	for (k = 0; k < n; k++, data += size) {
+	    SEXP s = (SEXP) data;
+	    if (NODE_IS_MARKED(s)) {
+		SNAP_NODE(s, R_GenHeap[i].Old[NODE_GENERATION(s)]);
+		R_GenHeap[i].OldCount[NODE_GENERATION(s)]++;
+	    }
+	    else SNAP_NODE(s, R_GenHeap[i].New);
+	}
+    }
+}
+
+/* The parallel version of PROCESS_NODES() for the nodes forwarded from
+   the roots; returns the number of threads used. */
+static int ParallelProcessNodes(SEXP forwarded_nodes, int nthreads,
+				Rboolean full)
+{
+    gc_mark_chunk *c = NewMarkChunk(NULL);
+    SEXP s;
+    int i;
+
+    while (forwarded_nodes != NULL) {
+	s = forwarded_nodes;
+	forwarded_nodes = NEXT_NODE(forwarded_nodes);
+	SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].Old[NODE_GENERATION(s)]);
+	R_GenHeap[NODE_CLASS(s)].OldCount[NODE_GENERATION(s)]++;
+	if (c->n == GC_MARK_CHUNK_SIZE) {
+	    PublishMarkChunk(c);
+	    c = NewMarkChunk(NULL);
+	}
+	c->s[c->n++] = s;
+    }
+    PublishMarkChunk(c);
+
+    gc_mark_idle = 0;
+    for (i = 0; i < NUM_NODE_CLASSES; i++) gc_marked[i] = NULL;
+#pragma omp parallel num_threads(nthreads)
+    {
+#pragma omp single
+	gc_mark_team = omp_get_num_threads();
+	MarkWorker(gc_mark_team, ! full);
+    }
+
+    /* move the marked nodes to their generations */
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1) private(c)
+    for (i = 0; i < NUM_NODE_CLASSES; i++) {
+	if (full && i < NUM_SMALL_NODE_CLASSES)
+	    RebuildClassLists(i);
+	else if (full) {
+	    SEXP t = NEXT_NODE(R_GenHeap[i].New);
+	    while (t != R_GenHeap[i].New) {
+		SEXP next = NEXT_NODE(t);
+		if (NODE_IS_MARKED(t)) {
+		    UNSNAP_NODE(t);
+		    SNAP_NODE(t, R_GenHeap[i].Old[NODE_GENERATION(t)]);
+		    R_GenHeap[i].OldCount[NODE_GENERATION(t)]++;
+		}
+		t = next;
+	    }
+	}
+	else
+	    for (c = gc_marked[i]; c != NULL; c = c->next)
+		for (int k = 0; k < c->n; k++) {
+		    SEXP t = c->s[k];
+		    UNSNAP_NODE(t);
+		    SNAP_NODE(t, R_GenHeap[i].Old[NODE_GENERATION(t)]);
+		    R_GenHeap[i].OldCount[NODE_GENERATION(t)]++;
+		}
+    }
+
+    for (i = 0; i < NUM_NODE_CLASSES; i++)
+	while (gc_marked[i] != NULL) {
+	    c = gc_marked[i];
+	    gc_marked[i] = c->next;
+	    c->next = gc_mark_empty;
+	    gc_mark_empty = c;
+	    gc_mark_nempty++;
+	}
+    while (gc_mark_nempty > GC_MARK_KEEP_CHUNKS) {
+	c = gc_mark_empty;
+	gc_mark_empty = c->next;
+	gc_mark_nempty--;
+	free(c);
+    }
+    return gc_mark_team;
+}
+#endif
+
+#if defined(GC_PARALLEL_MARK) && defined(HAVE_PTHREAD)
+/* The OpenMP threads of the parent do not exist in a child process
+   created by fork(), and the run time may not cope with that, so
+   children mark serially. */
+static void gc_threads_atfork_child(void)
+{
+    R_GCNumThreads = 1;
+}
+#endif
+
+static void init_gc_threads(void)
+{
+#ifdef GC_PARALLEL_MARK
+    char *arg = getenv("R_GC_NUM_THREADS");
+    SEXPREC x;
+    if (arg != NULL) {
+	int n = atoi(arg);
+	if (n >= 1 && n <= 256) R_GCNumThreads = n;
+    }
+#ifdef HAVE_PTHREAD
+    if (R_GCNumThreads > 1)
+	pthread_atfork(NULL, NULL, gc_threads_atfork_child);
+#endif
+    memset(&x.sxpinfo, 0, sizeof(x.sxpinfo));
+    x.sxpinfo.mark = 1;
+    if (sizeof(x.sxpinfo) == sizeof(unsigned int))
+	memcpy(&gc_mark_mask, &x.sxpinfo, sizeof(unsigned int));
+    else R_GCNumThreads = 1;
+#endif
+}
+
+/* The (maximum) number of threads used by the OpenMP code in base R,
+   from the environment variable R_NUM_MATH_THREADS. */
+static void init_math_threads(void)
+{
+    char *arg = getenv("R_NUM_MATH_THREADS");
+    if (arg != NULL) {
+	int n = atoi(arg);
+	if (n > 0) R_max_num_math_threads = R_num_math_threads = n;
+    }
+}
+
+/* times of the phases of the last collection, in seconds */
+static double gc_phase_times[4];
+static int gc_mark_threads;
+
+
 /* The Generational Collector. */
 
 #define PROCESS_NODES() do { \
@@ -1502,8 +2543,14 @@ static void RunGenCollect(R_size_t size_needed)
     RCNTXT *ctxt;
     SEXP s;
     SEXP forwarded_nodes;
+    double t0, t1;
+#ifdef GC_PARALLEL_MARK
+    Rboolean parallel, full;
+#endif
 
     bad_sexp_type_seen = 0;
+    for (i = 0; i < 4; i++) gc_phase_times[i] = 0;
+    gc_mark_threads = 1;
 
     /* determine number of generations to collect */
     while (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
@@ -1521,6 +2568,18 @@ static void RunGenCollect(R_size_t size_needed)
 
  again:
     gens_collected = num_old_gens_to_collect;
+    t0 = currentTime();
+#ifdef LAZY_SWEEP
+    /* a full collection finds the unswept free nodes by walking the
+       pages; otherwise they have to be linked before unmarking */
+    if (num_old_gens_to_collect > 0 &&
+	num_old_gens_to_collect < NUM_OLD_GENERATIONS)
+	FinishSweep();
+#endif
+#ifdef GC_PARALLEL_MARK
+    parallel = R_GCNumThreads > 1 && R_NodesInUse >= GC_PARALLEL_MIN_NODES;
+    full = num_old_gens_to_collect == NUM_OLD_GENERATIONS;
+#endif
 
 #ifndef EXPEL_OLD_TO_NEW
     /* eliminate old-to-new references in generations to collect by
@@ -1545,8 +2604,18 @@ static void RunGenCollect(R_size_t size_needed)
 
     /* unmark all marked nodes in old generations to be collected and
        move to New space */
-    for (gen = 0; gen < num_old_gens_to_collect; gen++) {
-	for (i = 0; i < NUM_NODE_CLASSES; i++) {
+#ifdef GC_PARALLEL_MARK
+    /* the node classes can be done in parallel */
+#pragma omp parallel for num_threads(R_GCNumThreads) schedule(dynamic, 1) \
+    private(gen, s) if (parallel)
+#endif
+    for (i = 0; i < NUM_NODE_CLASSES; i++) {
+	if (num_old_gens_to_collect == NUM_OLD_GENERATIONS &&
+	    i < NUM_SMALL_NODE_CLASSES) {
+	    UnmarkClassPages(i);
+	    continue;
+	}
+	for (gen = 0; gen < num_old_gens_to_collect; gen++) {
 	    R_GenHeap[i].OldCount[gen] = 0;
 	    s = NEXT_NODE(R_GenHeap[i].Old[gen]);
 	    while (s != R_GenHeap[i].Old[gen]) {
@@ -1562,6 +2631,9 @@ static void RunGenCollect(R_size_t size_needed)
     }
 
     forwarded_nodes = NULL;
+    t1 = currentTime();
+    gc_phase_times[0] += t1 - t0;
+    t0 = t1;
 
 #ifndef EXPEL_OLD_TO_NEW
     /* scan nodes in uncollected old generations with old-to-new pointers */
@@ -1601,8 +2673,8 @@ static void RunGenCollect(R_size_t size_needed)
     FORWARD_NODE(R_print.na_string_noquote);
 
     if (R_SymbolTable != NULL)             /* in case of GC during startup */
-	for (i = 0; i < HSIZE; i++)        /* Symbol table */
-	    FORWARD_NODE(R_SymbolTable[i]);
+	for (i = 0; i < R_SymbolTableSize; i++) /* Symbol table */
+	    FORWARD_NODE(R_SymbolTable[i]);   /* NULL if free */
 
     if (R_CurrentExpr != NULL)	           /* Current expression */
 	FORWARD_NODE(R_CurrentExpr);
@@ -1649,7 +2721,18 @@ static void RunGenCollect(R_size_t size_needed)
     FORWARD_NODE(R_CachedScalarInteger);
 
     /* main processing loop */
-    PROCESS_NODES();
+#ifdef GC_PARALLEL_MARK
+    if (parallel) {
+	gc_mark_threads = ParallelProcessNodes(forwarded_nodes,
+					       R_GCNumThreads, full);
+	forwarded_nodes = NULL;
+    }
+    else
+#endif
+	PROCESS_NODES();
+    t1 = currentTime();
+    gc_phase_times[1] += t1 - t0;
+    t0 = t1;
 
     /* identify weakly reachable nodes */
     {
@@ -1672,6 +2755,24 @@ static void RunGenCollect(R_size_t size_needed)
 	} while (recheck_weak_refs);
     }
 
+    /* The vectors in the match() cache are only weakly referenced:
+       drop the entries for unreachable ones, keep the hash tables of
+       the others. */
+    if (R_MatchCache != NULL) {
+	for (i = 0; i < LENGTH(R_MatchCache); i += 3) {
+	    if (NODE_IS_MARKED(VECTOR_ELT(R_MatchCache, i))) {
+		FORWARD_NODE(VECTOR_ELT(R_MatchCache, i + 1));
+		FORWARD_NODE(VECTOR_ELT(R_MatchCache, i + 2));
+	    } else {
+		VECTOR_ELT(R_MatchCache, i) = R_NilValue;
+		VECTOR_ELT(R_MatchCache, i + 1) = R_NilValue;
+		VECTOR_ELT(R_MatchCache, i + 2) = R_NilValue;
+	    }
+	}
+	FORWARD_NODE(R_MatchCache);
+	PROCESS_NODES();
+    }
+
     /* mark nodes ready for finalizing */
     CheckFinalizers();
 
@@ -1685,35 +2786,28 @@ static void RunGenCollect(R_size_t size_needed)
     PROCESS_NODES();
 
     DEBUG_CHECK_NODE_COUNTS("after processing forwarded list");
-
-    /* process CHARSXP cache */
-    if (R_StringHash != NULL) /* in case of GC during initialization */
-    {
-	SEXP t;
-	int nc = 0;
-	for (i = 0; i < LENGTH(R_StringHash); i++) {
-	    s = VECTOR_ELT(R_StringHash, i);
-	    t = R_NilValue;
-	    while (s != R_NilValue) {
-		if (! NODE_IS_MARKED(CXHEAD(s))) { /* remove unused CHARSXP and cons cell */
-		    if (t == R_NilValue) /* head of list */
-			VECTOR_ELT(R_StringHash, i) = CXTAIL(s);
-		    else
-			CXTAIL(t) = CXTAIL(s);
-		    s = CXTAIL(s);
-		    continue;
-		}
-		FORWARD_NODE(s);
-		FORWARD_NODE(CXHEAD(s));
-		t = s;
-		s = CXTAIL(s);
+    t1 = currentTime();
+    gc_phase_times[2] += t1 - t0;
+    t0 = t1;
+
+    /* process CHARSXP cache: remove unused CHARSXPs */
+    for (int k = 0; k < 2; k++) {
+	R_StringTable *t = &R_StringHash[k];
+	for (R_size_t j = 0; j < t->size; j++) {
+	    s = t->slots[j].c;
+	    if (s != NULL && s != R_NilValue && ! NODE_IS_MARKED(s)) {
+		t->slots[j].c = R_NilValue;
+		t->used--;
+		t->deleted++;
 	    }
-	    if(VECTOR_ELT(R_StringHash, i) != R_NilValue) nc++;
 	}
-	SET_TRUELENGTH(R_StringHash, nc); /* SET_HASHPRI, really */
     }
-    FORWARD_NODE(R_StringHash);
-    PROCESS_NODES();
+
+#ifdef R_MEMORY_PROFILING
+    /* find the objects sampled by the heap profiler that are freed */
+    if (R_HeapNSamples > 0 || R_HeapProfiling)
+	R_HeapProfileCollect(gens_collected == NUM_OLD_GENERATIONS);
+#endif
 
 #ifdef PROTECTCHECK
     for(i=0; i< NUM_SMALL_NODE_CLASSES;i++){
@@ -1778,6 +2872,22 @@ static void RunGenCollect(R_size_t size_needed)
     for (i = 0; i < NUM_NODE_CLASSES; i++)
 	R_GenHeap[i].Free = NEXT_NODE(R_GenHeap[i].New);
 
+#ifdef LAZY_SWEEP
+    /* leave the small free nodes of a full collection to GetNewPage() */
+    if (gens_collected == NUM_OLD_GENERATIONS)
+	for (i = 0; i < NUM_SMALL_NODE_CLASSES; i++) {
+	    s = R_GenHeap[i].New;
+	    SET_NEXT_NODE(s, s);
+	    SET_PREV_NODE(s, s);
+	    R_GenHeap[i].Free = s;
+	    R_GenHeap[i].unswept = R_GenHeap[i].pages;
+	}
+#endif
+
+
+    t1 = currentTime();
+    gc_phase_times[3] += t1 - t0;
+    t0 = t1;
 
     /* update heap statistics */
     R_Collected = R_NSize;
@@ -1813,10 +2923,11 @@ static void RunGenCollect(R_size_t size_needed)
 	TryToReleasePages();
 	DEBUG_CHECK_NODE_COUNTS("after heap adjustment");
     }
-#ifdef SORT_NODES
+#if defined(SORT_NODES) && ! defined(LAZY_SWEEP)
     if (gens_collected == NUM_OLD_GENERATIONS)
 	SortNodes();
 #endif
+    gc_phase_times[3] += currentTime() - t0;
 
     if (gc_reporting) {
 	REprintf("Garbage collection %d = %d", gc_count, gen_gc_counts[0]);
@@ -2003,6 +3114,14 @@ void attribute_hidden InitMemory()
 
     init_gctorture();
     init_gc_grow_settings();
+    init_gc_threads();
+    init_math_threads();
+#ifdef VECTOR_ARENAS
+    InitArenas();
+#endif
+#ifdef VECTOR_MMAP
+    InitVectorMaps();
+#endif
 
     gc_reporting = R_Verbose;
     R_StandardPPStackSize = R_PPStackSize;
@@ -2606,7 +3725,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	    if (size < (R_SIZE_T_MAX / sizeof(VECREC)) - hdrsize) { /*** not sure this test is quite right -- why subtract the header? LT */
 		mem = allocator ?
 		    custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-		    malloc(hdrsize + size * sizeof(VECREC));
+		    AllocLargeVector(hdrsize + size * sizeof(VECREC));
 		if (mem == NULL) {
 		    /* If we are near the address space limit, we
 		       might be short of address space.  So return
@@ -2614,7 +3733,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 		    R_gc_full(alloc_size);
 		    mem = allocator ?
 			custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-			malloc(hdrsize + size * sizeof(VECREC));
+			AllocLargeVector(hdrsize + size * sizeof(VECREC));
 		}
 		if (mem != NULL) {
 #ifdef LONG_VECTOR_SUPPORT
@@ -2637,6 +3756,8 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 		else s = NULL;
 #ifdef R_MEMORY_PROFILING
 		R_ReportAllocation(hdrsize + size * sizeof(VECREC));
+		if (success)
+		    HEAP_SAMPLE(s, hdrsize + size * sizeof(VECREC));
 #endif
 	    } else s = NULL; /* suppress warning */
 	    if (! success) {
@@ -2802,6 +3923,9 @@ static void R_gc_full(R_size_t size_needed)
 {
     num_old_gens_to_collect = NUM_OLD_GENERATIONS;
     R_gc_internal(size_needed);
+#ifdef HAVE_PTHREAD
+    BgFreeWait();
+#endif
 }
 
 static double gctimes[5], gcstarttimes[5];
@@ -2917,6 +4041,19 @@ static void R_gc_internal(R_size_t size_needed)
 	vcells = 0.1*ceil(10*vcells * vsfac/Mega);
 	REprintf("%.1f Mbytes of vectors used (%d%%)\n",
 		 vcells, (int) (vfrac + 0.5));
+#ifdef VECTOR_ARENAS
+	REprintf("%.1f Mbytes of vector arenas (%d%% in use)\n",
+		 0.1*ceil(10.0*R_ArenaBytes/Mega),
+		 R_ArenaBytes > 0 ?
+		 (int) (100.0 * R_ArenaBytesUsed / R_ArenaBytes + 0.5) : 0);
+#endif
+	REprintf("Pause %.1f ms: aging %.1f, marking %.1f (%d %s), "
+		 "weak references %.1f, sweeping %.1f\n",
+		 1e3 * (gc_phase_times[0] + gc_phase_times[1] +
+			gc_phase_times[2] + gc_phase_times[3]),
+		 1e3 * gc_phase_times[0], 1e3 * gc_phase_times[1],
+		 gc_mark_threads, gc_mark_threads > 1 ? "threads" : "thread",
+		 1e3 * gc_phase_times[2], 1e3 * gc_phase_times[3]);
     }
 
 #ifdef IMMEDIATE_FINALIZERS
@@ -3658,18 +4795,6 @@ attribute_hidden
 void (SET_HASHVALUE)(SEXP x, int v) { SET_HASHVALUE(CHK(x), v); }
 #endif
 
-attribute_hidden
-SEXP (SET_CXTAIL)(SEXP x, SEXP v) {
-#ifdef USE_TYPE_CHECKING
-    if(TYPEOF(v) != CHARSXP && TYPEOF(v) != NILSXP)
-	error("value of 'SET_CXTAIL' must be a char or NULL, not a '%s'",
-	      type2char(TYPEOF(v)));
-#endif
-    /*CHECK_OLD_TO_NEW(x, v); *//* not needed since not properly traced */
-    ATTRIB(x) = v;
-    return x;
-}
-
 /* Test functions */
 Rboolean Rf_isNull(SEXP s) { return isNull(s); }
 Rboolean Rf_isSymbol(SEXP s) { return isSymbol(s); }
@@ -3746,6 +4871,11 @@ SEXP NORET do_Rprofmem(SEXP args)
     error(_("memory profiling is not available on this system"));
 }
 
+SEXP NORET do_Rprofheap(SEXP args)
+{
+    error(_("memory profiling is not available on this system"));
+}
+
 #else
 static int R_IsMemReporting;  /* Rboolean more appropriate? */
 static FILE *R_MemReportingOutfile;
@@ -3831,6 +4961,428 @@ SEXP do_Rprofmem(SEXP args)
     return R_NilValue;
 }
 
+/*******************************************/
+/* Sampling heap profiler: reports the     */
+/* objects allocated, in use and freed by  */
+/* R call stack                            */
+/*******************************************/
+
+/* An allocation is sampled when it takes the count of bytes allocated
+   past an exponentially distributed gap with mean R_HeapInterval, so
+   that one of b bytes is sampled with probability 1 - exp(-b /
+   R_HeapInterval), and then stands for the 1 / (1 - exp(-b /
+   R_HeapInterval)) objects of its size this implies.  The sampled
+   objects are kept in a table until the collector finds them
+   unmarked.  The counts of objects in use are those of the last full
+   collection. */
+
+#include <zlib.h>
+
+#define HEAP_PROFILE_MAX_DEPTH 100
+#define HEAP_STACK_BUCKETS 4096
+
+typedef struct heap_stack {
+    struct heap_stack *next;	/* in its hash bucket */
+    unsigned int hash;
+    int depth;
+    double alloc_objects, alloc_bytes;
+    double live_objects, live_bytes;	/* sampled objects not yet freed */
+    double inuse_objects, inuse_bytes;	/* as of the last full collection */
+    double freed_objects, freed_bytes;
+    const char *frames[];	/* innermost first */
+} heap_stack;
+
+typedef struct {
+    SEXP s;
+    heap_stack *stack;
+    double objects, bytes;
+} heap_sample;
+
+static R_size_t R_HeapInterval;
+static double R_HeapProfileStart;
+static SEXP R_HeapProfileFile = NULL;
+static heap_stack *R_HeapStacks[HEAP_STACK_BUCKETS];
+static int R_HeapNStacks = 0;
+static heap_sample *R_HeapSamples = NULL;
+static int R_HeapSamplesSize = 0;
+static uint64_t heap_rand_state;
+
+static const char *anonymous_frame = "<Anonymous>";
+
+/* The gaps between samples are drawn by a generator of our own, as
+   the streams of R's generators belong to the user. */
+static double HeapSampleGap(void)
+{
+    double u;
+    heap_rand_state ^= heap_rand_state >> 12;
+    heap_rand_state ^= heap_rand_state << 25;
+    heap_rand_state ^= heap_rand_state >> 27;
+    u = ((heap_rand_state * 2685821657736338717ULL) >> 11) *
+	(1.0 / 9007199254740992.0);
+    return -log1p(-u) * R_HeapInterval;
+}
+
+static heap_stack *HeapStack(void)
+{
+    const char *frames[HEAP_PROFILE_MAX_DEPTH];
+    unsigned int hash = 0;
+    int depth = 0;
+    heap_stack *stack;
+
+    for (RCNTXT *cptr = R_GlobalContext;
+	 cptr != NULL && depth < HEAP_PROFILE_MAX_DEPTH;
+	 cptr = cptr->nextcontext)
+	if ((cptr->callflag & (CTXT_FUNCTION | CTXT_BUILTIN))
+	    && TYPEOF(cptr->call) == LANGSXP) {
+	    SEXP fun = CAR(cptr->call);
+	    /* the names of symbols are never collected */
+	    const char *name = TYPEOF(fun) == SYMSXP ?
+		CHAR(PRINTNAME(fun)) : anonymous_frame;
+	    frames[depth++] = name;
+	    hash = hash * 31 + (unsigned int) ((uintptr_t) name >> 3);
+	}
+    for (stack = R_HeapStacks[hash % HEAP_STACK_BUCKETS]; stack != NULL;
+	 stack = stack->next)
+	if (stack->hash == hash && stack->depth == depth &&
+	    memcmp(stack->frames, frames, depth * sizeof(char *)) == 0)
+	    return stack;
+    stack = calloc(1, sizeof(heap_stack) + depth * sizeof(char *));
+    if (stack == NULL)
+	return NULL;
+    stack->hash = hash;
+    stack->depth = depth;
+    memcpy(stack->frames, frames, depth * sizeof(char *));
+    stack->next = R_HeapStacks[hash % HEAP_STACK_BUCKETS];
+    R_HeapStacks[hash % HEAP_STACK_BUCKETS] = stack;
+    R_HeapNStacks++;
+    return stack;
+}
+
+static void R_HeapSample(SEXP s, R_size_t bytes)
+{
+    heap_stack *stack;
+    double w;
+
+    if (! R_HeapProfiling) {
+	R_HeapSampleCountdown = R_XLEN_T_MAX;
+	return;
+    }
+    R_HeapSampleCountdown = (R_xlen_t) HeapSampleGap();
+    if (R_HeapNSamples == R_HeapSamplesSize) {
+	int n = R_HeapSamplesSize ? 2 * R_HeapSamplesSize : 1024;
+	heap_sample *samples = realloc(R_HeapSamples, n * sizeof(heap_sample));
+	if (samples == NULL)
+	    return;
+	R_HeapSamples = samples;
+	R_HeapSamplesSize = n;
+    }
+    if ((stack = HeapStack()) == NULL)
+	return;
+    w = 1 / -expm1(-(double) bytes / R_HeapInterval);
+    stack->alloc_objects += w;
+    stack->alloc_bytes += w * bytes;
+    stack->live_objects += w;
+    stack->live_bytes += w * bytes;
+    R_HeapSamples[R_HeapNSamples].s = s;
+    R_HeapSamples[R_HeapNSamples].stack = stack;
+    R_HeapSamples[R_HeapNSamples].objects = w;
+    R_HeapSamples[R_HeapNSamples].bytes = w * bytes;
+    R_HeapNSamples++;
+}
+
+/* Called by the collector when marking is done: the sampled objects
+   left unmarked are about to be freed. */
+static void R_HeapProfileCollect(Rboolean full)
+{
+    int i, j;
+
+    for (i = 0, j = 0; i < R_HeapNSamples; i++) {
+	heap_sample *sample = R_HeapSamples + i;
+	if (NODE_IS_MARKED(sample->s))
+	    R_HeapSamples[j++] = *sample;
+	else {
+	    heap_stack *stack = sample->stack;
+	    stack->live_objects -= sample->objects;
+	    stack->live_bytes -= sample->bytes;
+	    stack->freed_objects += sample->objects;
+	    stack->freed_bytes += sample->bytes;
+	}
+    }
+    R_HeapNSamples = j;
+    if (full)
+	for (i = 0; i < HEAP_STACK_BUCKETS; i++)
+	    for (heap_stack *stack = R_HeapStacks[i]; stack != NULL;
+		 stack = stack->next) {
+		stack->inuse_objects = stack->live_objects;
+		stack->inuse_bytes = stack->live_bytes;
+	    }
+}
+
+static void R_EndHeapProfiling(void)
+{
+    for (int i = 0; i < HEAP_STACK_BUCKETS; i++) {
+	heap_stack *stack = R_HeapStacks[i];
+	while (stack != NULL) {
+	    heap_stack *next = stack->next;
+	    free(stack);
+	    stack = next;
+	}
+	R_HeapStacks[i] = NULL;
+    }
+    free(R_HeapSamples);
+    R_HeapSamples = NULL;
+    R_HeapNSamples = R_HeapSamplesSize = R_HeapNStacks = 0;
+    R_HeapProfiling = FALSE;
+    R_HeapSampleCountdown = R_XLEN_T_MAX;
+    if (R_HeapProfileFile != NULL) {
+	R_ReleaseObject(R_HeapProfileFile);
+	R_HeapProfileFile = NULL;
+    }
+}
+
+/* The profile is written as a gzipped protocol buffer in the format
+   of pprof (https://github.com/google/pprof, proto/profile.proto). */
+
+typedef struct {
+    unsigned char *data;
+    size_t len, size;
+    Rboolean failed;
+} pb_buf;
+
+static void pb_bytes(pb_buf *b, const void *data, size_t len)
+{
+    if (b->failed)
+	return;
+    if (b->len + len > b->size) {
+	size_t size = b->size ? b->size : 4096;
+	while (size < b->len + len) size *= 2;
+	unsigned char *p = realloc(b->data, size);
+	if (p == NULL) {
+	    b->failed = TRUE;
+	    return;
+	}
+	b->data = p;
+	b->size = size;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void pb_varint(pb_buf *b, uint64_t v)
+{
+    unsigned char buf[10];
+    int n = 0;
+    while (v >= 0x80) {
+	buf[n++] = (unsigned char) (v | 0x80);
+	v >>= 7;
+    }
+    buf[n++] = (unsigned char) v;
+    pb_bytes(b, buf, n);
+}
+
+static void pb_int(pb_buf *b, int field, uint64_t v)
+{
+    if (v != 0) {
+	pb_varint(b, (uint64_t) field << 3);
+	pb_varint(b, v);
+    }
+}
+
+static void pb_string(pb_buf *b, int field, const void *data, size_t len)
+{
+    pb_varint(b, ((uint64_t) field << 3) | 2);
+    pb_varint(b, len);
+    pb_bytes(b, data, len);
+}
+
+/* append a message and empty its buffer */
+static void pb_message(pb_buf *b, int field, pb_buf *msg)
+{
+    pb_string(b, field, msg->data, msg->len);
+    b->failed |= msg->failed;
+    msg->len = 0;
+}
+
+/* the fixed strings of the profile */
+static const char *heap_profile_strings[] = {
+    "", "alloc_objects", "count", "alloc_space", "bytes", "inuse_objects",
+    "inuse_space", "freed_objects", "freed_space", "space"
+};
+#define HEAP_NFIXED_STRINGS 10
+
+static size_t HeapNameSlot(const char **table, size_t tsize,
+			  const char *name)
+{
+    size_t h = ((uintptr_t) name >> 3) & (tsize - 1);
+    while (table[h] != NULL && table[h] != name)
+	h = (h + 1) & (tsize - 1);
+    return h;
+}
+
+static uint64_t HeapCount(double x)
+{
+    return x > 0 ? (uint64_t) (x + 0.5) : 0;
+}
+
+/* returns FALSE if the profile could not be written */
+static Rboolean WriteHeapProfile(SEXP filename)
+{
+    pb_buf prof = { NULL, 0, 0, FALSE }, msg = prof, sub = prof;
+    const char **table, **names;
+    int *index, nnames = 0, i, k;
+    size_t nframes = 0, tsize = 64, len;
+    const char *fn = R_ExpandFileName(translateChar(filename));
+    heap_stack *stack;
+    gzFile f;
+
+    if ((f = gzopen(fn, "wb")) == NULL)
+	return FALSE;
+
+    /* number the functions by their names, which are found in a table
+       open-addressed by the addresses of the strings */
+    for (i = 0; i < HEAP_STACK_BUCKETS; i++)
+	for (stack = R_HeapStacks[i]; stack != NULL; stack = stack->next)
+	    nframes += stack->depth;
+    while (tsize < 2 * nframes) tsize *= 2;
+    table = (const char **) R_alloc(tsize, sizeof(char *));
+    index = (int *) R_alloc(tsize, sizeof(int));
+    names = (const char **) R_alloc(nframes + 1, sizeof(char *));
+    memset(table, 0, tsize * sizeof(char *));
+    for (i = 0; i < HEAP_STACK_BUCKETS; i++)
+	for (stack = R_HeapStacks[i]; stack != NULL; stack = stack->next)
+	    for (k = 0; k < stack->depth; k++) {
+		size_t h = HeapNameSlot(table, tsize, stack->frames[k]);
+		if (table[h] == NULL) {
+		    table[h] = names[nnames] = stack->frames[k];
+		    index[h] = nnames++;
+		}
+	    }
+
+    /* the sample types, as indices of their names and units in the
+       string table */
+    for (i = 0; i < 6; i++) {
+	static const int types[6][2] =
+	    { {1, 2}, {3, 4}, {5, 2}, {6, 4}, {7, 2}, {8, 4} };
+	pb_int(&msg, 1, types[i][0]);
+	pb_int(&msg, 2, types[i][1]);
+	pb_message(&prof, 1, &msg);
+    }
+
+    /* the samples, one for each stack */
+    for (i = 0; i < HEAP_STACK_BUCKETS; i++)
+	for (stack = R_HeapStacks[i]; stack != NULL; stack = stack->next) {
+	    for (k = 0; k < stack->depth; k++)
+		pb_varint(&sub, index[HeapNameSlot(table, tsize,
+						    stack->frames[k])] + 1);
+	    pb_message(&msg, 1, &sub);
+	    pb_varint(&sub, HeapCount(stack->alloc_objects));
+	    pb_varint(&sub, HeapCount(stack->alloc_bytes));
+	    pb_varint(&sub, HeapCount(stack->inuse_objects));
+	    pb_varint(&sub, HeapCount(stack->inuse_bytes));
+	    pb_varint(&sub, HeapCount(stack->freed_objects));
+	    pb_varint(&sub, HeapCount(stack->freed_bytes));
+	    pb_message(&msg, 2, &sub);
+	    pb_message(&prof, 2, &msg);
+	}
+
+    /* a location and a function for each name */
+    for (k = 0; k < nnames; k++) {
+	pb_int(&msg, 1, k + 1);
+	pb_int(&sub, 1, k + 1);
+	pb_message(&msg, 4, &sub);
+	pb_message(&prof, 4, &msg);
+	pb_int(&msg, 1, k + 1);
+	pb_int(&msg, 2, HEAP_NFIXED_STRINGS + k);
+	pb_int(&msg, 3, HEAP_NFIXED_STRINGS + k);
+	pb_message(&prof, 5, &msg);
+    }
+
+    for (k = 0; k < HEAP_NFIXED_STRINGS; k++)
+	pb_string(&prof, 6, heap_profile_strings[k],
+		  strlen(heap_profile_strings[k]));
+    for (k = 0; k < nnames; k++)
+	pb_string(&prof, 6, names[k], strlen(names[k]));
+    pb_int(&prof, 9, (uint64_t) (R_HeapProfileStart * 1e9));
+    pb_int(&prof, 10, (uint64_t) ((currentTime() - R_HeapProfileStart) * 1e9));
+    pb_int(&msg, 1, 9);
+    pb_int(&msg, 2, 4);
+    pb_message(&prof, 11, &msg);
+    pb_int(&prof, 12, R_HeapInterval);
+    pb_int(&prof, 14, 6); /* inuse_space */
+
+    free(msg.data);
+    free(sub.data);
+    len = 0;
+    if (! prof.failed)
+	while (len < prof.len) {
+	    unsigned int n = prof.len - len > 1048576 ?
+		1048576 : (unsigned int) (prof.len - len);
+	    if (gzwrite(f, prof.data + len, n) != (int) n)
+		break;
+	    len += n;
+	}
+    free(prof.data);
+    return gzclose(f) == Z_OK && len == prof.len && ! prof.failed;
+}
+
+static void R_InitHeapProfiling(SEXP filename, R_size_t interval)
+{
+    const char *fn = R_ExpandFileName(translateChar(filename));
+    gzFile f = gzopen(fn, "wb");
+
+    if (f == NULL)
+	error(_("Rprofheap: cannot open output file '%s'"), fn);
+    gzclose(f);
+    R_HeapProfileFile = filename;
+    R_PreserveObject(filename);
+    R_HeapInterval = interval;
+    R_HeapProfileStart = currentTime();
+    heap_rand_state = (uint64_t) (R_HeapProfileStart * 1e6) ^
+	((uint64_t) (uintptr_t) &interval << 16) ^ 0x9E3779B97F4A7C15ULL;
+    R_HeapProfiling = TRUE;
+    R_HeapSampleCountdown = (R_xlen_t) HeapSampleGap();
+}
+
+SEXP do_Rprofheap(SEXP args)
+{
+    SEXP filename;
+    double interval;
+    int snapshot;
+
+    if (!isString(CAR(args)) || (LENGTH(CAR(args))) != 1)
+	error(_("invalid '%s' argument"), "filename");
+    filename = STRING_ELT(CAR(args), 0);
+    interval = asReal(CADR(args));
+    snapshot = asLogical(CADDR(args));
+    if (snapshot == TRUE && ! R_HeapProfiling)
+	error(_("heap profiling is not in progress"));
+    if (strlen(CHAR(filename)) &&
+	(! R_FINITE(interval) || interval < 1 || interval > 1e15))
+	error(_("invalid '%s' argument"), "interval");
+    if (R_HeapProfiling) {
+	SEXP file = snapshot == TRUE && strlen(CHAR(filename)) ?
+	    filename : R_HeapProfileFile;
+	Rboolean written;
+
+	/* a full collection brings the counts of objects in use up to date */
+	num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+	R_gc();
+	PROTECT(file);
+	written = WriteHeapProfile(file);
+	if (snapshot != TRUE)
+	    R_EndHeapProfiling();
+	if (! written)
+	    error(_("Rprofheap: cannot write profile to '%s'"),
+		  translateChar(file));
+	UNPROTECT(1);
+	if (snapshot == TRUE)
+	    return R_NilValue;
+    }
+    if (strlen(CHAR(filename)))
+	R_InitHeapProfiling(filename, (R_size_t) interval);
+    return R_NilValue;
+}
+
 #endif /* R_MEMORY_PROFILING */
 
 /* RBufferUtils, moved from deparse.c */
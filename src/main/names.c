@@ -669,7 +669,7 @@ FUNTAB R_FunTab[] =
 {"load",	do_load,	0,	111,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"loadFromConn2",do_loadFromConn2,0,	111,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"serializeToConn",	do_serializeToConn,	0,	111,	5,	{PP_FUNCALL, PREC_FN,	0}},
-{"unserializeFromConn",	do_unserializeFromConn,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"unserializeFromConn",	do_unserializeFromConn,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"deparse",	do_deparse,	0,	11,	5,	{PP_FUNCALL, PREC_FN,	0}},
 {"dput",	do_dput,	0,	111,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"dump",	do_dump,	0,	111,	5,	{PP_FUNCALL, PREC_FN,	0}},
@@ -683,6 +683,8 @@ FUNTAB R_FunTab[] =
 {"gctorture",	do_gctorture,	0,	111,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"gctorture2",	do_gctorture2,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"memory.profile",do_memoryprofile, 0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
+{"stringCacheInfo",do_stringcacheinfo, 0, 11,	0,	{PP_FUNCALL, PREC_FN,	0}},
+{"dispatchCacheInfo",do_dispatchcacheinfo, 0, 11, 0,	{PP_FUNCALL, PREC_FN,	0}},
 {"split",	do_split,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"is.loaded",	do_isloaded,	0,	11,	-1,	{PP_FOREIGN, PREC_FN,	0}},
 {"recordGraphics", do_recordGraphics, 0, 211,     3,      {PP_FOREIGN, PREC_FN,	0}},
@@ -751,6 +753,7 @@ FUNTAB R_FunTab[] =
 {"topenv",	do_topenv,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"l10n_info",	do_l10n_info,	0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
 {"Cstack_info", do_Cstack_info,	0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
+{"symtab_info", do_symtab_info,	0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
 
 /* Functions To Interact with the Operating System */
 
@@ -1138,12 +1141,110 @@ SEXP attribute_hidden installDDVAL(int n) {
 }
 
 
+/* The symbol table is open addressed with linear probing.  Symbols
+   are never removed, so a NULL slot ends a probe sequence.  The hash
+   of the print name of each symbol is kept in a parallel array, so a
+   probe only looks at a symbol when the hashes are equal, and the
+   table can be enlarged without looking at the symbols at all.  The
+   table size is a power of 2, and is doubled when the table would be
+   more than half full.  The hash codes are those of R_Newhashpjw,
+   which are also used for environments and are kept in the print
+   names, and are mixed by a multiplication to choose the slot. */
+
+static unsigned int *R_SymbolHashes;
+static int R_SymbolCount = 0;
+static int SymbolTableShift;
+
+#define SYMBOL_HOME(h) (((unsigned int) (h) * 2654435769U) >> SymbolTableShift)
+
+static void AllocSymbolTable(int size, SEXP **ptable, unsigned int **phashes)
+{
+    *ptable = (SEXP *) calloc(size, sizeof(SEXP));
+    *phashes = (unsigned int *) calloc(size, sizeof(unsigned int));
+    if (*ptable == NULL || *phashes == NULL) {
+	free(*ptable);
+	free(*phashes);
+	*ptable = NULL;
+	*phashes = NULL;
+    }
+}
+
+/* make room for at least n symbols */
+static void ReserveSymbolTable(R_xlen_t n)
+{
+    int size = R_SymbolTableSize, shift = SymbolTableShift;
+    if (n > INT_MAX / 2)
+	error(_("too many symbols"));
+    while (2 * n > size) {
+	size *= 2;
+	shift--;
+    }
+    if (size == R_SymbolTableSize)
+	return;
+
+    SEXP *table;
+    unsigned int *hashes;
+    AllocSymbolTable(size, &table, &hashes);
+    if (table == NULL)
+	error(_("couldn't allocate memory for symbol table"));
+    SymbolTableShift = shift;
+    for (int i = 0; i < R_SymbolTableSize; i++)
+	if (R_SymbolTable[i] != NULL) {
+	    unsigned int h = R_SymbolHashes[i];
+	    int j = SYMBOL_HOME(h);
+	    while (table[j] != NULL)
+		j = (j + 1) & (size - 1);
+	    table[j] = R_SymbolTable[i];
+	    hashes[j] = h;
+	}
+    free(R_SymbolTable);
+    free(R_SymbolHashes);
+    R_SymbolTable = table;
+    R_SymbolHashes = hashes;
+    R_SymbolTableSize = size;
+}
+
+/* The symbol with print name 'name' and hash 'h', or NULL.  If
+   'charSXP' is not NULL it is the CHARSXP of the name, and if it is
+   the print name of the symbol the names need not be compared. */
+static R_INLINE SEXP LookupSymbol(const char *name, SEXP charSXP,
+				  unsigned int h)
+{
+    int mask = R_SymbolTableSize - 1;
+    for (int i = SYMBOL_HOME(h); R_SymbolTable[i] != NULL;
+	 i = (i + 1) & mask) {
+	if (R_SymbolHashes[i] == h) {
+	    SEXP sym = R_SymbolTable[i];
+	    if (PRINTNAME(sym) == charSXP ||
+		strcmp(name, CHAR(PRINTNAME(sym))) == 0)
+		return sym;
+	}
+    }
+    return NULL;
+}
+
+static void EnterSymbol(SEXP sym, unsigned int h)
+{
+    ReserveSymbolTable((R_xlen_t) R_SymbolCount + 1);
+    int i = SYMBOL_HOME(h);
+    while (R_SymbolTable[i] != NULL)
+	i = (i + 1) & (R_SymbolTableSize - 1);
+    R_SymbolTable[i] = sym;
+    R_SymbolHashes[i] = h;
+    R_SymbolCount++;
+}
+
 /* initialize the symbol table */
 void attribute_hidden InitNames()
 {
     /* allocate the symbol table */
-    if (!(R_SymbolTable = (SEXP *) calloc(HSIZE, sizeof(SEXP))))
+    AllocSymbolTable(HSIZE, &R_SymbolTable, &R_SymbolHashes);
+    if (R_SymbolTable == NULL)
 	R_Suicide("couldn't allocate memory for symbol table");
+    R_SymbolTableSize = HSIZE;
+    SymbolTableShift = 32;
+    for (int size = HSIZE; size > 1; size /= 2)
+	SymbolTableShift--;
 
     /* R_UnboundValue */
     R_UnboundValue = allocSExp(SYMSXP);
@@ -1173,9 +1274,6 @@ void attribute_hidden InitNames()
     R_BlankScalarString = ScalarString(R_BlankString);
     MARK_NOT_MUTABLE(R_BlankScalarString);
 
-    /* Initialize the symbol Table */
-    for (int i = 0; i < HSIZE; i++) R_SymbolTable[i] = R_NilValue;
-
     /* Set up a set of globals so that a symbol table search can be
        avoided when matching something like dim or dimnames. */
     SymbolShortcuts();
@@ -1200,13 +1298,12 @@ void attribute_hidden InitNames()
 SEXP install(const char *name)
 {
     SEXP sym;
-    int i, hashcode;
+    int hashcode;
 
     hashcode = R_Newhashpjw(name);
-    i = hashcode % HSIZE;
     /* Check to see if the symbol is already present;  if it is, return it. */
-    for (sym = R_SymbolTable[i]; sym != R_NilValue; sym = CDR(sym))
-	if (strcmp(name, CHAR(PRINTNAME(CAR(sym)))) == 0) return (CAR(sym));
+    if ((sym = LookupSymbol(name, NULL, hashcode)) != NULL)
+	return sym;
     /* Create a new symbol node and link it into the table. */
     if (*name == '\0')
 	error(_("attempt to use zero-length variable name"));
@@ -1216,26 +1313,28 @@ SEXP install(const char *name)
     SET_HASHVALUE(PRINTNAME(sym), hashcode);
     SET_HASHASH(PRINTNAME(sym), 1);
 
-    R_SymbolTable[i] = CONS(sym, R_SymbolTable[i]);
+    EnterSymbol(sym, hashcode);
     return (sym);
 }
 
-SEXP installChar(SEXP charSXP)
+/* the hash code of a symbol with print name 'charSXP', kept in it */
+static R_INLINE int SymbolHash(SEXP charSXP)
 {
-    SEXP sym;
-    int i, hashcode;
-
     if( !HASHASH(charSXP) ) {
-	hashcode = R_Newhashpjw(CHAR(charSXP));
-	SET_HASHVALUE(charSXP, hashcode);
+	SET_HASHVALUE(charSXP, R_Newhashpjw(CHAR(charSXP)));
 	SET_HASHASH(charSXP, 1);
-    } else {
-	hashcode = HASHVALUE(charSXP);
     }
-    i = hashcode % HSIZE;
+    return HASHVALUE(charSXP);
+}
+
+SEXP installChar(SEXP charSXP)
+{
+    SEXP sym;
+    int hashcode = SymbolHash(charSXP);
+
     /* Check to see if the symbol is already present;  if it is, return it. */
-    for (sym = R_SymbolTable[i]; sym != R_NilValue; sym = CDR(sym))
-	if (strcmp(CHAR(charSXP), CHAR(PRINTNAME(CAR(sym)))) == 0) return (CAR(sym));
+    if ((sym = LookupSymbol(CHAR(charSXP), charSXP, hashcode)) != NULL)
+	return sym;
     /* Create a new symbol node and link it into the table. */
     int len = LENGTH(charSXP);
     if (len == 0)
@@ -1256,10 +1355,63 @@ SEXP installChar(SEXP charSXP)
 	UNPROTECT(1);
     }
 
-    R_SymbolTable[i] = CONS(sym, R_SymbolTable[i]);
+    EnterSymbol(sym, hashcode);
     return (sym);
 }
 
+/* Install the elements of the character vector 'names', as by
+   installTrChar, storing the symbols in 'syms'.  Symbols are never
+   collected, so 'syms' need not be protected. */
+void installN(SEXP names, SEXP *syms)
+{
+    R_xlen_t n = XLENGTH(names), nnew = 0;
+
+    /* Look up the ASCII names first, so that the table is only
+       enlarged for those that are new.  Others need translating. */
+    for (R_xlen_t i = 0; i < n; i++) {
+	SEXP c = STRING_ELT(names, i);
+	if (! IS_ASCII(c))
+	    syms[i] = installTrChar(c);
+	else if ((syms[i] = LookupSymbol(CHAR(c), c, SymbolHash(c))) == NULL)
+	    nnew++;
+    }
+    ReserveSymbolTable((R_xlen_t) R_SymbolCount + nnew);
+    for (R_xlen_t i = 0; i < n; i++)
+	if (syms[i] == NULL)
+	    syms[i] = installChar(STRING_ELT(names, i));
+}
+
+/* .Internal(symtab_info()): the size of the symbol table, the number
+   of symbols and the longest and mean number of probes to find one */
+SEXP attribute_hidden do_symtab_info(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    SEXP ans, nms;
+    int mask = R_SymbolTableSize - 1, maxprobe = 0;
+    double probes = 0;
+
+    checkArity(op, args);
+    for (int i = 0; i < R_SymbolTableSize; i++)
+	if (R_SymbolTable[i] != NULL) {
+	    int np = ((i - (int) SYMBOL_HOME(R_SymbolHashes[i])) & mask) + 1;
+	    probes += np;
+	    if (np > maxprobe) maxprobe = np;
+	}
+    PROTECT(ans = allocVector(REALSXP, 4));
+    PROTECT(nms = allocVector(STRSXP, 4));
+    REAL(ans)[0] = R_SymbolTableSize;
+    REAL(ans)[1] = R_SymbolCount;
+    REAL(ans)[2] = maxprobe;
+    REAL(ans)[3] = R_SymbolCount > 0 ? probes / R_SymbolCount : 0;
+    SET_STRING_ELT(nms, 0, mkChar("size"));
+    SET_STRING_ELT(nms, 1, mkChar("symbols"));
+    SET_STRING_ELT(nms, 2, mkChar("max_probes"));
+    SET_STRING_ELT(nms, 3, mkChar("mean_probes"));
+
+    UNPROTECT(2);
+    setAttrib(ans, R_NamesSymbol, nms);
+    return ans;
+}
+
 #define maxLength 512
 attribute_hidden
 SEXP installS3Signature(const char *className, const char *methodName) {
@@ -310,6 +310,8 @@ SEXP dispatchMethod(SEXP op, SEXP sxp, SEXP dotClass, RCNTXT *cptr, SEXP method,
 	int matched;
 
 	for (s = FRAME(cptr->cloenv); s != R_NilValue; s = CDR(s)) {
+	    if (CAR(s) == R_UnboundValue) /* unassigned compiled local */
+		continue;
 	    matched = 0;
 	    for (t = formals; t != R_NilValue; t = CDR(t))
 		if (TAG(t) == TAG(s)) {
@@ -339,11 +341,243 @@ SEXP dispatchMethod(SEXP op, SEXP sxp, SEXP dotClass, RCNTXT *cptr, SEXP method,
     return ans;
 }
 
+/* S3 dispatch cache.
+
+   usemethod() remembers the method it found for a generic, class
+   vector, call environment and definition environment.  The search
+   from the call environment up to the first global frame, namespace
+   or already marked environment (usually through function frames) is
+   not cached: on a hit the candidate names are looked for in those
+   frames directly.  The environments from there to the empty
+   environment, the definition environment and its table of
+   registered methods are marked, and any change to a binding whose
+   name contains a dot (as every method name does) in a global frame
+   or a marked environment bumps 'S3Epoch', invalidating all entries,
+   if the old or the new value may be a function.
+   As the value of an active binding can change at any time, creating
+   one with such a name in a searched environment turns the cache off.
+*/
+
+#define S3_CACHE_SIZE 1024
+#define S3_CACHE_MAXCLASS 16
+
+static SEXP S3Cache = NULL;
+static double S3Epoch = 0, S3CacheHits = 0, S3CacheMisses = 0;
+static Rboolean S3CacheOff = FALSE;
+
+void attribute_hidden R_S3MethodChanged(SEXP sym)
+{
+    if (strchr(CHAR(PRINTNAME(sym)), '.')) S3Epoch++;
+}
+
+void attribute_hidden R_S3ActiveBinding(SEXP sym, SEXP env)
+{
+    if (strchr(CHAR(PRINTNAME(sym)), '.') &&
+	(env == R_BaseEnv || env == R_BaseNamespace || env == R_GlobalEnv ||
+	 IS_S3_LOOKUP_FRAME(env) || R_IsNamespaceEnv(env)))
+	S3CacheOff = TRUE;
+    R_S3MethodChanged(sym);
+}
+
+void attribute_hidden R_S3FlushCache(void)
+{
+    S3Epoch++;
+}
+
+/* the first environment from 'rho' whose bindings the cache tracks */
+static SEXP S3CacheEnv(SEXP rho)
+{
+    for ( ; rho != R_EmptyEnv; rho = ENCLOS(rho))
+	if (rho == R_GlobalEnv || rho == R_BaseEnv || IS_S3_LOOKUP_FRAME(rho) ||
+	    R_IsNamespaceEnv(rho))
+	    break;
+    return rho;
+}
+
+static int S3CacheIndex(const char *generic, SEXP klass, SEXP top,
+			SEXP defrho)
+{
+    uintptr_t h = 5381;
+    for (const unsigned char *p = (const unsigned char *) generic; *p; p++)
+	h = h * 33 + *p;
+    for (int i = 0; i < LENGTH(klass); i++)
+	h = h * 31 + ((uintptr_t) STRING_ELT(klass, i) >> 4);
+    h = h * 31 + ((uintptr_t) top >> 4);
+    h = h * 31 + ((uintptr_t) defrho >> 4);
+    h ^= h >> 17;
+    return (int)(h % S3_CACHE_SIZE);
+}
+
+/* is any of 'syms' bound in the frames from 'callrho' up to 'top'? */
+static Rboolean S3BoundBelow(SEXP syms, SEXP callrho, SEXP top)
+{
+    for (SEXP rho = callrho; rho != top; rho = ENCLOS(rho))
+	for (int i = 0; i < LENGTH(syms); i++)
+	    if (!R_VARLOC_IS_NULL(R_findVarLocInFrame(rho, VECTOR_ELT(syms, i))))
+		return TRUE;
+    return FALSE;
+}
+
+/* Entries are lists of the generic (a CHARSXP), class vector, top and
+   definition environments, candidate method names (which are also
+   those to look for in the uncached frames), method found and
+   c(epoch, index of the class matched, or nclass for the default
+   method and -1 for none) */
+static SEXP S3CacheGet(int h, const char *generic, SEXP klass, SEXP callrho,
+		       SEXP top, SEXP defrho)
+{
+    SEXP entry = VECTOR_ELT(S3Cache, h), k;
+    int i, n;
+
+    if (entry == R_NilValue || REAL(VECTOR_ELT(entry, 6))[0] != S3Epoch ||
+	VECTOR_ELT(entry, 2) != top || VECTOR_ELT(entry, 3) != defrho)
+	return R_NilValue;
+    k = VECTOR_ELT(entry, 1);
+    n = LENGTH(klass);
+    if (LENGTH(k) != n) return R_NilValue;
+    for (i = 0; i < n; i++)
+	if (STRING_ELT(k, i) != STRING_ELT(klass, i)) return R_NilValue;
+    if (strcmp(CHAR(VECTOR_ELT(entry, 0)), generic)) return R_NilValue;
+    if (S3BoundBelow(VECTOR_ELT(entry, 4), callrho, top)) return R_NilValue;
+    return entry;
+}
+
+/* Mark the environments an entry will rely on, before the lookup so
+   that changes made while it is done are seen.  Returns FALSE if the
+   result cannot be cached. */
+static Rboolean S3CacheMark(SEXP top, SEXP defrho)
+{
+    static SEXP s_S3MethodsTable = NULL;
+    SEXP rho, table;
+
+    for (rho = top; rho != R_EmptyEnv; rho = ENCLOS(rho))
+	if (OBJECT(rho) && inherits(rho, "UserDefinedDatabase"))
+	    return FALSE; /* can change behind our back */
+    for (rho = top; rho != R_EmptyEnv; rho = ENCLOS(rho))
+	MARK_AS_S3_LOOKUP_FRAME(rho);
+    if (defrho == R_BaseEnv) defrho = R_BaseNamespace;
+    MARK_AS_S3_LOOKUP_FRAME(defrho);
+    if (!s_S3MethodsTable)
+	s_S3MethodsTable = install(".__S3MethodsTable__.");
+    table = findVarInFrame3(defrho, s_S3MethodsTable, TRUE);
+    if (TYPEOF(table) == PROMSXP) {
+	PROTECT(table);
+	table = eval(table, R_BaseEnv);
+	UNPROTECT(1);
+    }
+    if (TYPEOF(table) == ENVSXP) MARK_AS_S3_LOOKUP_FRAME(table);
+    return TRUE;
+}
+
+static void S3CachePut(int h, const char *generic, SEXP klass, SEXP top,
+		       SEXP defrho, SEXP syms, SEXP sxp, int index,
+		       double epoch)
+{
+    SEXP entry, info;
+
+    PROTECT(entry = allocVector(VECSXP, 7));
+    SET_VECTOR_ELT(entry, 0, mkChar(generic));
+    SET_VECTOR_ELT(entry, 1, duplicate(klass));
+    SET_VECTOR_ELT(entry, 2, top);
+    SET_VECTOR_ELT(entry, 3, defrho);
+    SET_VECTOR_ELT(entry, 4, syms);
+    SET_VECTOR_ELT(entry, 5, sxp);
+    info = allocVector(REALSXP, 2);
+    SET_VECTOR_ELT(entry, 6, info);
+    REAL(info)[0] = epoch;
+    REAL(info)[1] = index;
+    SET_VECTOR_ELT(S3Cache, h, entry);
+    UNPROTECT(1);
+}
+
+/* Find the method for 'generic' and the classes in 'klass': returns
+   the index of the class it is for, nclass for the default method or
+   -1 if there is none, setting *method and *sxp. */
+static int lookupS3Method(const char *generic, SEXP klass, SEXP rho,
+			  SEXP callrho, SEXP defrho, SEXP *method, SEXP *sxp)
+{
+    SEXP syms, top = R_NilValue, entry;
+    int i, h = 0, nclass = length(klass);
+    double epoch = S3Epoch;
+    Rboolean cache = !S3CacheOff && nclass <= S3_CACHE_MAXCLASS &&
+	TYPEOF(callrho) == ENVSXP && TYPEOF(defrho) == ENVSXP;
+
+    if (cache) {
+	if (!S3Cache) {
+	    S3Cache = allocVector(VECSXP, S3_CACHE_SIZE);
+	    R_PreserveObject(S3Cache);
+	}
+	top = S3CacheEnv(callrho);
+	h = S3CacheIndex(generic, klass, top, defrho);
+	entry = S3CacheGet(h, generic, klass, callrho, top, defrho);
+	if (entry != R_NilValue) {
+	    S3CacheHits++;
+	    i = (int) REAL(VECTOR_ELT(entry, 6))[1];
+	    syms = VECTOR_ELT(entry, 4);
+	    *method = (i >= 0) ? VECTOR_ELT(syms, LENGTH(syms) - 1) : R_NilValue;
+	    *sxp = VECTOR_ELT(entry, 5);
+	    return i;
+	}
+	S3CacheMisses++;
+	cache = S3CacheMark(top, defrho);
+    }
+
+    PROTECT(syms = allocVector(VECSXP, nclass + 1));
+    for (i = 0; i < nclass; i++) {
+	const void *vmax = vmaxget();
+	const char *ss = translateChar(STRING_ELT(klass, i));
+	*method = installS3Signature(generic, ss);
+	vmaxset(vmax);
+	SET_VECTOR_ELT(syms, i, *method);
+	*sxp = R_LookupMethod(*method, rho, callrho, defrho);
+	if (isFunction(*sxp)) {
+	    if(*method == R_SortListSymbol && CLOENV(*sxp) == R_BaseNamespace)
+		continue; /* kludge because sort.list is not a method */
+	    break;
+	}
+    }
+    if (i == nclass) {
+	*method = installS3Signature(generic, "default");
+	SET_VECTOR_ELT(syms, i, *method);
+	*sxp = R_LookupMethod(*method, rho, callrho, defrho);
+	if (!isFunction(*sxp)) i = -1;
+    }
+    if (i >= 0 && i < nclass) syms = xlengthgets(syms, i + 1);
+    if (cache && !S3BoundBelow(syms, callrho, top)) {
+	PROTECT(syms);
+	PROTECT(*sxp);
+	S3CachePut(h, generic, klass, top, defrho, syms, *sxp, i, epoch);
+	UNPROTECT(2);
+    }
+    UNPROTECT(1);
+    return i;
+}
+
+/* .Internal(dispatchCacheInfo()) */
+SEXP attribute_hidden do_dispatchcacheinfo(SEXP call, SEXP op, SEXP args,
+					   SEXP env)
+{
+    const char *nms[] = {"hits", "misses", "entries", "epoch", ""};
+    double n = 0;
+
+    checkArity(op, args);
+    if (S3Cache)
+	for (int i = 0; i < S3_CACHE_SIZE; i++)
+	    if (VECTOR_ELT(S3Cache, i) != R_NilValue) n++;
+    SEXP ans = PROTECT(mkNamed(REALSXP, nms));
+    REAL(ans)[0] = S3CacheHits;
+    REAL(ans)[1] = S3CacheMisses;
+    REAL(ans)[2] = n;
+    REAL(ans)[3] = S3Epoch;
+    UNPROTECT(1);
+    return ans;
+}
+
 attribute_hidden
 int usemethod(const char *generic, SEXP obj, SEXP call, SEXP args,
 	      SEXP rho, SEXP callrho, SEXP defrho, SEXP *ans)
 {
-    SEXP klass, method, sxp;
+    SEXP klass, method = R_NilValue, sxp = R_NilValue;
     SEXP op;
     int i, nclass;
     RCNTXT *cptr;
@@ -355,41 +589,27 @@ int usemethod(const char *generic, SEXP obj, SEXP call, SEXP args,
     PROTECT(klass = R_data_class2(obj));
 
     nclass = length(klass);
-    for (i = 0; i < nclass; i++) {
-	const void *vmax = vmaxget();
-	const char *ss = translateChar(STRING_ELT(klass, i));
-	method = installS3Signature(generic, ss);
-	vmaxset(vmax);
-	sxp = R_LookupMethod(method, rho, callrho, defrho);
-	if (isFunction(sxp)) {
-	    if(method == R_SortListSymbol && CLOENV(sxp) == R_BaseNamespace)
-		continue; /* kludge because sort.list is not a method */
-	    PROTECT(sxp);
-	    if (i > 0) {
-		SEXP dotClass = PROTECT(stringSuffix(klass, i));
-		setAttrib(dotClass, R_PreviousSymbol, klass);
-		*ans = dispatchMethod(op, sxp, dotClass, cptr, method, generic,
-				      rho, callrho, defrho);
-		UNPROTECT(1); /* dotClass */
-	    } else {
-		*ans = dispatchMethod(op, sxp, klass, cptr, method, generic,
-				      rho, callrho, defrho);
-	    }
-	    UNPROTECT(2); /* klass, sxp */
-	    return 1;
-	}
+    i = lookupS3Method(generic, klass, rho, callrho, defrho, &method, &sxp);
+    if (i < 0) {
+	UNPROTECT(1); /* klass */
+	cptr->callflag = CTXT_RETURN;
+	return 0;
     }
-    method = installS3Signature(generic, "default");
-    PROTECT(sxp = R_LookupMethod(method, rho, callrho, defrho));
-    if (isFunction(sxp)) {
+    PROTECT(sxp);
+    if (i == nclass)
 	*ans = dispatchMethod(op, sxp, R_NilValue, cptr, method, generic,
 			      rho, callrho, defrho);
-	UNPROTECT(2); /* klass, sxp */
-	return 1;
-    }
+    else if (i > 0) {
+	SEXP dotClass = PROTECT(stringSuffix(klass, i));
+	setAttrib(dotClass, R_PreviousSymbol, klass);
+	*ans = dispatchMethod(op, sxp, dotClass, cptr, method, generic,
+			      rho, callrho, defrho);
+	UNPROTECT(1); /* dotClass */
+    } else
+	*ans = dispatchMethod(op, sxp, klass, cptr, method, generic,
+			      rho, callrho, defrho);
     UNPROTECT(2); /* klass, sxp */
-    cptr->callflag = CTXT_RETURN;
-    return 0;
+    return 1;
 }
 
 /* Note: "do_usemethod" is not the only entry point to
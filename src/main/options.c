@@ -244,9 +244,9 @@ void attribute_hidden InitOptions(void)
     char *p;
 
 #ifdef HAVE_RL_COMPLETION_MATCHES
-    PROTECT(v = val = allocList(17));
+    PROTECT(v = val = allocList(18));
 #else
-    PROTECT(v = val = allocList(16));
+    PROTECT(v = val = allocList(17));
 #endif
 
     SET_TAG(v, install("prompt"));
@@ -319,6 +319,14 @@ void attribute_hidden InitOptions(void)
     SETCAR(v, ScalarLogical(R_CBoundsCheck));
     v = CDR(v);
 
+    SET_TAG(v, install("matprod"));
+    switch(R_Matprod) {
+    case MATPROD_AUTO: SETCAR(v, mkString("auto")); break;
+    case MATPROD_INTERNAL: SETCAR(v, mkString("internal-blocked")); break;
+    case MATPROD_BLAS: SETCAR(v, mkString("blas")); break;
+    }
+    v = CDR(v);
+
 #ifdef HAVE_RL_COMPLETION_MATCHES
     /* value from Rf_initialize_R */
     SET_TAG(v, install("rl_word_breaks"));
@@ -648,6 +656,22 @@ SEXP attribute_hidden do_options(SEXP call, SEXP op, SEXP args, SEXP rho)
 		R_CBoundsCheck = k;
 		SET_VECTOR_ELT(value, i, SetOption(tag, ScalarLogical(k)));
 	    }
+	    else if (streql(CHAR(namei), "matprod")) {
+		const char *p;
+		if (TYPEOF(argi) != STRSXP || LENGTH(argi) != 1 ||
+		    STRING_ELT(argi, 0) == NA_STRING)
+		    error(_("invalid value for '%s'"), CHAR(namei));
+		p = CHAR(STRING_ELT(argi, 0));
+		if (streql(p, "auto"))
+		    R_Matprod = MATPROD_AUTO;
+		else if (streql(p, "internal-blocked"))
+		    R_Matprod = MATPROD_INTERNAL;
+		else if (streql(p, "blas"))
+		    R_Matprod = MATPROD_BLAS;
+		else
+		    error(_("invalid value for '%s'"), CHAR(namei));
+		SET_VECTOR_ELT(value, i, SetOption(tag, duplicate(argi)));
+	    }
 	    else {
 		SET_VECTOR_ELT(value, i, SetOption(tag, duplicate(argi)));
 	    }
@@ -639,10 +639,15 @@ static union {
     unsigned long long ull;
 } u;
 
-static
-unsigned long long dtwiddle(void *p, int i, int order)
+// 'dkey' does the work of 'dtwiddle' without the static union, so it
+// can also be used from the threads of 'radixsort_long'.
+static R_INLINE unsigned long long dkey(double x, int order)
 {
-    u.d = order * ((double *)p)[i]; // take care of 'order' at the beginning
+    union {
+	double d;
+	unsigned long long ull;
+    } u;
+    u.d = order * x; // take care of 'order' at the beginning
     if (R_FINITE(u.d)) {
 	u.ull = (u.d != 0.0) ? u.ull + ((u.ull & dmask1) << 1) : 0;
     } else if (ISNAN(u.d)) {
@@ -673,6 +678,12 @@ unsigned long long dtwiddle(void *p, int i, int order)
     return ((u.ull ^ mask) & dmask2);
 }
 
+static
+unsigned long long dtwiddle(void *p, int i, int order)
+{
+    return dkey(((double *)p)[i], order);
+}
+
 static Rboolean dnan(void *p, int i)
 {
     u.d = ((double *) p)[i];
@@ -1561,6 +1572,137 @@ static void dsort(double *x, int *o, int n)
     }
 }
 
+/* Parallel LSD radix ordering of a single integer, logical or double
+   key.  This is used for long vectors, which the MSD code above cannot
+   handle, and for large vectors when R_num_math_threads > 1.
+
+   The keys are the same as those used above (icheck() and dkey(), so
+   including the rounding of doubles, 'decreasing' and 'na.last') and
+   every pass is stable, so the result is identical.  Each pass over a
+   byte computes per-thread histograms over contiguous chunks and then
+   each thread scatters its own chunk to offsets derived from all the
+   histograms.  Bytes which are the same in all keys are skipped. */
+
+#define N_PARALLEL 100000
+
+static SEXP radixsort_long(SEXP x, int nthreads)
+{
+    R_xlen_t n = XLENGTH(x), m;
+    int nt = nthreads, type = TYPEOF(x);
+    const void *vmax = vmaxget();
+
+    R_xlen_t *cnt = (R_xlen_t *) R_alloc((size_t) nt * 256, sizeof(R_xlen_t));
+    unsigned long long *kor = (unsigned long long *)
+	R_alloc(nt, sizeof(unsigned long long));
+    unsigned long long *kand = (unsigned long long *)
+	R_alloc(nt, sizeof(unsigned long long));
+    unsigned long long *key = (unsigned long long *)
+	R_alloc(n, sizeof(unsigned long long));
+    unsigned long long *key2 = (unsigned long long *)
+	R_alloc(n, sizeof(unsigned long long));
+    R_xlen_t *idx = (R_xlen_t *) R_alloc(n, sizeof(R_xlen_t));
+    R_xlen_t *idx2 = (R_xlen_t *) R_alloc(n, sizeof(R_xlen_t));
+    int *ix = (type == REALSXP) ? NULL : INTEGER(x);
+    double *dx = (type == REALSXP) ? REAL(x) : NULL;
+
+#define CHUNK_LO(t, len) ((len) / nt * (t) + ((t) < (len) % nt ? (t) : (len) % nt))
+#define CHUNK_HI(t, len) CHUNK_LO((t) + 1, len)
+#define IS_NA_ELT(i) (dx ? ISNAN(dx[i]) : ix[i] == NA_INTEGER)
+
+    /* Count the elements to keep: all unless na.last = NA. */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+#endif
+    for (int t = 0; t < nt; t++) {
+	R_xlen_t c = 0, hi = CHUNK_HI(t, n);
+	for (R_xlen_t i = CHUNK_LO(t, n); i < hi; i++)
+	    if (nalast != 0 || !IS_NA_ELT(i)) c++;
+	cnt[t] = c;
+    }
+    m = 0;
+    for (int t = 0; t < nt; t++) {
+	R_xlen_t c = cnt[t];
+	cnt[t] = m;
+	m += c;
+    }
+
+    /* Make the keys, noting which bits vary. */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+#endif
+    for (int t = 0; t < nt; t++) {
+	R_xlen_t j = cnt[t], hi = CHUNK_HI(t, n);
+	unsigned long long o = 0, a = ~0ULL, k;
+	for (R_xlen_t i = CHUNK_LO(t, n); i < hi; i++) {
+	    if (nalast == 0 && IS_NA_ELT(i)) continue;
+	    k = dx ? dkey(dx[i], order) :
+		(unsigned int) icheck(ix[i]) ^ 0x80000000U;
+	    key[j] = k;
+	    idx[j++] = i;
+	    o |= k;
+	    a &= k;
+	}
+	kor[t] = o;
+	kand[t] = a;
+    }
+    unsigned long long vary = 0, a = ~0ULL;
+    for (int t = 0; t < nt; t++) {
+	vary |= kor[t];
+	a &= kand[t];
+    }
+    vary ^= a;
+
+    for (int b = 0; b < 8; b++) {
+	int shift = 8 * b;
+	if (((vary >> shift) & 0xff) == 0) continue;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+#endif
+	for (int t = 0; t < nt; t++) {
+	    R_xlen_t *c = cnt + 256 * t, hi = CHUNK_HI(t, m);
+	    for (int v = 0; v < 256; v++) c[v] = 0;
+	    for (R_xlen_t i = CHUNK_LO(t, m); i < hi; i++)
+		c[(key[i] >> shift) & 0xff]++;
+	}
+	R_xlen_t pos = 0;
+	for (int v = 0; v < 256; v++)
+	    for (int t = 0; t < nt; t++) {
+		R_xlen_t c = cnt[256 * t + v];
+		cnt[256 * t + v] = pos;
+		pos += c;
+	    }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt) schedule(static, 1)
+#endif
+	for (int t = 0; t < nt; t++) {
+	    R_xlen_t *c = cnt + 256 * t, hi = CHUNK_HI(t, m);
+	    for (R_xlen_t i = CHUNK_LO(t, m); i < hi; i++) {
+		R_xlen_t j = c[(key[i] >> shift) & 0xff]++;
+		key2[j] = key[i];
+		idx2[j] = idx[i];
+	    }
+	}
+	unsigned long long *ktmp = key; key = key2; key2 = ktmp;
+	R_xlen_t *itmp = idx; idx = idx2; idx2 = itmp;
+    }
+#undef CHUNK_LO
+#undef CHUNK_HI
+#undef IS_NA_ELT
+
+    SEXP ans;
+    if (n > INT_MAX) {
+	ans = allocVector(REALSXP, m);
+	double *ra = REAL(ans);
+	for (R_xlen_t i = 0; i < m; i++) ra[i] = (double) idx[i] + 1;
+    } else {
+	ans = allocVector(INTSXP, m);
+	int *ia = INTEGER(ans);
+	for (R_xlen_t i = 0; i < m; i++) ia[i] = (int) idx[i] + 1;
+    }
+    vmaxset(vmax);
+    return ans;
+}
+
 SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     int n = -1, narg = 0, ngrp, tmp, *osub, thisgrpn;
@@ -1621,9 +1763,19 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
     SEXP x = CAR(args);
     args = CDR(args);
 
-    // (ML) FIXME: need to support long vectors
+    int nthreads = 1;
+#ifdef _OPENMP
+    if (R_num_math_threads > 0)
+	nthreads = R_num_math_threads;
+#endif
+    if (narg == 1 && !retGrp &&
+	(TYPEOF(x) == INTSXP || TYPEOF(x) == LGLSXP || TYPEOF(x) == REALSXP) &&
+	(nl > INT_MAX || (nthreads > 1 && nl >= N_PARALLEL)))
+	return radixsort_long(x, nthreads);
+
+    // (ML) FIXME: need to support long vectors in the general case
     if (nl > INT_MAX) {
-	error(_("long vectors not supported"));
+	error(_("long vectors are only supported for a single integer, logical or double key"));
     }
     n = (int) nl;
 
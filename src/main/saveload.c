@@ -1139,7 +1139,9 @@ static void NewDataSave (SEXP s, FILE *fp, OutputRoutines *m, SaveLoadData *d)
 	 iterator = CDR(iterator)) {
 	R_assert(TYPEOF(CAR(iterator)) == ENVSXP);
 	NewWriteItem(ENCLOS(CAR(iterator)), sym_table, env_table, fp, m, d);
-	NewWriteItem(FRAME(CAR(iterator)), sym_table, env_table, fp, m, d);
+	NewWriteItem(PROTECT(R_VisibleFrame(CAR(iterator))), sym_table, env_table,
+		     fp, m, d);
+	UNPROTECT(1);
 	NewWriteItem(TAG(CAR(iterator)), sym_table, env_table, fp, m, d);
     }
     NewWriteItem(s, sym_table, env_table, fp, m, d);
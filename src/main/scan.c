@@ -60,6 +60,8 @@ static unsigned char ConsoleBuf[CONSOLE_BUFFER_SIZE+1], *ConsoleBufp;
 static int  ConsoleBufCnt;
 static char ConsolePrompt[CONSOLE_PROMPT_SIZE];
 
+typedef struct ScanPar ScanPar;
+
 typedef struct {
     SEXP NAstrings;
     int quiet;
@@ -78,6 +80,7 @@ typedef struct {
     Rboolean embedWarn;
     Rboolean skipNul;
     char convbuf[100];
+    ScanPar *par; /* = NULL */
 } LocalData;
 
 static SEXP insertString(char *str, LocalData *l)
@@ -304,9 +307,12 @@ static int scanchar(Rboolean inQuote, LocalData *d)
 }
 
 /* utility to close connections after interrupts */
+static void freeScanPar(ScanPar *par);
+
 static void scan_cleanup(void *data)
 {
     LocalData *ld = data;
+    if(ld->par) freeScanPar(ld->par);
     if(!ld->ttyflag && !ld->wasopen) ld->con->close(ld->con);
     if (ld->quoteset[0]) free(ld->quoteset);
 }
@@ -656,6 +662,518 @@ static SEXP scanVector(SEXPTYPE type, int maxitems, int maxlines,
 }
 
 
+/* Parallel reading for scanFrame().
+
+   Once the rest of the input can be taken directly from the buffer of
+   a file, compressed file or url connection (see Rconn_peek), it is
+   read into memory and split into items by several threads, each
+   starting at a line boundary.  The items are assigned to records by
+   the usual code in scanFrame(), converted in parallel and, for
+   character columns, interned on the main thread.
+
+   scanTokenize() follows fillBuffer() and scanchar() exactly for the
+   cases it is used for: no escapes, no flush, nmax or nlines, not in
+   a double-byte locale and no nuls in the input.  A chunk which
+   started inside a quoted item spanning lines is detected when the
+   chunks are joined and is tokenized again.  Items which cannot be
+   converted simply (e.g. not numbers or long) are left to
+   extractItem() on the main thread, so errors are as for scan().
+*/
+
+#define SCAN_CHUNK_MIN 262144	/* minimum bytes per thread */
+#define SCAN_ITEM_MAX  512	/* longer numeric items go to extractItem */
+
+/* flags for ScanItem */
+#define SI_EOFQUOTE 1
+#define SI_NA	    2
+#define SI_DEFER    4
+
+typedef struct {
+    size_t off;		/* offset in the input, or in the chunk's side buffer */
+    int len;
+    int col, row;	/* where it goes: col < 0 if not used */
+    short bch;		/* the character which ended it, as from fillBuffer */
+    char side;		/* not a contiguous part of the input */
+    char flag;
+} ScanItem;
+
+typedef struct {
+    ScanItem *items;
+    size_t n, nalloc;
+    char *side;		/* for items with quotes removed */
+    size_t nside, sidealloc;
+    size_t start, bound, stop;
+    int col0, col;	/* column at start and at stop */
+    Rboolean oom;
+} ScanChunk;
+
+struct ScanPar {
+    char *in;
+    size_t len;
+    int nc, nchunks;
+    Rboolean bom;
+    SEXPTYPE *type;	/* by column */
+    char *strip;
+    ScanChunk *chunks;
+    int k, ck;		/* chunk of the next item to be read, converted */
+    size_t i, ci;	/* and its index in the chunk */
+};
+
+static void freeScanPar(ScanPar *par)
+{
+    if (par->chunks) {
+	for (int k = 0; k < par->nchunks; k++) {
+	    free(par->chunks[k].items);
+	    free(par->chunks[k].side);
+	}
+	free(par->chunks);
+    }
+    free(par->in);
+    free(par->type);
+    free(par->strip);
+    free(par);
+}
+
+static Rboolean sideAppend(ScanChunk *ch, const char *s, size_t n)
+{
+    if (ch->nside + n > ch->sidealloc) {
+	size_t a = 2 * ch->sidealloc;
+	if (a < ch->nside + n) a = ch->nside + n;
+	if (a < 1024) a = 1024;
+	char *tmp = realloc(ch->side, a);
+	if (!tmp) {
+	    ch->oom = TRUE;
+	    return FALSE;
+	}
+	ch->side = tmp;
+	ch->sidealloc = a;
+    }
+    memcpy(ch->side + ch->nside, s, n);
+    ch->nside += n;
+    return TRUE;
+}
+
+static R_INLINE const char *itemData(ScanPar *par, ScanChunk *ch, ScanItem *it)
+{
+    return it->side ? ch->side + it->off : par->in + it->off;
+}
+
+static R_INLINE int
+scan_skip_comment(const char *in, size_t N, size_t *p)
+{
+    int c;
+    do
+	c = (*p < N) ? (unsigned char) in[(*p)++] : R_EOF;
+    while (c != '\n' && c != R_EOF);
+    return c;
+}
+
+/* Tokenize from ch->start, until the start of the next chunk has been
+   reached or (for the last chunk) the end of the input.  Runs on a
+   worker thread, so must not allocate R objects or signal. */
+static void scanTokenize(ScanPar *par, ScanChunk *ch, Rboolean last,
+			 LocalData *d)
+{
+    const char *in = par->in;
+    size_t N = par->len, p = ch->start, m, mm;
+    int c, quote, col = ch->col0, sep = d->sepchar, comchar = d->comchar;
+    const char *quoteset = d->quoteset;
+    ScanItem it;
+
+#define RAWC() (p < N ? (unsigned char) in[p++] : R_EOF)
+#define GETC() ((c = RAWC()) == comchar ?				\
+		(c = scan_skip_comment(in, N, &p)) : c)
+    /* the character at 'pos' becomes the next one of the item,
+       starting a copy in the side buffer when it is not contiguous */
+#define APPEND(pos) do {						\
+	size_t pos_ = (pos);						\
+	if (!it.side) {							\
+	    if (m == 0) it.off = pos_;					\
+	    else if (pos_ != it.off + m) {				\
+		size_t o = ch->nside;					\
+		if (!sideAppend(ch, in + it.off, m)) return;		\
+		it.off = o;						\
+		it.side = 1;						\
+	    }								\
+	}								\
+	if (it.side && !sideAppend(ch, in + pos_, 1)) return;		\
+	m++;								\
+    } while (0)
+
+    ch->n = ch->nside = 0;
+    ch->oom = FALSE;
+    while (p < ch->bound ||
+	   (last && (ch->n == 0 || ch->items[ch->n - 1].bch != R_EOF))) {
+	/* fillBuffer() skips leading white space in non-character
+	   items (but NULL ones) and recognizes quotes in character
+	   (and NULL) ones */
+	SEXPTYPE type = par->type[col];
+	int strip = par->strip[col], isstr = (type == STRSXP || type == NILSXP);
+	memset(&it, 0, sizeof(it));
+	it.col = -1;
+	m = mm = 0;
+	if (sep == 0) {
+	    while (GETC() == ' ' || c == '\t') ;
+	    if (c == '\n' || c == R_EOF) {
+		it.bch = (short) c;
+		goto donefill;
+	    }
+	    if (isstr && strchr(quoteset, c)) {
+		quote = c;
+		while ((c = RAWC()) != R_EOF && c != quote) {
+		    if (c == '\\') {
+			c = RAWC();
+			if (c == R_EOF) break;
+			if (c != quote) APPEND(p - 2);
+		    }
+		    APPEND(p - 1);
+		}
+		if (c == R_EOF) it.flag |= SI_EOFQUOTE;
+		GETC();
+		mm = m;
+	    } else {
+		do {
+		    APPEND(p - 1);
+		    GETC();
+		} while (!Rspace(c) && c != R_EOF);
+	    }
+	    while (c == ' ' || c == '\t') GETC();
+	    if (c == '\n' || c == R_EOF) it.bch = (short) c;
+	    else {
+		p--;
+		it.bch = 1;
+	    }
+	} else {
+	    for (;;) {
+		GETC();
+		if (c == sep || c == '\n' || c == R_EOF) break;
+		if (type != STRSXP)
+		    while (c == ' ' || c == '\t')
+			if (GETC() == sep || c == '\n' || c == R_EOF)
+			    goto sepdone;
+		if (isstr && strchr(quoteset, c)) {
+		    quote = c;
+		inquote:
+		    while ((c = RAWC()) != R_EOF && c != quote)
+			APPEND(p - 1);
+		    if (c == R_EOF) it.flag |= SI_EOFQUOTE;
+		    c = RAWC();
+		    if (c == quote) {
+			APPEND(p - 1);
+			goto inquote;
+		    }
+		    mm = m;
+		    if (c == sep || c == '\n' || c == R_EOF) break;
+		    p--;
+		    continue;
+		}
+		if (!strip || m > 0 || !Rspace(c)) APPEND(p - 1);
+	    }
+	sepdone:
+	    it.bch = (short) c;
+	    if (strip && m > mm) {
+		/* as fillBuffer, including its use of (signed) char */
+		const char *s = it.side ? ch->side + it.off : in + it.off;
+		while (m > mm && Rspace((int) s[m - 1])) m--;
+		if (it.side) ch->nside = it.off + m;
+	    }
+	}
+    donefill:
+	if (par->bom && ch->start == 0 && ch->n == 0 && m >= 3 &&
+	    !memcmp(it.side ? ch->side + it.off : in + it.off,
+		    "\xef\xbb\xbf", 3)) {
+	    it.off += 3;
+	    m -= 3;
+	}
+	if (m > INT_MAX) {
+	    ch->oom = TRUE;
+	    return;
+	}
+	it.len = (int) m;
+	if (ch->n == ch->nalloc) {
+	    size_t a = ch->nalloc ? 2 * ch->nalloc : 1024;
+	    ScanItem *tmp = realloc(ch->items, a * sizeof(ScanItem));
+	    if (!tmp) {
+		ch->oom = TRUE;
+		return;
+	    }
+	    ch->items = tmp;
+	    ch->nalloc = a;
+	}
+	ch->items[ch->n++] = it;
+	col = (it.bch == '\n') ? 0 : (col + 1) % par->nc;
+    }
+    ch->stop = p;
+    ch->col = col;
+#undef RAWC
+#undef GETC
+#undef APPEND
+}
+
+/* Read the rest of the input into memory, mapping CR and CRLF to LF
+   as Rconn_fgetc does, and split it into items.  Returns NULL (having
+   pushed back anything read) if the input contains nuls. */
+static ScanPar *scanParStart(SEXP ans, int nc, int *lstrip, Rboolean vec_strip,
+			     int colsread, LocalData *d)
+{
+    Rconnection con = d->con;
+    ScanPar *par;
+    const char *buf;
+    size_t avail, alloc = 0, i, j;
+    Rboolean nul = FALSE;
+    int k, nchunks = 1;
+
+    par = calloc(1, sizeof(ScanPar));
+    if (!par) return NULL;
+    d->par = par;
+    while ((avail = Rconn_peek(con, &buf)) > 0) {
+	const char *z = memchr(buf, '\0', avail);
+	size_t take = z ? (size_t)(z - buf) : avail;
+	if (par->len + take + 1 > alloc) {
+	    size_t a = 2 * alloc;
+	    if (a < par->len + take + 1) a = par->len + take + 1;
+	    char *tmp = realloc(par->in, a);
+	    if (!tmp) error(_("cannot allocate buffer in scan"));
+	    par->in = tmp;
+	    alloc = a;
+	}
+	memcpy(par->in + par->len, buf, take);
+	par->len += take;
+	Rconn_skip(con, take);
+	if (z) {
+	    nul = TRUE;
+	    break;
+	}
+    }
+    if (par->len && memchr(par->in, '\r', par->len)) {
+	char *in = par->in;
+	for (i = j = 0; i < par->len; i++) {
+	    if (in[i] != '\r') in[j++] = in[i];
+	    else {
+		in[j++] = '\n';
+		if (i + 1 < par->len && (in[i+1] == '\n' || in[i+1] == '\r')) {
+		    if (in[i+1] == '\r') in[j++] = '\n';
+		    i++;
+		}
+	    }
+	}
+	par->len = j;
+    }
+    if (nul) {
+	/* leave it to the character-at-a-time code */
+	if (par->len) {
+	    par->in[par->len] = '\0';
+	    con_pushback(con, FALSE, par->in);
+	}
+	freeScanPar(par);
+	d->par = NULL;
+	return NULL;
+    }
+
+    par->nc = nc;
+    par->bom = d->atStart && utf8locale;
+    d->atStart = FALSE;
+    par->type = malloc(nc * sizeof(SEXPTYPE));
+    par->strip = malloc(nc);
+    if (!par->type || !par->strip)
+	error(_("cannot allocate buffer in scan"));
+    for (j = 0; j < (size_t) nc; j++) {
+	par->type[j] = TYPEOF(VECTOR_ELT(ans, j));
+	par->strip[j] = (char)(vec_strip ? lstrip[j] : lstrip[0]);
+    }
+
+#ifdef _OPENMP
+    if (R_num_math_threads > 1) {
+	size_t nt = par->len / SCAN_CHUNK_MIN;
+	nchunks = (nt < (size_t) R_num_math_threads) ?
+	    (int) nt : R_num_math_threads;
+	if (nchunks < 1) nchunks = 1;
+    }
+#endif
+    par->chunks = calloc(nchunks, sizeof(ScanChunk));
+    if (!par->chunks) error(_("cannot allocate buffer in scan"));
+    par->nchunks = nchunks;
+    /* chunks after the first start after the first newline at or
+       after their share of the input */
+    for (k = 0; k < nchunks; k++) {
+	ScanChunk *ch = &par->chunks[k];
+	if (k == 0) ch->start = 0;
+	else {
+	    size_t b = (par->len / nchunks) * k;
+	    const char *nl = memchr(par->in + b - 1, '\n', par->len - b + 1);
+	    ch->start = nl ? (size_t)(nl - par->in) + 1 : par->len;
+	    if (ch->start < par->chunks[k-1].start)
+		ch->start = par->chunks[k-1].start;
+	}
+	ch->col0 = k ? 0 : colsread;
+	if (k) par->chunks[k-1].bound = ch->start;
+    }
+    par->chunks[nchunks - 1].bound = par->len;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nchunks) schedule(static, 1)
+#endif
+    for (k = 0; k < nchunks; k++)
+	scanTokenize(par, &par->chunks[k], k == nchunks - 1, d);
+
+    /* Join the chunks: a chunk is valid if the previous one stopped
+       where it started, in the same column.  Otherwise tokenize it
+       again from where the previous one stopped. */
+    Rboolean eof = FALSE;
+    for (k = 0; k < nchunks; k++) {
+	ScanChunk *ch = &par->chunks[k], *prev = k ? ch - 1 : NULL;
+	if (eof) {
+	    ch->n = 0;
+	    ch->stop = prev->stop;
+	    ch->col = prev->col;
+	} else if (prev && (prev->stop != ch->start || prev->col != ch->col0)) {
+	    ch->start = prev->stop;
+	    ch->col0 = prev->col;
+	    scanTokenize(par, ch, k == nchunks - 1, d);
+	}
+	if (ch->oom) error(_("cannot allocate buffer in scan"));
+	if (ch->n && ch->items[ch->n - 1].bch == R_EOF) eof = TRUE;
+    }
+    par->k = par->ck = 0;
+    par->i = par->ci = 0;
+    return par;
+}
+
+/* The next item to be read: the caller increments par->i */
+static ScanItem *scanParPeek(ScanPar *par)
+{
+    while (par->i >= par->chunks[par->k].n && par->k < par->nchunks - 1) {
+	par->k++;
+	par->i = 0;
+    }
+    return &par->chunks[par->k].items[par->i];
+}
+
+/* As isNAstring, for an item which is not nul-terminated */
+static R_INLINE int isNAitem(const char *s, int len, int mode, LocalData *d)
+{
+    if (!mode && len == 0) return 1;
+    for (int i = 0; i < LENGTH(d->NAstrings); i++) {
+	SEXP na = STRING_ELT(d->NAstrings, i);
+	if (LENGTH(na) == len && !memcmp(CHAR(na), s, len)) return 1;
+    }
+    return 0;
+}
+
+/* Convert an item on a worker thread if this can be done without
+   allocation or errors: otherwise mark it for the main thread */
+static void convertItem(const char *s, ScanItem *it, SEXPTYPE type,
+			void *data, LocalData *d)
+{
+    char buf[SCAN_ITEM_MAX], *endp;
+    int mode = (type == STRSXP);
+
+    if (type == NILSXP) return;
+    if (isNAitem(s, it->len, mode, d)) {
+	it->flag |= SI_NA;
+	switch(type) {
+	case LGLSXP: ((int *) data)[it->row] = NA_LOGICAL; break;
+	case INTSXP: ((int *) data)[it->row] = NA_INTEGER; break;
+	case REALSXP: ((double *) data)[it->row] = NA_REAL; break;
+	case STRSXP: break;
+	default: it->flag |= SI_DEFER;
+	}
+	return;
+    }
+    if (type == STRSXP) return;
+    if (it->len >= SCAN_ITEM_MAX ||
+	(type != LGLSXP && type != INTSXP && type != REALSXP)) {
+	it->flag |= SI_DEFER;
+	return;
+    }
+    memcpy(buf, s, it->len);
+    buf[it->len] = '\0';
+    switch(type) {
+    case LGLSXP:
+    {
+	int tr = StringTrue(buf), fa = StringFalse(buf);
+	if (tr || fa) ((int *) data)[it->row] = tr;
+	else it->flag |= SI_DEFER;
+	break;
+    }
+    case INTSXP:
+    {
+	int v = Strtoi(buf, 10);
+	if (v != NA_INTEGER) ((int *) data)[it->row] = v;
+	else it->flag |= SI_DEFER;
+	break;
+    }
+    case REALSXP:
+    {
+	double v = Strtod(buf, &endp, TRUE, d);
+	/* isBlankString() may need to look at multibyte characters */
+	while (*endp == ' ' || (*endp >= '\t' && *endp <= '\r')) endp++;
+	if (*endp == '\0') ((double *) data)[it->row] = v;
+	else it->flag |= SI_DEFER;
+	break;
+    }
+    default:
+	break;
+    }
+}
+
+/* Convert the items read since the last call: in parallel by chunk,
+   then interning strings and handling deferred items in order */
+static void scanConvert(SEXP ans, LocalData *d, R_StringBuffer *strBuf)
+{
+    ScanPar *par = d->par;
+    int k, k0 = par->ck, k1 = par->k, nc = par->nc;
+    size_t i0 = par->ci, i1 = par->i;
+    SEXPTYPE *type = (SEXPTYPE *) R_alloc(nc, sizeof(SEXPTYPE));
+    void **data = (void **) R_alloc(nc, sizeof(void *));
+    cetype_t enc = CE_NATIVE;
+
+    if (d->con->UTF8out || d->isUTF8) enc = CE_UTF8;
+    else if (d->isLatin1) enc = CE_LATIN1;
+    for (int j = 0; j < nc; j++) {
+	SEXP v = VECTOR_ELT(ans, j);
+	type[j] = TYPEOF(v);
+	data[j] = (type[j] == LGLSXP || type[j] == INTSXP ||
+		   type[j] == REALSXP) ? DATAPTR(v) : NULL;
+    }
+#ifdef _OPENMP
+    int nthreads = (k1 > k0) ? par->nchunks : 1;
+#pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+#endif
+    for (k = k0; k <= k1; k++) {
+	ScanChunk *ch = &par->chunks[k];
+	size_t from = (k == k0) ? i0 : 0, to = (k == k1) ? i1 : ch->n;
+	for (size_t i = from; i < to; i++) {
+	    ScanItem *it = &ch->items[i];
+	    if (it->col >= 0)
+		convertItem(itemData(par, ch, it), it, type[it->col],
+			    data[it->col], d);
+	}
+    }
+    for (k = k0; k <= k1; k++) {
+	ScanChunk *ch = &par->chunks[k];
+	size_t from = (k == k0) ? i0 : 0, to = (k == k1) ? i1 : ch->n;
+	for (size_t i = from; i < to; i++) {
+	    ScanItem *it = &ch->items[i];
+	    if (it->col < 0) continue;
+	    if (type[it->col] == STRSXP)
+		SET_STRING_ELT(VECTOR_ELT(ans, it->col), it->row,
+			       (it->flag & SI_NA) ? NA_STRING :
+			       mkCharLenCE(itemData(par, ch, it), it->len,
+					   enc));
+	    else if (it->flag & SI_DEFER) {
+		R_AllocStringBuffer(it->len + 1, strBuf);
+		memcpy(strBuf->data, itemData(par, ch, it), it->len);
+		strBuf->data[it->len] = '\0';
+		extractItem(strBuf->data, VECTOR_ELT(ans, it->col), it->row, d);
+	    }
+	}
+    }
+    par->ck = k1;
+    par->ci = i1;
+}
+
+
 static SEXP scanFrame(SEXP what, int maxitems, int maxlines, int flush,
 		      int fill, SEXP stripwhite, int blskip, int multiline,
 		      LocalData *d)
@@ -663,8 +1181,10 @@ static SEXP scanFrame(SEXP what, int maxitems, int maxlines, int flush,
     SEXP ans, new, old, w;
     char *buffer = NULL;
     int blksize, c, i, ii, j, n, nc, linesread, colsread, strip, bch;
-    int badline, nstring = 0;
+    int badline, nstring = 0, empty;
     R_StringBuffer buf = {NULL, 0, MAXELTSIZE};
+    ScanItem *item = NULL;
+    const char *peek;
 
     nc = length(what);
     if (!nc) {
@@ -701,6 +1221,20 @@ static SEXP scanFrame(SEXP what, int maxitems, int maxlines, int flush,
     Rboolean vec_strip = (length(stripwhite) == length(what));
     strip = lstrip[0];
 
+    /* Can the input be read in parallel (see scanTokenize)?  Records
+       spanning lines need all columns to be tokenized alike. */
+    Rboolean par_ok = !d->ttyflag && !d->escapes && !flush &&
+	maxitems <= 0 && maxlines <= 0 && MB_CUR_MAX != 2;
+    if (par_ok && multiline)
+	for (i = 1; i < nc; i++) {
+	    SEXPTYPE t0 = TYPEOF(VECTOR_ELT(ans, 0)),
+		t = TYPEOF(VECTOR_ELT(ans, i));
+	    if ((t == STRSXP) != (t0 == STRSXP) ||
+		(t == NILSXP) != (t0 == NILSXP) ||
+		(vec_strip && lstrip[i] != lstrip[0]))
+		par_ok = FALSE;
+	}
+
     for (;;) {
 	if(linesread % 1000 == 999) R_CheckUserInterrupt();
 
@@ -721,8 +1255,10 @@ static SEXP scanFrame(SEXP what, int maxitems, int maxlines, int flush,
 		    colsread = 0;
 		} else if (!badline && !multiline)
 		    badline = linesread;
-		if(badline && !multiline)
-		error(_("line %d did not have %d elements"), badline, nc);
+		if(badline && !multiline) {
+		    if (d->par) scanConvert(ans, d, &buf);
+		    error(_("line %d did not have %d elements"), badline, nc);
+		}
 	    }
 	    if (maxitems > 0 && n >= maxitems)
 		goto done;
@@ -732,7 +1268,10 @@ static SEXP scanFrame(SEXP what, int maxitems, int maxlines, int flush,
 		sprintf(ConsolePrompt, "%d: ", n + 1);
 	}
 	if (n == blksize && colsread == 0) {
-	    if(blksize > INT_MAX/2) error(_("too many items"));
+	    if(blksize > INT_MAX/2) {
+		if (d->par) scanConvert(ans, d, &buf);
+		error(_("too many items"));
+	    }
 	    blksize = 2 * blksize;
 	    for (i = 0; i < nc; i++) {
 		old = VECTOR_ELT(ans, i);
@@ -744,16 +1283,39 @@ static SEXP scanFrame(SEXP what, int maxitems, int maxlines, int flush,
 	    }
 	}
 
-	if (vec_strip) strip = lstrip[colsread];
-	buffer = fillBuffer(TYPEOF(VECTOR_ELT(ans, ii)), strip, &bch, d, &buf);
-	if (colsread == 0 &&
-	    strlen(buffer) == 0 &&
+	if (par_ok && !d->par && d->save == 0 &&
+	    Rconn_peek(d->con, &peek) > 0) {
+	    if (scanParStart(ans, nc, lstrip, vec_strip, colsread, d))
+		buffer = buf.data;
+	    else par_ok = FALSE;
+	}
+	if (d->par) {
+	    /* the next item: it is converted later, by scanConvert */
+	    item = scanParPeek(d->par);
+	    if (item->flag & SI_EOFQUOTE) {
+		scanConvert(ans, d, &buf);
+		warning(_("EOF within quoted string"));
+	    }
+	    d->par->i++;
+	    bch = item->bch;
+	    empty = (item->len == 0);
+	} else {
+	    if (vec_strip) strip = lstrip[colsread];
+	    buffer = fillBuffer(TYPEOF(VECTOR_ELT(ans, ii)), strip, &bch, d,
+				&buf);
+	    empty = (strlen(buffer) == 0);
+	}
+	if (colsread == 0 && empty &&
 	    ((blskip && bch =='\n') || bch == R_EOF)) {
 	    if (d->ttyflag || bch == R_EOF)
 		break;
 	}
 	else {
-	    extractItem(buffer, VECTOR_ELT(ans, ii), n, d);
+	    if (d->par) {
+		item->col = ii;
+		item->row = n;
+	    } else
+		extractItem(buffer, VECTOR_ELT(ans, ii), n, d);
 	    ii++;
 	    colsread++;
 	    /* increment n and reset i after filling a row */
@@ -770,6 +1332,11 @@ static SEXP scanFrame(SEXP what, int maxitems, int maxlines, int flush,
     }
 
  done:
+    if (d->par) {
+	scanConvert(ans, d, &buf);
+	freeScanPar(d->par);
+	d->par = NULL;
+    }
     if (colsread != 0) {
 	if (!fill)
 	    warning(_("number of items read is not a multiple of the number of columns"));
@@ -30,12 +30,20 @@
 #include <Fileio.h>
 #include <Rversion.h>
 #include <R_ext/RS.h>           /* for CallocCharBuf, Free */
+#include <R_ext/Rallocators.h> /* for R_allocator_t */
 #include <errno.h>
 #include <ctype.h>		/* for isspace */
 #include <stdarg.h>
 #ifdef Win32
 #include <trioremap.h>
 #endif
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H)
+# define MMAP_READER
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
 
 /* From time to time changes in R, such as the addition of a new SXP,
  * may require changes in the save file format.  Here are some
@@ -173,6 +181,15 @@ static SEXP ReadBC(SEXP ref_table, R_inpstream_t stream);
 
 static const int R_DefaultSerializeVersion = 2;
 
+/* Version 3 differs from version 2 in that in native binary streams
+   the payloads of atomic vectors of at least R_SER_ALIGN_MIN bytes
+   start at a multiple of R_SER_ALIGN bytes from the start of the
+   stream, so that a reader can map them from a file rather than copy
+   them. */
+
+#define R_SER_ALIGN 64
+#define R_SER_ALIGN_MIN 65536
+
 /*
  * Utility Functions
  *
@@ -688,6 +705,7 @@ static int HashGet(SEXP item, SEXP ht)
 #define IS_OBJECT_BIT_MASK (1 << 8)
 #define HAS_ATTR_BIT_MASK (1 << 9)
 #define HAS_TAG_BIT_MASK (1 << 10)
+#define IS_ALIGNED_BIT_MASK (1 << 11) /* payload follows padding: version 3 */
 #define ENCODE_LEVELS(v) ((v) << 12)
 #define DECODE_LEVELS(v) ((v) >> 12)
 #define DECODE_TYPE(v) ((v) & 255)
@@ -959,6 +977,61 @@ OutComplexVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
     }
 }
 
+/* Version 3 native binary streams keep track of the number of bytes
+   written, to align large payloads. */
+
+typedef struct outcount_st {
+    R_outpstream_t stream;
+    void (*OutBytes)(R_outpstream_t, void *, int);
+    R_size_t pos;
+    struct outcount_st *prev;
+} *outcount_t;
+
+static outcount_t OutCount = NULL;
+
+static void OutBytesCount(R_outpstream_t stream, void *buf, int length)
+{
+    outcount_t cnt = OutCount;
+    cnt->pos += length;
+    cnt->OutBytes(stream, buf, length);
+}
+
+static void outcount_cleanup(void *data)
+{
+    outcount_t cnt = data;
+    cnt->stream->OutBytes = cnt->OutBytes;
+    OutCount = cnt->prev;
+}
+
+/* The number of bytes of the payload of 's' if it is to be aligned,
+   otherwise 0 */
+static R_xlen_t AlignedBytes(R_outpstream_t stream, SEXP s)
+{
+    R_xlen_t n;
+
+    if (stream->OutBytes != OutBytesCount) return 0;
+    switch (TYPEOF(s)) {
+    case LGLSXP:
+    case INTSXP: n = XLENGTH(s) * sizeof(int); break;
+    case REALSXP: n = XLENGTH(s) * sizeof(double); break;
+    case CPLXSXP: n = XLENGTH(s) * sizeof(Rcomplex); break;
+    case RAWSXP: n = XLENGTH(s); break;
+    default: return 0;
+    }
+    return n >= R_SER_ALIGN_MIN ? n : 0;
+}
+
+static void OutAlign(R_outpstream_t stream)
+{
+    static char zero[R_SER_ALIGN];
+    outcount_t cnt = OutCount;
+    int pad = (int) ((R_SER_ALIGN - (cnt->pos + sizeof(int)) % R_SER_ALIGN)
+		     % R_SER_ALIGN);
+
+    OutInteger(stream, pad);
+    if (pad) stream->OutBytes(stream, zero, pad);
+}
+
 static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 {
     int i;
@@ -1014,15 +1087,17 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	else {
 	    OutInteger(stream, ENVSXP);
 	    OutInteger(stream, R_EnvironmentIsLocked(s) ? 1 : 0);
+	    R_HashFinishSplit(s);
 	    WriteItem(ENCLOS(s), ref_table, stream);
-	    WriteItem(FRAME(s), ref_table, stream);
+	    WriteItem(PROTECT(R_VisibleFrame(s)), ref_table, stream);
+	    UNPROTECT(1);
 	    WriteItem(HASHTAB(s), ref_table, stream);
 	    WriteItem(ATTRIB(s), ref_table, stream);
 	}
     }
     else {
 	int flags, hastag, hasattr;
-	R_xlen_t len;
+	R_xlen_t len, aligned;
 	switch(TYPEOF(s)) {
 	case LISTSXP:
 	case LANGSXP:
@@ -1037,6 +1112,8 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	hasattr = (TYPEOF(s) != CHARSXP && ATTRIB(s) != R_NilValue);
 	flags = PackFlags(TYPEOF(s), LEVELS(s), OBJECT(s),
 			  hasattr, hastag);
+	aligned = AlignedBytes(stream, s);
+	if (aligned) flags |= IS_ALIGNED_BIT_MASK;
 	OutInteger(stream, flags);
 	switch (TYPEOF(s)) {
 	case LISTSXP:
@@ -1083,16 +1160,19 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	case INTSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    if (aligned) OutAlign(stream);
 	    OutIntegerVec(stream, s, len);
 	    break;
 	case REALSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    if (aligned) OutAlign(stream);
 	    OutRealVec(stream, s, len);
 	    break;
 	case CPLXSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    if (aligned) OutAlign(stream);
 	    OutComplexVec(stream, s, len);
 	    break;
 	case STRSXP:
@@ -1114,6 +1194,7 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	case RAWSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    if (aligned) OutAlign(stream);
 	    switch (stream->type) {
 	    case R_pstream_xdr_format:
 	    case R_pstream_binary_format:
@@ -1300,6 +1381,24 @@ void R_Serialize(SEXP s, R_outpstream_t stream)
 {
     SEXP ref_table;
     int version = stream->version;
+    struct outcount_st cnt;
+    RCNTXT cntxt;
+    Rboolean counted =
+	version == 3 && stream->type == R_pstream_binary_format;
+
+    if (counted) {
+	cnt.stream = stream;
+	cnt.OutBytes = stream->OutBytes;
+	cnt.pos = 0;
+	cnt.prev = OutCount;
+	OutCount = &cnt;
+	stream->OutBytes = OutBytesCount;
+	/* restore the stream on error */
+	begincontext(&cntxt, CTXT_CCODE, R_NilValue, R_BaseEnv, R_BaseEnv,
+		     R_NilValue, R_NilValue);
+	cntxt.cend = &outcount_cleanup;
+	cntxt.cenddata = &cnt;
+    }
 
     OutFormat(stream);
 
@@ -1309,12 +1408,22 @@ void R_Serialize(SEXP s, R_outpstream_t stream)
 	OutInteger(stream, R_VERSION);
 	OutInteger(stream, R_Version(2,3,0));
 	break;
+    case 3:
+	OutInteger(stream, version);
+	OutInteger(stream, R_VERSION);
+	OutInteger(stream, R_Version(3,4,0));
+	break;
     default: error(_("version %d not supported"), version);
     }
 
     PROTECT(ref_table = MakeHashTable());
     WriteItem(s, ref_table, stream);
     UNPROTECT(1);
+
+    if (counted) {
+	endcontext(&cntxt);
+	outcount_cleanup(&cnt);
+    }
 }
 
 
@@ -1516,6 +1625,18 @@ static R_xlen_t ReadLENGTH (R_inpstream_t stream)
 #endif
 }
 
+static void InAlign(R_inpstream_t stream)
+{
+    char buf[R_SER_ALIGN];
+    int pad = InInteger(stream);
+
+    if (pad < 0 || pad >= R_SER_ALIGN)
+	error(_("invalid padding in serialized data"));
+    if (pad) stream->InBytes(stream, buf, pad);
+}
+
+static SEXP InMappedVec(R_inpstream_t stream, SEXPTYPE type, R_xlen_t len);
+
 /* differs when it fails from version in envir.c */
 static SEXP R_FindNamespace1(SEXP info)
 {
@@ -1705,19 +1826,32 @@ static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
 	    break;
 	case LGLSXP:
 	case INTSXP:
-	    len = ReadLENGTH(stream);
-	    PROTECT(s = allocVector(type, len));
-	    InIntegerVec(stream, s, len);
-	    break;
 	case REALSXP:
-	    len = ReadLENGTH(stream);
-	    PROTECT(s = allocVector(type, len));
-	    InRealVec(stream, s, len);
-	    break;
 	case CPLXSXP:
+	case RAWSXP:
 	    len = ReadLENGTH(stream);
+	    if (flags & IS_ALIGNED_BIT_MASK) {
+		InAlign(stream);
+		if ((s = InMappedVec(stream, type, len)) != NULL) {
+		    PROTECT(s);
+		    break;
+		}
+	    }
 	    PROTECT(s = allocVector(type, len));
-	    InComplexVec(stream, s, len);
+	    switch (type) {
+	    case LGLSXP:
+	    case INTSXP: InIntegerVec(stream, s, len); break;
+	    case REALSXP: InRealVec(stream, s, len); break;
+	    case CPLXSXP: InComplexVec(stream, s, len); break;
+	    default:
+	    {
+		R_xlen_t done, this;
+		for (done = 0; done < len; done += this) {
+		    this = min2(CHUNK_SIZE, len - done);
+		    stream->InBytes(stream, RAW(s) + done, (int) this);
+		}
+	    }
+	    }
 	    break;
 	case STRSXP:
 	    len = ReadLENGTH(stream);
@@ -1746,17 +1880,6 @@ static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
 	    error(_("this version of R cannot read class references"));
 	case GENERICREFSXP:
 	    error(_("this version of R cannot read generic function references"));
-	case RAWSXP:
-	    len = ReadLENGTH(stream);
-	    PROTECT(s = allocVector(type, len));
-	    {
-		R_xlen_t done, this;
-		for (done = 0; done < len; done += this) {
-		    this = min2(CHUNK_SIZE, len - done);
-		    stream->InBytes(stream, RAW(s) + done, (int) this);
-		}
-	    }
-	    break;
 	case S4SXP:
 	    PROTECT(s = allocS4Object());
 	    break;
@@ -1912,7 +2035,8 @@ SEXP R_Unserialize(R_inpstream_t stream)
     writer_version = InInteger(stream);
     release_version = InInteger(stream);
     switch (version) {
-    case 2: break;
+    case 2:
+    case 3: break;
     default:
 	if (version != 2) {
 	    int vw, pw, sw;
@@ -2200,6 +2324,9 @@ do_serializeToConn(SEXP call, SEXP op, SEXP args, SEXP env)
 	error(_("bad version value"));
     if (version < 2)
 	error(_("cannot save to connections in version %d format"), version);
+    /* version 3 files are written natively so they can be mapped */
+    if (version >= 3 && type == R_pstream_xdr_format)
+	type = R_pstream_binary_format;
 
     fun = CAR(nthcdr(args,4));
     hook = fun != R_NilValue ? CallHook : NULL;
@@ -2236,10 +2363,16 @@ do_serializeToConn(SEXP call, SEXP op, SEXP args, SEXP env)
 /* Used from readRDS().
    This became public in R 2.13.0, and that version added support for
    connections internally */
+#ifdef MMAP_READER
+static Rboolean UnserializeFromMap(const char *path,
+				   SEXP (*hook)(SEXP, SEXP), SEXP fun,
+				   SEXP *ans);
+#endif
+
 SEXP attribute_hidden
 do_unserializeFromConn(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    /* unserializeFromConn(conn, hook) */
+    /* unserializeFromConn(conn, hook, file) */
 
     struct R_inpstream_st in;
     Rconnection con;
@@ -2255,6 +2388,18 @@ do_unserializeFromConn(SEXP call, SEXP op, SEXP args, SEXP env)
     fun = CADR(args);
     hook = fun != R_NilValue ? CallHook : NULL;
 
+    /* 'file' is the name of the file 'conn' reads, if it may be mapped */
+    if (!isNull(CADDR(args))) {
+	if (!isString(CADDR(args)) || LENGTH(CADDR(args)) != 1)
+	    error(_("invalid '%s' argument"), "file");
+#ifdef MMAP_READER
+	const char *path =
+	    R_ExpandFileName(translateChar(STRING_ELT(CADDR(args), 0)));
+	if (UnserializeFromMap(path, hook, fun, &ans))
+	    return ans;
+#endif
+    }
+
     /* Now we need to do some sanity checking of the arguments.
        A filename will already have been opened, so anything
        not open was specified as a connection directly.
@@ -2487,6 +2632,234 @@ static SEXP CloseMemOutPStream(R_outpstream_t stream)
     return val;
 }
 
+/*
+ * Mapped Files
+ *
+ * Version 3 native binary files are read from a private read-only
+ * mapping, and aligned payloads get their own private mappings that
+ * become the data of the vectors, through a custom allocator which
+ * puts the vector header in the bytes before the payload.  Pages are
+ * only copied when written to.  The live mappings are kept in a list,
+ * and before R opens a file for writing the vectors mapped from it
+ * are moved to anonymous memory, as truncating the file would make
+ * their pages inaccessible.  Other processes must still not truncate
+ * a file while vectors mapped from it are in use.
+ */
+
+#ifdef MMAP_READER
+typedef struct sermap_st {
+    membuf_t mb;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    void *buf;
+    R_size_t size;
+    struct sermap_st *prev;
+} *sermap_t;
+
+static sermap_t SerMap = NULL;
+
+typedef struct mapvec_st {
+    int fd;
+    dev_t dev;		    /* of the file */
+    ino_t ino;
+    R_size_t off, datasize; /* of the payload */
+    void *base;		    /* of the mapping, NULL if malloc()ed */
+    size_t len;
+    struct mapvec_st *prev, *next; /* in MapVecs, while file-backed */
+} *mapvec_t;
+
+static struct mapvec_st MapVecs = { .prev = &MapVecs, .next = &MapVecs };
+
+static void MapVecUnlink(mapvec_t m)
+{
+    if (m->next) {
+	m->prev->next = m->next;
+	m->next->prev = m->prev;
+	m->prev = m->next = NULL;
+    }
+}
+
+/* Called before 'path' is opened with 'mode': if that may write to a
+   file that vectors are mapped from, give them private copies of
+   their pages which no longer depend on the file. */
+void attribute_hidden R_DetachMappedFile(const char *path, const char *mode)
+{
+    struct stat sb;
+    mapvec_t m, next;
+
+    if (MapVecs.next == &MapVecs || mode == NULL ||
+	(mode[0] == 'r' && strchr(mode, '+') == NULL) ||
+	path == NULL || stat(path, &sb) != 0)
+	return;
+    for (m = MapVecs.next; m != &MapVecs; m = next) {
+	next = m->next;
+	if (m->dev != sb.st_dev || m->ino != sb.st_ino) continue;
+	void *copy = malloc(m->len);
+	if (copy != NULL) memcpy(copy, m->base, m->len);
+	if (copy == NULL ||
+	    mmap(m->base, m->len, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)
+	    == MAP_FAILED) {
+	    free(copy);
+	    error(_("cannot write to file '%s' while objects read from it with 'mmap = TRUE' are in use"),
+		  path);
+	}
+	memcpy(m->base, copy, m->len);
+	free(copy);
+	MapVecUnlink(m);
+    }
+}
+
+static void *MapVecAlloc(R_allocator_t *allocator, size_t size)
+{
+    mapvec_t m = allocator->data;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    R_size_t hdr = size - m->datasize, pstart, flen;
+    size_t lead;
+    void *base;
+
+    /* The header goes in the bytes before the payload.  If there are
+       too few of them in the file, the file is mapped from its start
+       after an anonymous page which takes the rest of the header. */
+    if (hdr > page) return malloc(size);
+    if (m->off >= hdr) {
+	pstart = m->off - hdr;
+	pstart -= pstart % page;
+	lead = 0;
+    } else {
+	pstart = 0;
+	lead = page;
+    }
+    flen = m->off + m->datasize - pstart;
+    base = mmap(NULL, lead + flen, PROT_READ | PROT_WRITE,
+		lead ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_PRIVATE,
+		lead ? -1 : m->fd, lead ? 0 : (off_t) pstart);
+    if (base == MAP_FAILED) return malloc(size);
+    if (lead &&
+	mmap((char *) base + lead, flen, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_FIXED, m->fd, 0) == MAP_FAILED) {
+	munmap(base, lead + flen);
+	return malloc(size);
+    }
+    m->base = base;
+    m->len = lead + flen;
+    m->prev = &MapVecs;
+    m->next = MapVecs.next;
+    MapVecs.next->prev = m;
+    MapVecs.next = m;
+    return (char *) base + lead + (m->off - pstart) - hdr;
+}
+
+static void MapVecFree(R_allocator_t *allocator, void *ptr)
+{
+    mapvec_t m = allocator->data;
+    MapVecUnlink(m);
+    if (m->base) munmap(m->base, m->len);
+    else free(ptr);
+    free(m);
+}
+
+static SEXP InMappedVec(R_inpstream_t stream, SEXPTYPE type, R_xlen_t len)
+{
+    membuf_t mb = stream->data;
+    R_size_t nbytes, off;
+    R_allocator_t allocator;
+    mapvec_t m;
+    SEXP s;
+
+    if (SerMap == NULL || SerMap->mb != mb) return NULL;
+    off = mb->count;
+    switch (type) {
+    case LGLSXP:
+    case INTSXP: nbytes = len * sizeof(int); break;
+    case REALSXP: nbytes = len * sizeof(double); break;
+    case CPLXSXP: nbytes = len * sizeof(Rcomplex); break;
+    default: nbytes = len;
+    }
+    if (off + nbytes > mb->size) return NULL;
+    if ((m = malloc(sizeof(struct mapvec_st))) == NULL) return NULL;
+    m->fd = SerMap->fd;
+    m->dev = SerMap->dev;
+    m->ino = SerMap->ino;
+    m->prev = m->next = NULL;
+    m->off = off;
+    m->datasize = (nbytes + 7) / 8 * 8;
+    m->base = NULL;
+    allocator.mem_alloc = &MapVecAlloc;
+    allocator.mem_free = &MapVecFree;
+    allocator.res = NULL;
+    allocator.data = m;
+    s = allocVector3(type, len, &allocator);
+    if (m->base == NULL)
+	memcpy(DATAPTR(s), mb->buf + off, nbytes);
+    mb->count += nbytes;
+    return s;
+}
+
+static void sermap_cleanup(void *data)
+{
+    sermap_t map = data;
+    munmap(map->buf, map->size);
+    close(map->fd);
+    SerMap = map->prev;
+}
+
+/* Unserialize from a mapping of the file 'path' if it is in version 3
+   native binary format: otherwise return FALSE */
+static Rboolean UnserializeFromMap(const char *path,
+				   SEXP (*hook)(SEXP, SEXP), SEXP fun,
+				   SEXP *ans)
+{
+    struct R_inpstream_st in;
+    struct membuf_st mbs;
+    struct sermap_st map;
+    struct stat sb;
+    RCNTXT cntxt;
+    char head[6];
+    int version, fd = open(path, O_RDONLY);
+
+    if (fd < 0) return FALSE;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_size < 14 ||
+	read(fd, head, 6) != 6 || strncmp(head, "B\n", 2) != 0 ||
+	(memcpy(&version, head + 2, sizeof(int)), version != 3)) {
+	close(fd);
+	return FALSE;
+    }
+    map.buf = mmap(NULL, (size_t) sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map.buf == MAP_FAILED) {
+	close(fd);
+	return FALSE;
+    }
+    map.mb = &mbs;
+    map.fd = fd;
+    map.dev = sb.st_dev;
+    map.ino = sb.st_ino;
+    map.size = (R_size_t) sb.st_size;
+    map.prev = SerMap;
+    SerMap = &map;
+    begincontext(&cntxt, CTXT_CCODE, R_NilValue, R_BaseEnv, R_BaseEnv,
+		 R_NilValue, R_NilValue);
+    cntxt.cend = &sermap_cleanup;
+    cntxt.cenddata = &map;
+    InitMemInPStream(&in, &mbs, map.buf, map.size, hook, fun);
+    PROTECT(*ans = R_Unserialize(&in));
+    endcontext(&cntxt);
+    sermap_cleanup(&map);
+    UNPROTECT(1);
+    return TRUE;
+}
+#else
+static SEXP InMappedVec(R_inpstream_t stream, SEXPTYPE type, R_xlen_t len)
+{
+    return NULL;
+}
+
+void attribute_hidden R_DetachMappedFile(const char *path, const char *mode)
+{
+}
+#endif
+
 static SEXP
 R_serialize(SEXP object, SEXP icon, SEXP ascii, SEXP Sversion, SEXP fun)
 {
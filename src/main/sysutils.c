@@ -133,6 +133,7 @@ static wchar_t * wcfixmode(const wchar_t *mode)
 
 FILE *R_fopen(const char *filename, const char *mode)
 {
+    R_DetachMappedFile(filename, mode);
     return(filename ? fopen(filename, fixmode(mode)) : NULL );
 }
 
@@ -204,6 +205,7 @@ FILE *RC_fopen(const SEXP fn, const char *mode, const Rboolean expand)
     if(expand) res = R_ExpandFileName(filename);
     else res = filename;
     vmaxset(vmax);
+    R_DetachMappedFile(res, mode);
     return fopen(res, mode);
 }
 #endif
@@ -807,7 +809,10 @@ static R_INLINE nttype_t needsTranslation(SEXP x) {
 }
 
 static void *latin1_obj = NULL, *utf8_obj=NULL, *ucsmb_obj=NULL,
-    *ucsutf8_obj=NULL;
+    *ucsutf8_obj=NULL, *latin1_utf8_obj = NULL, *native_utf8_obj = NULL;
+
+/* The converters are opened when first needed and kept: those which
+   depend on the locale are closed by invalidate_cached_recodings(). */
 
 /* Translates string in "ans" to native encoding returning it as string
    buffer "cbuff" */
@@ -969,14 +974,20 @@ const char *translateCharUTF8(SEXP x)
     if(IS_BYTES(x))
 	error(_("translating strings with \"bytes\" encoding is not allowed"));
 
-    obj = Riconv_open("UTF-8", IS_LATIN1(x) ? "latin1" : "");
-    if(obj == (void *)(-1))
+    obj = IS_LATIN1(x) ? latin1_utf8_obj : native_utf8_obj;
+    if(!obj) {
+	obj = Riconv_open("UTF-8", IS_LATIN1(x) ? "latin1" : "");
+	if(obj == (void *)(-1))
 #ifdef Win32
-	error(_("unsupported conversion from '%s' in codepage %d"),
-	      "latin1", localeCP);
+	    error(_("unsupported conversion from '%s' in codepage %d"),
+		  "latin1", localeCP);
 #else
-       error(_("unsupported conversion from '%s' to '%s'"), "latin1", "UTF-8");
+	    error(_("unsupported conversion from '%s' to '%s'"),
+		  "latin1", "UTF-8");
 #endif
+	if (IS_LATIN1(x)) latin1_utf8_obj = obj;
+	else native_utf8_obj = obj;
+    }
     R_AllocStringBuffer(0, &cbuff);
 top_of_loop:
     inbuf = ans; inb = strlen(inbuf);
@@ -1000,7 +1011,6 @@ next_char:
 	goto next_char;
     }
     *outbuf = '\0';
-    Riconv_close(obj);
     res = strlen(cbuff.data) + 1;
     p = R_alloc(res, 1);
     memcpy(p, cbuff.data, res);
@@ -1019,7 +1029,7 @@ static const char TO_WCHAR[] = "UCS-4LE";
 # endif
 #endif
 
-static void *latin1_wobj = NULL, *utf8_wobj=NULL;
+static void *latin1_wobj = NULL, *utf8_wobj=NULL, *native_wobj = NULL;
 
 /* Translate from current encoding to wchar_t = UCS-2/4
    NB: that wchar_t is UCS-4 is an assumption, but not easy to avoid.
@@ -1065,14 +1075,20 @@ const wchar_t *wtransChar(SEXP x)
 	    obj = utf8_wobj;
 	knownEnc = TRUE;
     } else {
-	obj = Riconv_open(TO_WCHAR, "");
-	if(obj == (void *)(-1))
+	if(!native_wobj) {
+	    obj = Riconv_open(TO_WCHAR, "");
+	    if(obj == (void *)(-1))
 #ifdef Win32
-	    error(_("unsupported conversion to '%s' from codepage %d"),
-		  TO_WCHAR, localeCP);
+		error(_("unsupported conversion to '%s' from codepage %d"),
+		      TO_WCHAR, localeCP);
 #else
-	    error(_("unsupported conversion from '%s' to '%s'"), "", TO_WCHAR);
+		error(_("unsupported conversion from '%s' to '%s'"),
+		      "", TO_WCHAR);
 #endif
+	    native_wobj = obj;
+	} else
+	    obj = native_wobj;
+	knownEnc = TRUE;
     }
 
     R_AllocStringBuffer(0, &cbuff);
@@ -1346,6 +1362,10 @@ invalidate_cached_recodings(void)
     latin1_obj = NULL;
     utf8_obj = NULL;
     ucsmb_obj = NULL;
+    if (native_utf8_obj) Riconv_close(native_utf8_obj);
+    native_utf8_obj = NULL;
+    if (native_wobj) Riconv_close(native_wobj);
+    native_wobj = NULL;
 #ifdef Win32
     latin1_wobj = NULL;
     utf8_wobj=NULL;
@@ -54,6 +54,7 @@ struct _HashData {
     int nomatch;
     Rboolean useUTF8;
     Rboolean useCache;
+    int fast; /* a HASH_* type of specialised table, or HASH_GENERIC */
 };
 
 
@@ -75,8 +76,17 @@ struct _HashData {
     array and the values.  The values are initially NIL (-1).  O-based
     indices are inserted by isDuplicated, and invalidated by setting
     to NA_INTEGER.
+
+    For integer and double keys, and strings compared by address, the
+    table is specialised to the type: each slot is a pair (index,
+    fingerprint) where the fingerprint is the key itself for integers
+    and the hash value before scattering otherwise.  Probes compare the
+    fingerprint first, so only rarely look at the vector itself, and do
+    not go through the hash and equal functions.
 */
 
+enum { HASH_GENERIC = 0, HASH_INT, HASH_REAL, HASH_STR };
+
 static hlen scatter(unsigned int key, HashData *d)
 {
     return 3141592653U * key >> (32 - d->K);
@@ -103,25 +113,29 @@ union foo {
     unsigned int u[2];
 };
 
-static hlen rhash(SEXP x, R_xlen_t indx, HashData *d)
+static R_INLINE unsigned int rkey(double x)
 {
     /* There is a problem with signed 0s under IEC60559 */
-    double tmp = (REAL(x)[indx] == 0.0) ? 0.0 : REAL(x)[indx];
+    double tmp = (x == 0.0) ? 0.0 : x;
     /* need to use both 32-byte chunks or endianness is an issue */
     /* we want all NaNs except NA equal, and all NAs equal */
-    if (R_IsNA(tmp)) tmp = NA_REAL;
-    else if (R_IsNaN(tmp)) tmp = R_NaN;
+    if (ISNAN(tmp)) tmp = R_IsNA(tmp) ? NA_REAL : R_NaN;
 #if 2*SIZEOF_INT == SIZEOF_DOUBLE
     {
 	union foo tmpu;
 	tmpu.d = tmp;
-	return scatter(tmpu.u[0] + tmpu.u[1], d);
+	return tmpu.u[0] + tmpu.u[1];
     }
 #else
-    return scatter(*((unsigned int *) (&tmp)), d);
+    return *((unsigned int *) (&tmp));
 #endif
 }
 
+static hlen rhash(SEXP x, R_xlen_t indx, HashData *d)
+{
+    return scatter(rkey(REAL(x)[indx]), d);
+}
+
 static Rcomplex unify_complex_na(Rcomplex z) {
     Rcomplex ans;
     ans.r = (z.r == 0.0) ? 0.0 : z.r;
@@ -156,14 +170,19 @@ static hlen chash(SEXP x, R_xlen_t indx, HashData *d)
 
 /* Hash CHARSXP by address.  Hash values are int, For 64bit pointers,
  * we do (upper ^ lower) */
-static hlen cshash(SEXP x, R_xlen_t indx, HashData *d)
+static R_INLINE unsigned int skey(SEXP s)
 {
-    intptr_t z = (intptr_t) STRING_ELT(x, indx);
+    intptr_t z = (intptr_t) s;
     unsigned int z1 = (unsigned int)(z & 0xffffffff), z2 = 0;
 #if SIZEOF_LONG == 8
     z2 = (unsigned int)(z/0x100000000L);
 #endif
-    return scatter(z1 ^ z2, d);
+    return z1 ^ z2;
+}
+
+static hlen cshash(SEXP x, R_xlen_t indx, HashData *d)
+{
+    return scatter(skey(STRING_ELT(x, indx)), d);
 }
 
 static hlen shash(SEXP x, R_xlen_t indx, HashData *d)
@@ -205,6 +224,12 @@ static int requal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
     else return 0;
 }
 
+/* the same for two doubles, as used for tables with fingerprints */
+static R_INLINE int req(double x, double y)
+{
+    return x == y || (ISNAN(x) && ISNAN(y) && R_IsNA(x) == R_IsNA(y));
+}
+
 /* This is differentiating {NA,1}, {NA,0}, {NA, NaN}, {NA, NA},
  * but R's print() and format()  render all as "NA" */
 static int cplx_eq(Rcomplex x, Rcomplex y)
@@ -348,10 +373,13 @@ static void MKsetup(R_xlen_t n, HashData *d, R_xlen_t nmax)
 }
 
 #define IMAX 4294967296L
-static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
+/* Choose the hash and equality functions and the table size for x, but
+   do not allocate the table. */
+static void HashTableInit(SEXP x, HashData *d, R_xlen_t nmax)
 {
     d->useUTF8 = FALSE;
     d->useCache = TRUE;
+    d->fast = HASH_GENERIC;
     switch (TYPEOF(x)) {
     case LGLSXP:
 	d->hash = lhash;
@@ -363,6 +391,7 @@ static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
     {
 	d->hash = ihash;
 	d->equal = iequal;
+	d->fast = HASH_INT;
 #ifdef LONG_VECTOR_SUPPORT
 	R_xlen_t nn = XLENGTH(x);
 	if (nn > IMAX) nn = IMAX;
@@ -375,6 +404,7 @@ static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
     case REALSXP:
 	d->hash = rhash;
 	d->equal = requal;
+	d->fast = HASH_REAL;
 	MKsetup(XLENGTH(x), d, nmax);
 	break;
     case CPLXSXP:
@@ -385,6 +415,7 @@ static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
     case STRSXP:
 	d->hash = shash;
 	d->equal = sequal;
+	d->fast = HASH_STR;
 	MKsetup(XLENGTH(x), d, nmax);
 	break;
     case RAWSXP:
@@ -403,23 +434,108 @@ static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
     }
 #ifdef LONG_VECTOR_SUPPORT
     d->isLong = IS_LONG_VEC(x);
+    if (d->isLong) d->fast = HASH_GENERIC;
+#endif
+}
+
+/* Strings can only be compared by address when hashed by address;
+   so this depends on useUTF8 and useCache, which must be set before
+   the table is allocated. */
+static void HashTableMode(HashData *d)
+{
+    if (d->fast == HASH_STR && (d->useUTF8 || !d->useCache))
+	d->fast = HASH_GENERIC;
+}
+
+static void HashTableAlloc(HashData *d)
+{
+    HashTableMode(d);
+#ifdef LONG_VECTOR_SUPPORT
     if (d->isLong) {
 	d->HashTable = allocVector(REALSXP, (R_xlen_t) d->M);
 	for (R_xlen_t i = 0; i < d->M; i++) REAL(d->HashTable)[i] = NIL;
     } else
 #endif
-    {
+    if (d->fast) {
+	d->HashTable = allocVector(INTSXP, 2 * (R_xlen_t) d->M);
+	int *h = INTEGER(d->HashTable);
+	for (hlen i = 0; i < d->M; i++) {
+	    h[2*i] = NIL;
+	    h[2*i + 1] = 0;
+	}
+    } else {
 	d->HashTable = allocVector(INTSXP, (R_xlen_t) d->M);
 	for (R_xlen_t i = 0; i < d->M; i++) INTEGER(d->HashTable)[i] = NIL;
     }
 }
 
+static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
+{
+    HashTableInit(x, d, nmax);
+    HashTableAlloc(d);
+}
+
+/* Probe a specialised table for element indx of x: return the slot
+   holding an equal element of table, or the empty slot where it would
+   be inserted, with its fingerprint in *fp.  Invalidated entries do
+   not match. */
+static R_INLINE hlen
+fastProbe(SEXP table, SEXP x, R_xlen_t indx, HashData *d, int *fp)
+{
+    const int *h = INTEGER(d->HashTable);
+    hlen i, mask = d->M - 1;
+
+    switch (d->fast) {
+    case HASH_INT:
+    {
+	int key = INTEGER(x)[indx];
+	*fp = key;
+	for (i = scatter((unsigned int) key, d); h[2*i] != NIL;
+	     i = (i + 1) & mask)
+	    if (h[2*i + 1] == key && h[2*i] >= 0) break;
+	break;
+    }
+    case HASH_REAL:
+    {
+	double key = REAL(x)[indx];
+	const double *t = REAL(table);
+	unsigned int k = rkey(key);
+	*fp = (int) k;
+	for (i = scatter(k, d); h[2*i] != NIL; i = (i + 1) & mask)
+	    if (h[2*i + 1] == *fp && h[2*i] >= 0 && req(t[h[2*i]], key))
+		break;
+	break;
+    }
+    default: /* HASH_STR */
+    {
+	SEXP key = STRING_ELT(x, indx);
+	const SEXP *t = STRING_PTR(table);
+	unsigned int k = skey(key);
+	*fp = (int) k;
+	for (i = scatter(k, d); h[2*i] != NIL; i = (i + 1) & mask)
+	    if (h[2*i + 1] == *fp && h[2*i] >= 0 && t[h[2*i]] == key)
+		break;
+	break;
+    }
+    }
+    return i;
+}
+
 /* Open address hashing */
 /* Collision resolution is by linear probing */
 /* The table is guaranteed large so this is sufficient */
 
 static int isDuplicated(SEXP x, R_xlen_t indx, HashData *d)
 {
+    if (d->fast) {
+	int fp, *h = INTEGER(d->HashTable);
+	hlen i = fastProbe(x, x, indx, d, &fp);
+	if (h[2*i] != NIL) return 1;
+	if (d->nmax-- < 0) error("hash table is full");
+	h[2*i] = (int) indx;
+	h[2*i + 1] = fp;
+	return 0;
+    }
 #ifdef LONG_VECTOR_SUPPORT
     if (d->isLong) {
 	double *h = REAL(d->HashTable);
@@ -449,6 +565,13 @@ static int isDuplicated(SEXP x, R_xlen_t indx, HashData *d)
 
 static void removeEntry(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
 {
+    if (d->fast) {
+	int fp, *h = INTEGER(d->HashTable);
+	hlen i = fastProbe(table, x, indx, d, &fp);
+	if (h[2*i] != NIL)
+	    h[2*i] = NA_INTEGER;  /* < 0, only index values are inserted */
+	return;
+    }
 #ifdef LONG_VECTOR_SUPPORT
     if (d->isLong) {
 	double *h = REAL(d->HashTable);
@@ -477,7 +600,7 @@ static void removeEntry(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
 
 #define DUPLICATED_INIT						\
     HashData data;						\
-    HashTableSetup(x, &data, nmax);				\
+    HashTableInit(x, &data, nmax);				\
     if(TYPEOF(x) == STRSXP) {					\
 	data.useUTF8 = FALSE; data.useCache = TRUE;		\
 	for(i = 0; i < n; i++) {				\
@@ -491,7 +614,8 @@ static void removeEntry(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
 		data.useCache = FALSE; break;			\
 	    }							\
 	}							\
-    }
+    }								\
+    HashTableAlloc(&data);
 
 /* used in scan() */
 SEXP duplicated(SEXP x, Rboolean from_last)
@@ -662,6 +786,177 @@ R_xlen_t any_duplicated3(SEXP x, SEXP incomp, Rboolean from_last)
 #undef DUPLICATED_INIT
 
 
+/* The hash tables of large vectors used as the 'table' of match() are
+   cached, so that matching repeatedly against the same vector (as in
+   joins, or x %in% table in a loop) does not rebuild them each time.
+   duplicated(), unique() and anyDuplicated() of such a vector also use
+   its table.
+
+   R_MatchCache is a VECSXP of MATCH_CACHE_SIZE triples (vector, hash
+   table, info).  The garbage collector references the vectors only
+   weakly, dropping their entries when they become unreachable (see
+   RunGenCollect).  The vector may since have been modified in place,
+   so the info records its length, data pointer and a fingerprint of
+   its contents, which are checked before the table is used: the
+   fingerprint takes one pass over the data, much less than hashing
+   it.  When the cache is full the least recently used entry is
+   replaced. */
+
+#define MATCH_CACHE_SIZE 4
+#define MATCH_CACHE_MIN 10000
+
+/* flags */
+#define MC_KNOWN 1	/* has strings in a declared encoding */
+#define MC_UTF8 2	/* hashed after translation to UTF-8 */
+
+static unsigned int match_cache_used[MATCH_CACHE_SIZE], match_cache_clock = 0;
+
+static Rboolean matchCacheable(SEXP x)
+{
+    if (XLENGTH(x) < MATCH_CACHE_MIN || OBJECT(x)) return FALSE;
+#ifdef LONG_VECTOR_SUPPORT
+    if (IS_LONG_VEC(x)) return FALSE;
+#endif
+    switch (TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP:
+    case CPLXSXP:
+    case STRSXP:
+    case RAWSXP:
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
+/* -1 if some element of the character vector x is "bytes"-encoded or
+   not in the CHARSXP cache (so this case is not cached), otherwise
+   MC_KNOWN or 0 */
+static int stringFlags(SEXP x)
+{
+    int flags = 0;
+    for (R_xlen_t i = 0; i < XLENGTH(x); i++) {
+	SEXP s = STRING_ELT(x, i);
+	if (IS_BYTES(s) || !IS_CACHED(s)) return -1;
+	if (ENC_KNOWN(s)) flags = MC_KNOWN;
+    }
+    return flags;
+}
+
+/* the info of an entry: flags, then the length, data pointer and
+   fingerprint of the vector */
+typedef struct {
+    int flags;
+    R_xlen_t len;
+    void *data;
+    uint64_t stamp;
+} match_cache_info;
+
+#define MATCH_CACHE_TABLE(k) VECTOR_ELT(R_MatchCache, 3 * (k) + 1)
+#define MATCH_CACHE_INFO(k) \
+    ((match_cache_info *) RAW(VECTOR_ELT(R_MatchCache, 3 * (k) + 2)))
+#define MATCH_CACHE_FLAGS(k) (MATCH_CACHE_INFO(k)->flags)
+
+/* Each step is a bijection of the state, so a change to any one word
+   of the data always changes the fingerprint. */
+static uint64_t matchStamp(SEXP x)
+{
+    size_t n, i;
+    const unsigned char *p = (const unsigned char *) DATAPTR(x);
+    uint64_t h = 0, w;
+
+    switch (TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP: n = XLENGTH(x) * sizeof(int); break;
+    case REALSXP: n = XLENGTH(x) * sizeof(double); break;
+    case CPLXSXP: n = XLENGTH(x) * sizeof(Rcomplex); break;
+    case STRSXP: n = XLENGTH(x) * sizeof(SEXP); break;
+    default: n = XLENGTH(x);
+    }
+    for (i = 0; i + sizeof(w) <= n; i += sizeof(w)) {
+	memcpy(&w, p + i, sizeof(w));
+	h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    }
+    if (i < n) {
+	w = 0;
+	memcpy(&w, p + i, n - i);
+	h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    }
+    return h;
+}
+
+/* the slot of x, if any, whether or not its entry is still valid */
+static int matchCacheSlot(SEXP x)
+{
+    if (R_MatchCache != NULL)
+	for (int k = 0; k < MATCH_CACHE_SIZE; k++)
+	    if (VECTOR_ELT(R_MatchCache, 3 * k) == x)
+		return k;
+    return -1;
+}
+
+/* the slot of x if it has a valid entry, otherwise -1 */
+static int matchCacheFind(SEXP x)
+{
+    int k = matchCacheSlot(x);
+
+    if (k >= 0) {
+	match_cache_info *info = MATCH_CACHE_INFO(k);
+	if (info->len != XLENGTH(x) || info->data != DATAPTR(x) ||
+	    info->stamp != matchStamp(x)) {
+	    /* modified in place */
+	    SET_VECTOR_ELT(R_MatchCache, 3 * k, R_NilValue);
+	    SET_VECTOR_ELT(R_MatchCache, 3 * k + 1, R_NilValue);
+	    SET_VECTOR_ELT(R_MatchCache, 3 * k + 2, R_NilValue);
+	    return -1;
+	}
+	match_cache_used[k] = ++match_cache_clock;
+    }
+    return k;
+}
+
+/* x and hashtab must be protected by the caller */
+static void matchCacheStore(SEXP x, SEXP hashtab, int flags)
+{
+    if (R_MatchCache == NULL)
+	R_MatchCache = allocVector(VECSXP, 3 * MATCH_CACHE_SIZE);
+    SEXP sinfo = allocVector(RAWSXP, sizeof(match_cache_info));
+    match_cache_info *info = (match_cache_info *) RAW(sinfo);
+    info->flags = flags;
+    info->len = XLENGTH(x);
+    info->data = DATAPTR(x);
+    info->stamp = matchStamp(x);
+    int k = matchCacheSlot(x);
+    if (k < 0) {
+	k = 0;
+	for (int j = 1; j < MATCH_CACHE_SIZE; j++)
+	    if (match_cache_used[j] < match_cache_used[k]) k = j;
+    }
+    SET_VECTOR_ELT(R_MatchCache, 3 * k, x);
+    SET_VECTOR_ELT(R_MatchCache, 3 * k + 1, hashtab);
+    SET_VECTOR_ELT(R_MatchCache, 3 * k + 2, sinfo);
+    match_cache_used[k] = ++match_cache_clock;
+}
+
+/* duplicated(x) from the cached hash table of x: its entries are the
+   indices of the first occurrences */
+static SEXP cachedDuplicated(SEXP x, int k)
+{
+    R_xlen_t n = XLENGTH(x);
+    SEXP ans = allocVector(LGLSXP, n);
+    SEXP h = MATCH_CACHE_TABLE(k);
+    HashData data;
+    HashTableInit(x, &data, NA_INTEGER);
+    data.useUTF8 = (MATCH_CACHE_FLAGS(k) & MC_UTF8) != 0;
+    HashTableMode(&data);
+    int *v = LOGICAL(ans), *hp = INTEGER(h), step = data.fast ? 2 : 1;
+    for (R_xlen_t i = 0; i < n; i++) v[i] = 1;
+    for (R_xlen_t i = 0; i < XLENGTH(h); i += step)
+	if (hp[i] >= 0) v[hp[i]] = 0;
+    return ans;
+}
+
 /* .Internal(duplicated(x))	  [op=0]
   .Internal(unique(x))		  [op=1]
    .Internal(anyDuplicated(x))	  [op=2]
@@ -700,6 +995,7 @@ SEXP attribute_hidden do_duplicated(SEXP call, SEXP op, SEXP args, SEXP env)
 	    error(_("'nmax' must be positive"));
     }
 
+    int slot;
     if(length(incomp) && /* S has FALSE to mean empty */
        !(isLogical(incomp) && length(incomp) == 1 && LOGICAL(incomp)[0] == 0)) {
 	if(PRIMVAL(op) == 2) {
@@ -710,6 +1006,16 @@ SEXP attribute_hidden do_duplicated(SEXP call, SEXP op, SEXP args, SEXP env)
 	} else
 	    dup = duplicated3(x, incomp, fL, nmax);
     }
+    else if (!fL && nmax == NA_INTEGER && matchCacheable(x) &&
+	     (slot = matchCacheFind(x)) >= 0) {
+	/* x is the table of a cached match() */
+	dup = cachedDuplicated(x, slot);
+	if(PRIMVAL(op) == 2) {
+	    for (i = 0; i < n; i++)
+		if (LOGICAL(dup)[i]) break;
+	    return ScalarInteger(i < n ? (int) i + 1 : 0);
+	}
+    }
     else {
 	if(PRIMVAL(op) == 2) {
 	    R_xlen_t ind  = any_duplicated(x, fL);
@@ -794,6 +1100,11 @@ static void UndoHashing(SEXP x, SEXP table, HashData *d)
 static int Lookup(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
 {
     int *h = INTEGER(d->HashTable);
+    if (d->fast) {
+	int fp;
+	hlen i = fastProbe(table, x, indx, d, &fp);
+	return h[2*i] != NIL ? h[2*i] + 1 : d->nomatch;
+    }
     hlen i = d->hash(x, indx, d);
     while (h[i] != NIL) {
 	if (d->equal(table, h[i], x, indx))
@@ -803,17 +1114,30 @@ static int Lookup(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
     return d->nomatch;
 }
 
-/* Now do the table lookup */
-static SEXP HashLookup(SEXP table, SEXP x, HashData *d)
+/* minimum length of x for looking up in parallel */
+#define MATCH_PARALLEL_MIN 100000
+
+/* Now do the table lookup.  Lookup() only reads the hash table, so if
+   the hash and equality functions cannot allocate (as they can when
+   strings need translation or lists are compared) the caller can
+   allow a long x to be looked up by several threads. */
+static SEXP HashLookup(SEXP table, SEXP x, HashData *d, Rboolean parallel)
 {
     SEXP ans;
     R_xlen_t i, n;
 
     n = XLENGTH(x);
     PROTECT(ans = allocVector(INTSXP, n));
+    int *pa = INTEGER(ans);
+#ifdef _OPENMP
+    int nthreads = 1;
+    if (parallel && n >= MATCH_PARALLEL_MIN && R_num_math_threads > 1)
+	nthreads = R_num_math_threads;
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+#endif
     for (i = 0; i < n; i++) {
 //	if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	INTEGER(ans)[i] = Lookup(table, x, i, d);
+	pa[i] = Lookup(table, x, i, d);
     }
     UNPROTECT(1);
     return ans;
@@ -855,20 +1179,25 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 
     int nprot = 0;
     PROTECT(x	  = match_transform(ix,	    env)); nprot++;
-    PROTECT(table = match_transform(itable, env)); nprot++;
-    /* or should we use PROTECT_WITH_INDEX and REPROTECT below ? */
+    /* A cacheable table is not an object, so is unchanged by
+       match_transform() */
+    Rboolean cache = !incomp && matchCacheable(itable);
 
     /* Coerce to a common type; type == NILSXP is ok here.
      * Note that above we coerce factors and "POSIXlt", only to character.
      * Hence, coerce to character or to `higher' type
      * (given that we have "Vector" or NULL) */
+    table = cache ? itable : match_transform(itable, env);
+    PROTECT(table); nprot++;
     if(TYPEOF(x) >= STRSXP || TYPEOF(table) >= STRSXP) type = STRSXP;
     else type = TYPEOF(x) < TYPEOF(table) ? TYPEOF(table) : TYPEOF(x);
+    if (TYPEOF(table) != type) cache = FALSE;
     PROTECT(x	  = coerceVector(x,	type)); nprot++;
     PROTECT(table = coerceVector(table, type)); nprot++;
+    int k = cache ? matchCacheFind(table) : -1;
 
     // special case scalar x -- for speed only :
-    if(LENGTH(x) == 1 && !incomp && TYPEOF(table) != CPLXSXP) {
+    if(LENGTH(x) == 1 && !incomp && TYPEOF(table) != CPLXSXP && k < 0) {
       PROTECT(ans = ScalarInteger(nmatch)); nprot++;
       switch (type) {
       case STRSXP: {
@@ -924,9 +1253,32 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
     }
     else { // regular case
 
+    int flags = 0;
+    if (cache && type == STRSXP) {
+	int xflags = stringFlags(x),
+	    tflags = (k >= 0) ? (MATCH_CACHE_FLAGS(k) & MC_KNOWN) : stringFlags(table);
+	if (xflags < 0 || tflags < 0) cache = FALSE;
+	else flags = tflags | ((xflags | tflags) ? MC_UTF8 : 0);
+    }
     if (incomp) { PROTECT(incomp = coerceVector(incomp, type)); nprot++; }
     data.nomatch = nmatch;
-    HashTableSetup(table, &data, NA_INTEGER);
+    if (cache) {
+	HashTableInit(table, &data, NA_INTEGER);
+	data.useUTF8 = (flags & MC_UTF8) != 0;
+	data.useCache = TRUE;
+	if (k >= 0 && MATCH_CACHE_FLAGS(k) == flags) {
+	    HashTableMode(&data);
+	    data.HashTable = MATCH_CACHE_TABLE(k);
+	} else {
+	    HashTableAlloc(&data);
+	    PROTECT(data.HashTable); nprot++;
+	    DoHashing(table, &data);
+	    matchCacheStore(table, data.HashTable, flags);
+	}
+	/* translation is only needed with MC_UTF8 */
+	ans = HashLookup(table, x, &data, type != STRSXP || flags == 0);
+    } else {
+    HashTableInit(table, &data, NA_INTEGER);
     if(type == STRSXP) {
 	Rboolean useBytes = FALSE;
 	Rboolean useUTF8 = FALSE;
@@ -966,10 +1318,13 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 	data.useUTF8 = useUTF8;
 	data.useCache = useCache;
     }
+    HashTableAlloc(&data);
     PROTECT(data.HashTable); nprot++;
     DoHashing(table, &data);
     if (incomp) UndoHashing(incomp, table, &data);
-    ans = HashLookup(table, x, &data);
+    ans = HashLookup(table, x, &data,
+		     data.fast || (type != STRSXP && type != VECSXP));
+    }
   }
     UNPROTECT(nprot);
     return ans;
@@ -1116,8 +1471,9 @@ SEXP attribute_hidden do_pmatch(SEXP call, SEXP op, SEXP args, SEXP env)
 	}
     } else {
 	HashData data;
-	HashTableSetup(target, &data, NA_INTEGER);
+	HashTableInit(target, &data, NA_INTEGER);
 	data.useUTF8 = useUTF8;
+	HashTableAlloc(&data);
 	data.nomatch = 0;
 	DoHashing(target, &data);
 	for (R_xlen_t i = 0; i < n_input; i++) {
@@ -1462,7 +1818,8 @@ rowsum(SEXP x, SEXP g, SEXP uniqueg, SEXP snarm, SEXP rn)
     HashTableSetup(uniqueg, &data, NA_INTEGER);
     PROTECT(data.HashTable);
     DoHashing(uniqueg, &data);
-    PROTECT(matches = HashLookup(uniqueg, g, &data));
+    PROTECT(matches = HashLookup(uniqueg, g, &data, data.fast ||
+				 (TYPEOF(g) != STRSXP && TYPEOF(g) != VECSXP)));
 
     PROTECT(ans = allocMatrix(TYPEOF(x), ng, p));
 
@@ -1533,7 +1890,8 @@ rowsum_df(SEXP x, SEXP g, SEXP uniqueg, SEXP snarm, SEXP rn)
     HashTableSetup(uniqueg, &data, NA_INTEGER);
     PROTECT(data.HashTable);
     DoHashing(uniqueg, &data);
-    PROTECT(matches = HashLookup(uniqueg, g, &data));
+    PROTECT(matches = HashLookup(uniqueg, g, &data, data.fast ||
+				 (TYPEOF(g) != STRSXP && TYPEOF(g) != VECSXP)));
 
     PROTECT(ans = allocVector(VECSXP, p));
 
@@ -1616,7 +1974,9 @@ static SEXP duplicated2(SEXP x, HashData *d)
     int i, n;
 
     n = LENGTH(x);
-    HashTableSetup(x, d, NA_INTEGER);
+    HashTableInit(x, d, NA_INTEGER);
+    d->fast = HASH_GENERIC; /* isDuplicated2 uses the generic table */
+    HashTableAlloc(d);
     PROTECT(d->HashTable);
     PROTECT(ans = allocVector(INTSXP, n));
 
@@ -1711,9 +2071,11 @@ static void HashTableSetup1(SEXP x, HashData *d)
 #ifdef LONG_VECTOR_SUPPORT
     d->isLong = FALSE;
 #endif
+    d->useUTF8 = FALSE;
+    d->useCache = TRUE;
+    d->fast = HASH_STR; /* which also compares addresses */
     MKsetup(LENGTH(x), d, NA_INTEGER);
-    d->HashTable = allocVector(INTSXP, (R_xlen_t) d->M);
-    for (R_xlen_t i = 0; i < d->M; i++) INTEGER(d->HashTable)[i] = NIL;
+    HashTableAlloc(d);
 }
 
 /* used in utils */
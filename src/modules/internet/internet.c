@@ -161,6 +161,7 @@ static Rboolean url_open(Rconnection con)
     else con->text = TRUE;
     con->save = -1000;
     set_iconv(con);
+    set_buffer(con);
     return TRUE;
 }
 
@@ -282,6 +283,7 @@ static Rboolean url_open2(Rconnection con)
     else con->text = TRUE;
     con->save = -1000;
     set_iconv(con);
+    set_buffer(con);
     return TRUE;
 }
 
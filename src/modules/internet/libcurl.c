@@ -770,6 +770,7 @@ static Rboolean Curl_open(Rconnection con)
     else con->text = TRUE;
     con->save = -1000;
     set_iconv(con);
+    set_buffer(con);
     return TRUE;
 }
 